@@ -0,0 +1,249 @@
+/**
+ * @file qlog-bench.cpp
+ * @brief Measures the throughput of the loggers and the latency seen by the logging threads
+ *
+ * Usage: qlog-bench [-a] [-w sleep|spin|poll] [-t threads] [-n messages]
+ *
+ * Every combination of sink (null, ostringstream, file), message shape
+ * (literal, numbers, colored, decorated) and filtering is run with 1, 2, 4...
+ * logging threads, up to the given number (the number of processors by
+ * default). Each thread logs the given number of messages (100000 by
+ * default). With -a, the loggers hand their messages to the writer thread of
+ * the asynchronous mode, which waits for them as -w says (see
+ * qlog::set_writer_wait()).
+ *
+ * Each run prints one JSON object on a line of its own, so that the results
+ * of two versions of qlog.hpp can be compared by a script (split here):
+ * @code
+ * {"sink":"null","shape":"numbers","filtered":false,"async":false,"threads":2,"messages":200000,
+ *  "seconds":0.0291,"messages_per_second":6872852,"p50_ns":112,"p99_ns":310,"p999_ns":2051,"max_ns":48210}
+ * @endcode
+ *
+ * The latencies are measured around each call, reading the clock included.
+ * The throughput is computed from the time all the threads took, flush()
+ * included.
+ */
+#define QLOG_MULTITHREAD_CPP11
+#define QLOG_ASYNC
+#include "qlog.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include <fcntl.h>
+
+typedef std::chrono::steady_clock bench_clock;
+
+/**@brief What the loggers write to when only the cost of qlog itself is measured */
+struct null_sink : public qlog::sink
+{
+    virtual void write( const char *, size_t ) { }
+    virtual void flush() { }
+};
+
+namespace shape
+{
+    enum { literal, numbers, colored, decorated, count };
+    static const char * const names[count] = { "literal", "numbers", "colored", "decorated" };
+}
+
+namespace output
+{
+    enum { null, ostringstream, file, count };
+    static const char * const names[count] = { "null", "ostringstream", "file" };
+}
+
+static
+void log_message( unsigned _shape, unsigned _index )
+{
+    switch( _shape )
+    {
+    case shape::literal:
+        qlog::info << "a message made of a single string literal\n";
+        break;
+    case shape::numbers:
+        qlog::info << "request " << _index << " took " << 0.25 * _index << " ms, status " << -1 << '\n';
+        break;
+    case shape::colored:
+        qlog::info << qlog::color( qlog::red ) << "error" << qlog::color() << " in request " << _index << '\n';
+        break;
+    default:
+        // the decorations are set by run()
+        qlog::info << "request " << _index << '\n';
+        break;
+    }
+}
+
+/**@brief Logs the messages of a thread, timing each one */
+static
+void log_messages( unsigned _shape, unsigned _messages, std::atomic<unsigned> * _ready, unsigned _threads,
+                   std::vector<unsigned> * _latencies )
+{
+    _latencies->resize( _messages );
+
+    // every thread starts at the same time
+    _ready->fetch_add( 1 );
+    while( _ready->load() < _threads )
+        std::this_thread::yield();
+
+    for( unsigned i = 0; i < _messages; ++i )
+    {
+        const bench_clock::time_point start = bench_clock::now();
+        log_message( _shape, i );
+        const bench_clock::time_point end = bench_clock::now();
+        ( *_latencies )[i] = static_cast<unsigned>( std::chrono::duration_cast<std::chrono::nanoseconds>( end - start ).count() );
+    }
+}
+
+static
+unsigned percentile( std::vector<unsigned> & _latencies, double _fraction )
+{
+    const size_t index = static_cast<size_t>( _fraction * static_cast<double>( _latencies.size() - 1 ) );
+    std::nth_element( _latencies.begin(), _latencies.begin() + static_cast<std::ptrdiff_t>( index ), _latencies.end() );
+    return _latencies[index];
+}
+
+static
+void run( unsigned _output, unsigned _shape, bool _filtered, bool _async, unsigned _threads, unsigned _messages )
+{
+    // what the loggers are left with between two runs
+    static null_sink discard;
+    std::ostringstream text;
+    char path[] = "/tmp/qlog-bench.XXXXXX";
+    const int fd = ( output::file == _output ) ? mkstemp( path ) : -1;
+    qlog::fd_sink file( fd );
+
+    if( output::null == _output )
+        qlog::set_output( discard );
+    else if( output::ostringstream == _output )
+        qlog::set_output( text );
+    else
+        qlog::set_output( file );
+
+    qlog::set_loglevel( _filtered ? qlog::loglevel::warning : qlog::loglevel::info );
+    if( shape::decorated == _shape )
+    {
+        qlog::info.prepend() << qlog::timestamp( 3 ) << " [" << qlog::thread_id() << "] " << qlog::level_tag() << ": ";
+        qlog::info.append() << " (bench)";
+    }
+
+    std::atomic<unsigned> ready( 0 );
+    std::vector< std::vector<unsigned> > latencies( _threads );
+    std::vector<std::thread> threads;
+
+    const bench_clock::time_point start = bench_clock::now();
+    for( unsigned i = 0; i < _threads; ++i )
+        threads.push_back( std::thread( log_messages, _shape, _messages, &ready, _threads, &latencies[i] ) );
+    for( unsigned i = 0; i < _threads; ++i )
+        threads[i].join();
+    qlog::flush();
+    const double seconds = std::chrono::duration<double>( bench_clock::now() - start ).count();
+
+    qlog::info.prepend().reset();
+    qlog::info.append().reset();
+    qlog::set_output( discard );
+    if( fd >= 0 )
+    {
+        close( fd );
+        unlink( path );
+    }
+
+    std::vector<unsigned> all;
+    all.reserve( static_cast<size_t>( _threads ) * _messages );
+    for( unsigned i = 0; i < _threads; ++i )
+        all.insert( all.end(), latencies[i].begin(), latencies[i].end() );
+
+    const unsigned long total = static_cast<unsigned long>( all.size() );
+    const unsigned p50 = percentile( all, 0.5 );
+    const unsigned p99 = percentile( all, 0.99 );
+    const unsigned p999 = percentile( all, 0.999 );
+    const unsigned longest = *std::max_element( all.begin(), all.end() );
+
+    std::cout << "{\"sink\":\"" << output::names[_output] << "\",\"shape\":\"" << shape::names[_shape]
+              << "\",\"filtered\":" << ( _filtered ? "true" : "false" ) << ",\"async\":" << ( _async ? "true" : "false" )
+              << ",\"threads\":" << _threads << ",\"messages\":" << total
+              << ",\"seconds\":" << seconds << ",\"messages_per_second\":" << static_cast<unsigned long>( total / seconds )
+              << ",\"p50_ns\":" << p50 << ",\"p99_ns\":" << p99 << ",\"p999_ns\":" << p999 << ",\"max_ns\":" << longest
+              << "}" << std::endl;
+}
+
+/**@brief Reads the wait strategy of -w */
+static
+bool parse_wait( const char * _name, unsigned & _wait )
+{
+    static const char * const names[] = { "sleep", "spin", "poll" };
+    static const unsigned strategies[] = { qlog::writer_wait::sleep, qlog::writer_wait::spin_then_sleep, qlog::writer_wait::busy_poll };
+    for( size_t i = 0; i < sizeof( names ) / sizeof( *names ); ++i )
+    {
+        if( 0 == std::strcmp( _name, names[i] ) )
+        {
+            _wait = strategies[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+int main( int argc, char ** argv )
+{
+    bool async = false;
+    unsigned wait = qlog::writer_wait::sleep;
+    unsigned max_threads = std::thread::hardware_concurrency();
+    unsigned messages = 100000;
+    for( int i = 1; i < argc; ++i )
+    {
+        if( 0 == std::strcmp( argv[i], "-a" ) )
+            async = true;
+        else if( 0 == std::strcmp( argv[i], "-w" ) && i + 1 < argc && parse_wait( argv[i + 1], wait ) )
+            ++i;
+        else if( 0 == std::strcmp( argv[i], "-t" ) && i + 1 < argc )
+            max_threads = static_cast<unsigned>( std::atoi( argv[++i] ) );
+        else if( 0 == std::strcmp( argv[i], "-n" ) && i + 1 < argc )
+            messages = static_cast<unsigned>( std::atoi( argv[++i] ) );
+        else
+        {
+            std::cerr << "usage: qlog-bench [-a] [-w sleep|spin|poll] [-t threads] [-n messages]" << std::endl;
+            return 2;
+        }
+    }
+    if( 0 == max_threads )
+        max_threads = 1;
+    if( 0 == messages )
+        messages = 1;
+
+    if( async )
+    {
+        qlog::set_async( 16384, qlog::overflow::block );
+        qlog::set_writer_wait( wait );
+    }
+    if( !qlog::init() )
+    {
+        std::cerr << "qlog-bench: cannot initialize qlog" << std::endl;
+        return 1;
+    }
+
+    for( unsigned o = 0; o < output::count; ++o )
+    {
+        for( unsigned s = 0; s < shape::count; ++s )
+        {
+            for( int filtered = 1; filtered >= 0; --filtered )
+            {
+                for( unsigned threads = 1; ; threads *= 2 )
+                {
+                    threads = threads < max_threads ? threads : max_threads;
+                    run( o, s, 0 != filtered, async, threads, messages );
+                    if( threads == max_threads )
+                        break;
+                }
+            }
+        }
+    }
+
+    qlog::destroy();
+    return 0;
+}
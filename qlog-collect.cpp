@@ -0,0 +1,193 @@
+/**
+ * @file qlog-collect.cpp
+ * @brief Reads the ring of a qlog::shm_ring_sink and writes it to a file or to syslog
+ *
+ * Usage: qlog-collect [-x] [-s ident] name [file]
+ *
+ * The messages are appended to the file, or written to the standard output
+ * if none is given. With -s, each line is sent to syslog(3) instead, with
+ * the given identity. The collector waits for the ring to be created, and
+ * follows the next ring of the same name once the program writing to it is
+ * gone; with -x, it exits instead, after reading what was left. SIGINT and
+ * SIGTERM make it read what is left and exit.
+ *
+ * Binary records (see qlog::binary_sink) are written as they are, for
+ * qlog-decode to read: do not send them to syslog.
+ */
+#include "qlog.hpp"
+#include <iostream>
+#include <string>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <syslog.h>
+
+static volatile sig_atomic_t stopping = 0;
+
+static
+void on_stop_signal( int )
+{
+    stopping = 1;
+}
+
+static
+bool write_all( int _fd, const char * _data, size_t _size )
+{
+    while( _size )
+    {
+        const ssize_t written = ::write( _fd, _data, _size );
+        if( written < 0 )
+        {
+            if( EINTR == errno )
+                continue;
+            return false;
+        }
+        _data += written;
+        _size -= static_cast<size_t>( written );
+    }
+    return true;
+}
+
+/**@brief Sends the complete lines of the pending text to syslog, and keeps the rest for later */
+static
+void send_lines( std::string & _pending, bool _everything )
+{
+    size_t start = 0;
+    for( size_t end = _pending.find( '\n' ); std::string::npos != end; end = _pending.find( '\n', start ) )
+    {
+        syslog( LOG_INFO, "%.*s", static_cast<int>( end - start ), _pending.data() + start );
+        start = end + 1;
+    }
+
+    if( _everything && start < _pending.size() )
+    {
+        syslog( LOG_INFO, "%.*s", static_cast<int>( _pending.size() - start ), _pending.data() + start );
+        start = _pending.size();
+    }
+    _pending.erase( 0, start );
+}
+
+static
+void sleep_milliseconds( unsigned _milliseconds )
+{
+    struct timespec delay;
+    delay.tv_sec = _milliseconds / 1000;
+    delay.tv_nsec = static_cast<long>( _milliseconds % 1000 ) * 1000000L;
+    nanosleep( &delay, 0 );
+}
+
+/**@brief Reads a ring until the program writing to it is gone
+ * @return false if the output cannot be written to */
+static
+bool collect( qlog::shm_ring_reader & _ring, int _output, bool _syslog, bool _exit )
+{
+    static char chunk[64 * 1024];
+    std::string pending;
+    unsigned idle = 0;
+    size_t dropped = 0;
+
+    for( ;; )
+    {
+        const bool closed = _ring.closed();
+        const size_t size = _ring.read( chunk, sizeof( chunk ) );
+        if( size )
+        {
+            idle = 0;
+            if( _syslog )
+            {
+                pending.append( chunk, size );
+                send_lines( pending, false );
+            }
+            else if( !write_all( _output, chunk, size ) )
+            {
+                return false;
+            }
+            continue;
+        }
+
+        if( _ring.dropped() != dropped )
+        {
+            dropped = _ring.dropped();
+            std::cerr << "qlog-collect: " << dropped << " writes dropped so far" << std::endl;
+        }
+
+        // the ring is empty: closed holds since before the last read
+        if( closed || stopping || ( !_exit && idle >= 1000 && _ring.replaced() ) )
+            break;
+
+        // about a second between two checks for a new ring
+        idle = idle >= 1000 ? 0 : idle + 1;
+        sleep_milliseconds( 1 );
+    }
+
+    if( _syslog )
+        send_lines( pending, true );
+    return true;
+}
+
+int main( int argc, char ** argv )
+{
+    bool exit_when_closed = false;
+    const char * ident = 0;
+    int first = 1;
+    for( ; first < argc && '-' == argv[first][0]; ++first )
+    {
+        if( 0 == std::strcmp( argv[first], "-x" ) )
+            exit_when_closed = true;
+        else if( 0 == std::strcmp( argv[first], "-s" ) && first + 1 < argc )
+            ident = argv[++first];
+        else
+            break;
+    }
+
+    if( first == argc || argc - first > 2 )
+    {
+        std::cerr << "usage: qlog-collect [-x] [-s ident] name [file]" << std::endl;
+        return 2;
+    }
+
+    int output = 1;
+    if( argc - first == 2 )
+    {
+        output = open( argv[first + 1], O_WRONLY | O_CREAT | O_APPEND, 0644 );
+        if( output < 0 )
+        {
+            std::cerr << argv[first + 1] << ": cannot be opened" << std::endl;
+            return 1;
+        }
+    }
+
+    if( ident )
+        openlog( ident, 0, LOG_USER );
+
+    signal( SIGINT, &on_stop_signal );
+    signal( SIGTERM, &on_stop_signal );
+
+    while( !stopping )
+    {
+        qlog::shm_ring_reader ring( argv[first] );
+        if( !ring.is_open() )
+        {
+            // the program has not created the ring yet
+            sleep_milliseconds( 100 );
+            continue;
+        }
+
+        if( !collect( ring, output, 0 != ident, exit_when_closed ) )
+        {
+            std::cerr << "qlog-collect: cannot write the messages" << std::endl;
+            return 1;
+        }
+
+        if( exit_when_closed && ring.closed() )
+            break;
+
+        // the ring is gone: wait for the next one rather than read it again
+        while( !stopping && !ring.replaced() )
+            sleep_milliseconds( 100 );
+    }
+
+    if( ident )
+        closelog();
+    return 0;
+}
@@ -0,0 +1,164 @@
+/**
+ * @file qlog-decode.cpp
+ * @brief Turns files written through a qlog::binary_sink back into text
+ *
+ * Usage: qlog-decode [-h] [file...]
+ *
+ * The files, or the standard input if none is given, are decoded in order
+ * and written to the standard output. With -h, each message is preceded by
+ * its level, the time at which it was logged and the id of its thread: the
+ * messages only carry them in their text if the prepended decorations did.
+ *
+ * Files made of LZ4 frames, such as the ones a qlog::lz4_sink writes, are
+ * decompressed first: the binary records are then decoded, and text is
+ * written as it is.
+ *
+ * The files must have been written on a machine with the same sizes and byte
+ * order as this one.
+ */
+#include "qlog.hpp"
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <vector>
+
+static
+bool read_all( std::istream & _input, std::vector<char> & _data )
+{
+    char chunk[64 * 1024];
+    while( _input.read( chunk, sizeof( chunk ) ) || _input.gcount() )
+        _data.insert( _data.end(), chunk, chunk + _input.gcount() );
+    return _input.eof();
+}
+
+static
+void print_header( const qlog::record_header & _header )
+{
+    char text[32];
+    struct tm broken_down;
+#   ifndef WIN32
+    localtime_r( &_header.m_seconds, &broken_down );
+#   else
+    localtime_s( &broken_down, &_header.m_seconds );
+#   endif
+    const size_t size = std::strftime( text, sizeof( text ), "%Y-%m-%d %H:%M:%S", &broken_down );
+
+    std::cout << qlog::level_name( _header.m_level ) << ' ';
+    std::cout.write( text, static_cast<std::streamsize>( size ) );
+    std::cout << '.' << std::setw( 6 ) << std::setfill( '0' ) << _header.m_nanoseconds / 1000
+              << std::setfill( ' ' ) << " [" << _header.m_thread << "] ";
+}
+
+/**@brief Decodes the records one at a time, so that their headers can be printed */
+static
+bool decode_with_headers( const char * _data, size_t _size, size_t & _used )
+{
+    _used = 0;
+    while( _size - _used >= sizeof( qlog::record_header ) )
+    {
+        qlog::record_header header;
+        std::memcpy( &header, _data + _used, sizeof( qlog::record_header ) );
+        if( header.m_size < sizeof( qlog::record_header ) || header.m_size > _size - _used )
+            break;
+
+        print_header( header );
+        size_t used = 0;
+        if( !qlog::decode_records( _data + _used, header.m_size, std::cout, false, &used ) )
+            return false;
+        _used += used;
+    }
+    return true;
+}
+
+static
+bool decode_binary( const char * _data, size_t _size, bool _headers, const char * _name )
+{
+    const char * data = _data;
+    size_t size = _size;
+
+    if( size >= sizeof( qlog::binary_file_magic )
+        && 0 == std::memcmp( data, qlog::binary_file_magic, sizeof( qlog::binary_file_magic ) ) )
+    {
+        data += sizeof( qlog::binary_file_magic );
+        size -= sizeof( qlog::binary_file_magic );
+    }
+
+    size_t used = 0;
+    const bool ok = _headers ? decode_with_headers( data, size, used )
+                             : qlog::decode_records( data, size, std::cout, false, &used );
+    std::cout.flush();
+
+    if( !ok )
+    {
+        std::cerr << _name << ": corrupted record at offset " << _size - size + used << std::endl;
+        return false;
+    }
+    if( used != size )
+    {
+        // the program that wrote the file may have been stopped in the middle of a record
+        std::cerr << _name << ": " << size - used << " trailing bytes ignored" << std::endl;
+    }
+    return true;
+}
+
+static
+bool decode( const std::vector<char> & _data, bool _headers, const char * _name )
+{
+    const char * data = _data.empty() ? 0 : &_data[0];
+    const size_t size = _data.size();
+    if( size < sizeof( qlog::lz4_frame_magic )
+        || 0 != std::memcmp( data, qlog::lz4_frame_magic, sizeof( qlog::lz4_frame_magic ) ) )
+        return decode_binary( data, size, _headers, _name );
+
+    std::string decompressed;
+    size_t used = 0;
+    const bool ok = qlog::lz4_decompress( data, size, decompressed, &used );
+    if( !ok )
+        std::cerr << _name << ": corrupted frame at offset " << used << std::endl;
+    else if( used != size )
+    {
+        // the program that wrote the file may have been stopped in the middle of a frame
+        std::cerr << _name << ": " << size - used << " trailing compressed bytes ignored" << std::endl;
+    }
+
+    if( decompressed.size() >= sizeof( qlog::binary_file_magic )
+        && 0 == std::memcmp( decompressed.data(), qlog::binary_file_magic, sizeof( qlog::binary_file_magic ) ) )
+        return decode_binary( decompressed.data(), decompressed.size(), _headers, _name ) && ok;
+
+    std::cout.write( decompressed.data(), static_cast<std::streamsize>( decompressed.size() ) );
+    std::cout.flush();
+    return ok;
+}
+
+int main( int argc, char ** argv )
+{
+    bool headers = false;
+    int first = 1;
+    if( argc > 1 && 0 == std::strcmp( argv[1], "-h" ) )
+    {
+        headers = true;
+        ++first;
+    }
+
+    bool ok = true;
+    if( first == argc )
+    {
+        std::vector<char> data;
+        ok = read_all( std::cin, data ) && decode( data, headers, "<stdin>" );
+    }
+
+    for( int i = first; i < argc; ++i )
+    {
+        std::ifstream input( argv[i], std::ios::in | std::ios::binary );
+        std::vector<char> data;
+        if( !input || !read_all( input, data ) )
+        {
+            std::cerr << argv[i] << ": cannot be read" << std::endl;
+            ok = false;
+            continue;
+        }
+        ok = decode( data, headers, argv[i] ) && ok;
+    }
+
+    return ok ? 0 : 1;
+}
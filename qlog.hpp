@@ -41,7 +41,8 @@
  * One of them is a member function that you can call on any log object, like
  * qlog::debug.set_output( new_output ), and the other one is a global function
  * that will call set_output on every available logger.
- * Note that set_output() takes a std::ostream reference as a parameter.
+ * Note that set_output() takes a std::ostream reference as a parameter, or a sink
+ * such as qlog::fd_sink or qlog::file_sink to write without going through a std::ostream.
  *
  * The following snippet will redirect all output to myprogram.log
  * @code{.cpp}
@@ -97,6 +98,17 @@
  *
  * @endcode
  *
+ * On POSIX systems, qlog::rotating_file_sink writes to a file through memory mappings and renames it
+ * once it is big or old enough, keeping a given number of older files.
+ *
+ * A logger can also write to several sinks at once, the message being formatted only once.
+ * add_output() adds a sink to the loggers of a given level and above:
+ * @code{.cpp}
+ * qlog::fd_sink standard_error( 2 );
+ * qlog::set_output( logstream );                               // everything goes to myprogram.log
+ * qlog::add_output( standard_error, qlog::loglevel::warning ); // warnings and errors go to stderr too
+ * @endcode
+ *
  * FILTERING IMPORTANT MESSAGES IN
  * -------------------------------
  *
@@ -158,6 +170,195 @@
  * }
  * @endcode
  *
+ * ONE INSTANCE OF THE LOGGERS
+ * ---------------------------
+ * Being a header, qlog gives each compile unit its own 5 loggers, which share their outputs and
+ * decorations but are enabled and disabled on their own. In C++17 they are inline variables
+ * instead, a single instance for the whole program. Before C++17, define QLOG_EXTERN_LOGGERS
+ * wherever qlog.hpp is included, and QLOG_DEFINE_LOGGERS as well in the one compile unit that
+ * defines the loggers:
+ * @code{.cpp}
+ * // logging.cpp
+ * #define QLOG_EXTERN_LOGGERS
+ * #define QLOG_DEFINE_LOGGERS
+ * #include "qlog.hpp"
+ * @endcode
+ * From C++11 on, the loggers are constant-initialized: none of them costs anything at startup.
+ *
+ * FLUSHING LESS OFTEN
+ * -------------------
+ * std::endl flushes the output, which usually costs a system call per message. After
+ * set_flush_policy(), std::endl only writes a new line and the outputs are flushed once enough
+ * bytes are pending, once the oldest pending message is old enough, or right after a message of an
+ * important level. qlog::flush() flushes everything at once:
+ * @code{.cpp}
+ * qlog::set_flush_policy( 64 * 1024, 100, qlog::loglevel::error );
+ * @endcode
+ *
+ * PREFIX FIELDS
+ * -------------
+ * Besides text and colors, prepend() and append() accept fields that are rendered again for
+ * every message: timestamp, thread_id, level_tag, source_location and module_name. The date of a timestamp is
+ * only formatted when the second changes, and the id of a thread only once. The location is the
+ * one of the QLOG_DEBUG family of macros, or of QLOG_HERE:
+ * @code{.cpp}
+ * qlog::info.prepend() << qlog::timestamp( 3 ) << " [" << qlog::thread_id() << "] "
+ *                      << qlog::level_tag() << " " << qlog::source_location() << ": ";
+ * QLOG_INFO << "started" << std::endl; // 2014-03-01 12:30:45.123 [4242] INFO main.cpp:12: started
+ * @endcode
+ *
+ * REMOVING MESSAGES AT COMPILE TIME
+ * ---------------------------------
+ * Defining QLOG_MIN_LEVEL removes the loggers of a lower level from the program: with
+ * <c>\#define QLOG_MIN_LEVEL qlog::loglevel::info</c>, sending a message to qlog::debug or
+ * qlog::trace does nothing at all. The arguments of the message are still evaluated though, unless
+ * the QLOG_DEBUG, QLOG_TRACE, QLOG_INFO, QLOG_WARNING, QLOG_ERROR macros (or QLOG_LOG for a logger of
+ * your own) are used instead of the objects themselves. These macros do not evaluate the message
+ * either when it is filtered out at run-time:
+ * @code{.cpp}
+ * QLOG_DEBUG << "current state: " << dump_state() << std::endl; // dump_state() is only called when needed
+ * @endcode
+ *
+ * Without a macro, qlog::lazy() wraps a function object whose result is only computed once the
+ * message is known to be written, be it with operator<<, kv() or log(); and QLOG_LOG_IF adds a
+ * condition of your own, only evaluated when the level lets the message through:
+ * @code{.cpp}
+ * qlog::debug( verbose ) << "state: " << qlog::lazy( [&]{ return dump_state(); } ) << std::endl;
+ * QLOG_LOG_IF( qlog::debug, verbose ) << "state: " << dump_state() << std::endl;
+ * @endcode
+ *
+ * FORMAT STRINGS
+ * --------------
+ * In C++11, log() writes a whole message in one call, each {} of the format being replaced by
+ * the next argument. QLOG_LOGF checks at compile time that the format has as many {} as there are
+ * arguments, and does not evaluate them when the message is filtered out:
+ * @code{.cpp}
+ * qlog::info.log( "x={} y={}\n", x, y );
+ * QLOG_LOGF( qlog::info, "x={} y={}\n", x, y );
+ * @endcode
+ *
+ * LIMITING NOISY MESSAGES
+ * -----------------------
+ * Each use of QLOG_EVERY_N, QLOG_SAMPLED or QLOG_RATE_LIMITED has counters of its own, which
+ * decide whether the message is written with a relaxed atomic increment. Like QLOG_LOG, they do
+ * not evaluate the messages they drop:
+ * @code{.cpp}
+ * QLOG_EVERY_N( qlog::warning, 1000 ) << "queue full" << std::endl;          // 1 message in 1000
+ * QLOG_SAMPLED( qlog::debug, 0.01 ) << "request " << dump( request ) << std::endl; // 1% of them
+ * QLOG_RATE_LIMITED( qlog::error, 10 ) << "cannot reach " << host << std::endl;  // 10 per second
+ * @endcode
+ * Once the rate limit lifts, a message tells how many were suppressed. These macros declare a
+ * static variable, so each must be a statement of its own.
+ *
+ * KEEPING THE CONTEXT OF ERRORS
+ * -----------------------------
+ * With set_backtrace(), the messages filtered out by the level are not thrown away but kept, in
+ * binary form, in a small ring of the thread that logs them. When that thread logs an error, the
+ * messages it kept are written first, to the outputs of the error:
+ * @code{.cpp}
+ * qlog::set_loglevel( qlog::loglevel::warning );
+ * qlog::set_backtrace( 32 );             // the last 32 debug, trace and info messages of each thread
+ * qlog::debug << "parsing " << path;      // kept
+ * qlog::error << "cannot parse " << path; // written after the kept messages
+ * @endcode
+ * Each thread has its own ring, which takes no lock and shows what led to the error in that
+ * thread only. The kept messages are formatted only if they are ever written.
+ *
+ * STRUCTURED MESSAGES
+ * -------------------
+ * kv() writes key-value pairs instead of free text, as one JSON object per message or in logfmt
+ * (see set_structured_format()). Integers, booleans and strings are encoded directly in the
+ * buffer of the message, and a filtered message costs no more than with operator<<:
+ * @code{.cpp}
+ * qlog::info.kv( "user", id ).kv( "latency_us", latency ) << std::endl;
+ * // {"user":42,"latency_us":118}
+ * @endcode
+ * The prepended and appended text still surround the message, so leave them empty to get plain
+ * JSON lines.
+ *
+ * BINARY LOGS
+ * -----------
+ * A qlog::binary_sink makes the loggers skip the formatting: the arguments of the messages are
+ * copied as they are, after the level, the time and the thread of the message. The qlog-decode
+ * program, built along with the library, turns such a file back into text, with <c>-h</c>
+ * printing the level, time and thread of each message:
+ * @code{.cpp}
+ * qlog::rotating_file_sink file( "myprogram.qlog" );
+ * qlog::binary_sink records( file );
+ * qlog::set_output( records );
+ * @endcode
+ * <c>qlog-decode -h myprogram.qlog</c>. The other sinks of the same logger still receive text.
+ *
+ * COMPRESSED LOGS
+ * ---------------
+ * A qlog::lz4_sink compresses what it writes to another sink, a block at a time, each block being
+ * a LZ4 frame of its own: a file can be rotated or appended to, and a crash only loses the block
+ * being filled. The lz4 program reads the files, and qlog-decode decompresses them itself, binary
+ * records or text:
+ * @code{.cpp}
+ * qlog::rotating_file_sink file( "myprogram.log.lz4", 100 * 1024 * 1024 );
+ * qlog::lz4_sink compressed( file );
+ * qlog::set_output( compressed );
+ * qlog::set_flush_policy( 64 * 1024, 1000 );
+ * @endcode
+ * A block is written when it is full or when the sink is flushed, so that it pays to flush less
+ * often. In asynchronous mode, the compression is done by the writer thread.
+ *
+ * LOGGING THROUGH SHARED MEMORY
+ * -----------------------------
+ * A qlog::shm_ring_sink copies the messages to a ring in shared memory, with a memcpy and an
+ * atomic store, and leaves the input and output to another process. The qlog-collect program,
+ * built along with the library, reads the ring and appends it to a file, or sends each line to
+ * syslog with <c>-s ident</c>:
+ * @code{.cpp}
+ * qlog::shm_ring_sink ring( "/myprogram", 4 * 1024 * 1024 );
+ * qlog::set_output( ring );
+ * @endcode
+ * <c>qlog-collect /myprogram myprogram.log</c>. When the collector falls behind, the messages that
+ * do not fit in the ring are dropped rather than waited for.
+ *
+ * LOGGING TO A COLLECTOR
+ * ----------------------
+ * When QLOG_NETWORK is defined, a qlog::network_sink sends the messages to a collector, as RFC 5424
+ * syslog messages over UDP or TCP, or as text preceded by its length over TCP. The messages of a
+ * write leave in one system call, and the sink never blocks: when the collector is slow or gone,
+ * they wait in a bounded buffer while the sink connects again, and the ones that do not fit are
+ * dropped. With QLOG_ASYNC, only the writer thread talks to the network:
+ * @code{.cpp}
+ * qlog::network_sink collector( "logs.example.com", "514", qlog::network::tcp_syslog, "myprogram" );
+ * qlog::set_output( collector );
+ * @endcode
+ *
+ * COUNTING WHAT LOGGING COSTS
+ * ---------------------------
+ * When QLOG_STATS is defined, each level counts the messages it emitted, the ones it filtered
+ * out, their bytes and the time the logging threads waited for its lock; get_stats() adds them up,
+ * along with the depth of the asynchronous ring, the most it held and the messages it dropped. The
+ * counters are spread over QLOG_STATS_STRIPES cache lines, one per thread as long as there are
+ * enough, so that the threads do not fight over them:
+ * @code{.cpp}
+ * const qlog::stats now = qlog::get_stats();
+ * std::cout << now.m_levels[qlog::loglevel::info].m_emitted << " info messages" << std::endl;
+ * @endcode
+ * A mutex of your own, with QLOG_MULTITHREAD, needs a try_lock() member as well.
+ *
+ * LOGGING BY MODULE
+ * -----------------
+ * A qlog::module names a part of the program, such as "net.http", a child of "net". A module has
+ * a level of its own, or else the one of its nearest parent, or else the global level, and the
+ * same goes for its outputs. The name is only looked up when the handle is made, and a level
+ * change computes the threshold of every module again, so that checking a message stays a
+ * single comparison:
+ * @code{.cpp}
+ * static qlog::module http( "net.http" );
+ *
+ * qlog::module( "net" ).set_level( qlog::loglevel::debug );
+ * http.set_output( http_file );
+ * QLOG_MODULE( http, qlog::debug ) << "request " << id; // written to http_file
+ * @endcode
+ * The levels themselves stay the five loggers: a module changes which of them are output, and
+ * where to.
+ *
  * TIPS
  * ----
  * A handy feature is the possibility to disable the logging easily:
@@ -221,6 +422,14 @@
  * You might have noticed that I used the special symbol @c qlog::color() which
  * role is to restore the terminal settings to default.
  *
+ * On Linux, the colors are only written to the outputs that are terminals, so
+ * that a log file or a pipe is not filled with escape sequences; see
+ * set_color_policy() to write them everywhere, or nowhere. A std::ostream is
+ * only taken for a terminal when set_output() is told so:
+ * @code{.cpp}
+ * qlog::set_output( std::cout, 1 == isatty( 1 ) );
+ * @endcode
+ *
  * <h3>Stressing important messages</h3>
  *
  * Both Windows and Linux can use a <b>bold font</b> to draw attention to particular
@@ -263,15 +472,70 @@
  * --------------
  *
  * qlog allows multiple threads to run on the same level of logging. When support is enabled, many threads
- * can concurrently write on the same logger level. Pay attention that different level of logging
- * will not be multithread-safe, they should write to different outputs.
+ * can concurrently write on the same logger level, and loggers of different levels can share the same
+ * output: writing to a destination (a std::ostream, a FILE *, a file descriptor...) takes one of
+ * QLOG_SINK_LOCKS locks chosen by the destination, so that loggers writing to different outputs
+ * rarely wait for each other.
  *
  * To enable multithread mode, you can define QLOG_MULTITHREAD and provide a class or a struct called
  * mutex in the qlog namespace. Alternatively, defining QLOG_MULTITHREAD_PTHREAD lets you use pthread
  * mutexes.
+ *
+ * Each thread formats its messages in a buffer of its own, and the logger is only locked for the
+ * time it takes to write the finished message (prepended text, message and appended text) to its
+ * output. Messages shorter than QLOG_RECORD_BUFFER_SIZE bytes do not allocate any memory.
+ *
+ * ASYNCHRONOUS LOGGING
+ * --------------------
+ *
+ * When QLOG_ASYNC is defined along with QLOG_MULTITHREAD_CPP11, QLOG_MULTITHREAD_PTHREAD or
+ * QLOG_MULTITHREAD_WIN32, the loggers can hand their messages to a dedicated writer thread instead
+ * of writing them to their output. The logging threads then only copy the finished message to a
+ * bounded ring buffer and never wait on a slow file or terminal. Call set_async() before init() to
+ * choose the size of the ring and what happens when it is full, and flush() to wait for the writer
+ * to catch up:
+ * @code{.cpp}
+ * #define QLOG_MULTITHREAD_CPP11
+ * #define QLOG_ASYNC
+ * #include "qlog.hpp"
+ *
+ * int main()
+ * {
+ *     qlog::set_async( 4096, qlog::overflow::block );
+ *     qlog::init();
+ *     qlog::info << "written by the writer thread" << std::endl;
+ *     qlog::flush();
+ *     qlog::destroy(); // writes what is left and stops the writer
+ * }
+ * @endcode
+ *
+ * Calling set_deferred_formatting() as well moves the formatting to the writer thread: the
+ * numbers, pointers and strings of a message are copied to the ring in binary form and only turned
+ * into text by the writer. Other types are still formatted by the logging thread.
+ *
+ * Where the writer runs can be chosen before init() as well: set_writer_affinity() keeps it on
+ * some processors, away from the ones of the threads that must not wait, set_writer_priority()
+ * changes its nice value or makes it a SCHED_FIFO thread, and set_writer_wait() makes it poll the
+ * ring, for a while or all the time, rather than sleep until a logger wakes it up:
+ * @code{.cpp}
+ * qlog::set_async( 4096 );
+ * qlog::set_writer_affinity( 0 );
+ * qlog::set_writer_priority( 10 );
+ * qlog::set_writer_wait( qlog::writer_wait::spin_then_sleep, 100 );
+ * qlog::init();
+ * @endcode
+ *
+ * The messages still in the ring when the program crashes would be lost. After
+ * set_crash_handler(), init() catches the fatal signals and writes them to the fd_sink and
+ * rotating_file_sink outputs, using only async-signal-safe calls, before the signal goes on to
+ * kill the program.
  */
 
 #include <ostream>
+#include <locale>
+#include <string>
+#include <cstring>
+#include <cstddef>
 #ifdef QLOG_USE_ASSERTS
 #   include <assert.h>
 #   define QLOG_ASSERT(a); assert(a);
@@ -304,13 +568,161 @@
 #	endif
 #endif
 
-#ifndef QLOG_MAX_DECORATIONS
-#   define QLOG_MAX_DECORATIONS 10
+// clock and thread ids of the prefix fields, files of the sinks
+#include <ctime>
+#include <cstdio>
+#ifndef WIN32
+#   include <time.h>
+#   include <unistd.h>
+#   include <errno.h>
+#   include <fcntl.h>
+#   include <sys/stat.h>
+#   include <sys/mman.h>
+#   include <signal.h>
+#   ifdef __linux__
+#       include <sys/syscall.h>
+#   elif defined QLOG_MULTITHREAD_CPP11
+#       include <thread>
+#       include <functional>
+#   endif
+#endif
+
+// sockets of network_sink
+#if defined QLOG_NETWORK && !defined WIN32
+#   include <sys/socket.h>
+#   include <sys/uio.h>
+#   include <netdb.h>
+#   include <poll.h>
+#endif
+
+#ifdef QLOG_ASYNC
+#   if !defined QLOG_MULTITHREAD_CPP11 && !defined QLOG_MULTITHREAD_PTHREAD && !defined QLOG_MULTITHREAD_WIN32
+#       error "QLOG_ASYNC requires QLOG_MULTITHREAD_CPP11, QLOG_MULTITHREAD_PTHREAD or QLOG_MULTITHREAD_WIN32"
+#   endif
+#   include <vector>
+#   ifdef QLOG_MULTITHREAD_CPP11
+#       include <thread>
+#       include <condition_variable>
+#       include <chrono>
+#   elif defined QLOG_MULTITHREAD_PTHREAD
+#       include <sys/time.h>
+#   endif
+    // affinity and priority of the writer thread
+#   ifndef WIN32
+#       include <sched.h>
+#       include <pthread.h>
+#       include <sys/resource.h>
+#   endif
+#endif
+
+// the prepended or appended bytes of a logger kept without allocating memory
+#ifndef QLOG_DECORATION_BUFFER_SIZE
+#   define QLOG_DECORATION_BUFFER_SIZE 256
+#endif
+
+// loggers of a lower level are compiled out (1 is loglevel::debug)
+#ifndef QLOG_MIN_LEVEL
+#   define QLOG_MIN_LEVEL 1
+#endif
+
+#if __cplusplus >= 201103L || defined __GNUC__ || defined _MSC_VER
+#   define QLOG_HAS_LONG_LONG
+#endif
+
+#if defined _MSC_VER && _MSC_VER < 1900
+#   define QLOG_SNPRINTF _snprintf
+#else
+#   define QLOG_SNPRINTF snprintf
+#endif
+
+#if __cplusplus >= 201103L || ( defined _MSC_VER && _MSC_VER >= 1900 )
+#   define QLOG_HAS_VARIADIC_TEMPLATES
+#endif
+
+#if __cplusplus >= 201103L || ( defined _MSC_VER && _MSC_VER >= 1900 )
+#   define QLOG_HAS_CONSTEXPR
+#endif
+
+// a single instance of the loggers in the whole program, see QLOG_EXTERN_LOGGERS
+#if defined QLOG_EXTERN_LOGGERS || ( !defined QLOG_STATIC_LOGGERS && \
+    ( __cplusplus >= 201703L || ( defined _MSVC_LANG && _MSVC_LANG >= 201703L ) ) )
+#   define QLOG_SINGLE_INSTANCE
 #endif
 
-// hide symbols on linux
+// the free functions refer to the loggers, and have their linkage
+#ifdef QLOG_SINGLE_INSTANCE
+#   define QLOG_INLINE inline
+#else
+#   define QLOG_INLINE static inline
+#endif
+
+#if __cplusplus >= 201103L || ( defined _MSC_VER && _MSC_VER >= 1900 )
+#   define QLOG_HAS_THREAD_LOCAL
+#elif defined _MSC_VER
+#   define QLOG_THREAD_LOCAL_POINTER __declspec( thread )
+#else
+#   define QLOG_THREAD_LOCAL_POINTER __thread
+#endif
+
+// number of slots in the asynchronous ring (rounded up to a power of 2)
+#ifndef QLOG_ASYNC_CAPACITY
+#   define QLOG_ASYNC_CAPACITY 1024
+#endif
+
+// bytes of message carried by a single slot of the asynchronous ring
+#ifndef QLOG_ASYNC_SLOT_SIZE
+#   define QLOG_ASYNC_SLOT_SIZE 128
+#endif
+
+// bytes the writer thread accumulates before writing to the outputs
+#ifndef QLOG_ASYNC_BATCH_SIZE
+#   define QLOG_ASYNC_BATCH_SIZE 65536
+#endif
+
+// processors the writer thread can be kept on, see set_writer_affinity()
+#ifndef QLOG_WRITER_MAX_CPUS
+#   define QLOG_WRITER_MAX_CPUS 64
+#endif
+
+// bytes a record can hold before its buffer has to allocate memory
+#ifndef QLOG_RECORD_BUFFER_SIZE
+#   define QLOG_RECORD_BUFFER_SIZE 256
+#endif
+
+// bytes of the backtrace ring of a thread for each message it keeps, see set_backtrace()
+#ifndef QLOG_BACKTRACE_RECORD_SIZE
+#   define QLOG_BACKTRACE_RECORD_SIZE 256
+#endif
+
+// sinks a single logger can write to at once
+#ifndef QLOG_MAX_SINKS
+#   define QLOG_MAX_SINKS 8
+#endif
+
+// locks shared by the sinks in multithread mode, chosen by destination
+#ifndef QLOG_SINK_LOCKS
+#   define QLOG_SINK_LOCKS 16
+#endif
+
+// copies of the counters of QLOG_STATS, shared by the threads in turn
+#ifndef QLOG_STATS_STRIPES
+#   define QLOG_STATS_STRIPES 16
+#endif
+
+#if defined __GNUC__
+#   define QLOG_CACHE_ALIGNED __attribute__ (( aligned( 64 ) ))
+#elif defined _MSC_VER
+#   define QLOG_CACHE_ALIGNED __declspec( align( 64 ) )
+#else
+#   define QLOG_CACHE_ALIGNED
+#endif
+
+// hide symbols on linux, but the classes users derive from
 #if __GNUC__ >= 4
 #   pragma GCC visibility push(hidden)
+#   define QLOG_VISIBLE __attribute__ (( visibility( "default" ) ))
+#else
+#   define QLOG_VISIBLE
 #endif
 
 // let the user defines his own namespace
@@ -359,6 +771,11 @@ struct mutex
         return pthread_mutex_unlock( &m_mutex ) == 0;
     }
 
+    bool try_lock()
+    {
+        return pthread_mutex_trylock( &m_mutex ) == 0;
+    }
+
 private:
     pthread_mutexattr_t m_attr;
     pthread_mutex_t m_mutex;
@@ -389,6 +806,11 @@ struct mutex
 		return true;
 	}
 
+	bool try_lock()
+	{
+		return FALSE != TryEnterCriticalSection( &m_section );
+	}
+
 private:
 	CRITICAL_SECTION m_section;
 };
@@ -396,6 +818,103 @@ private:
 using std::mutex;
 #endif
 
+// -------------------------------------------------------------------------- //
+// atomics
+/**@struct atomic_integer
+ * @cond GENERATE_INTERNAL_DOCUMENTATION
+ * @brief A minimal atomic integer that does not depend on C++11.
+ *
+ * The structure is an aggregate so that static instances are initialized
+ * before any code runs, whatever the compile unit. Without compiler support
+ * for atomics, it degrades to a plain integer, which is only correct when
+ * a single thread is involved.
+ */
+template< typename T >
+struct atomic_integer
+{
+#if defined __ATOMIC_RELAXED
+    T load() const { return __atomic_load_n( &m_value, __ATOMIC_ACQUIRE ); }
+    T load_relaxed() const { return __atomic_load_n( &m_value, __ATOMIC_RELAXED ); }
+    void store( T _value ) { __atomic_store_n( &m_value, _value, __ATOMIC_RELEASE ); }
+    void store_relaxed( T _value ) { __atomic_store_n( &m_value, _value, __ATOMIC_RELAXED ); }
+    T fetch_add( T _value ) { return __atomic_fetch_add( &m_value, _value, __ATOMIC_ACQ_REL ); }
+    T fetch_add_relaxed( T _value ) { return __atomic_fetch_add( &m_value, _value, __ATOMIC_RELAXED ); }
+
+    bool compare_exchange( T & _expected, T _desired )
+    {
+        return __atomic_compare_exchange_n( &m_value, &_expected, _desired, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE );
+    }
+#elif defined WIN32
+    T load() const { const T ret = m_value; MemoryBarrier(); return ret; }
+    T load_relaxed() const { return m_value; }
+    void store( T _value ) { MemoryBarrier(); m_value = _value; }
+    void store_relaxed( T _value ) { m_value = _value; }
+
+    T fetch_add( T _value )
+    {
+        T expected = load_relaxed();
+        while( !compare_exchange( expected, expected + _value ) )
+        {
+        }
+        return expected;
+    }
+
+    T fetch_add_relaxed( T _value ) { return fetch_add( _value ); }
+
+    bool compare_exchange( T & _expected, T _desired )
+    {
+        T previous;
+        if( sizeof( T ) == sizeof( LONGLONG ) )
+            previous = static_cast<T>( InterlockedCompareExchange64( reinterpret_cast<volatile LONGLONG *>( &m_value ),
+                                                                     static_cast<LONGLONG>( _desired ),
+                                                                     static_cast<LONGLONG>( _expected ) ) );
+        else
+            previous = static_cast<T>( InterlockedCompareExchange( reinterpret_cast<volatile LONG *>( &m_value ),
+                                                                   static_cast<LONG>( _desired ),
+                                                                   static_cast<LONG>( _expected ) ) );
+        const bool ret = ( previous == _expected );
+        _expected = previous;
+        return ret;
+    }
+#else
+    T load() const { return m_value; }
+    T load_relaxed() const { return m_value; }
+    void store( T _value ) { m_value = _value; }
+    void store_relaxed( T _value ) { m_value = _value; }
+    T fetch_add( T _value ) { const T ret = m_value; m_value += _value; return ret; }
+    T fetch_add_relaxed( T _value ) { return fetch_add( _value ); }
+
+    bool compare_exchange( T & _expected, T _desired )
+    {
+        if( m_value != _expected )
+        {
+            _expected = m_value;
+            return false;
+        }
+        m_value = _desired;
+        return true;
+    }
+#endif
+
+#if !defined __ATOMIC_RELAXED && defined WIN32
+    volatile T m_value;
+#else
+    T m_value;
+#endif
+};
+
+/**@brief Full memory barrier */
+QLOG_INLINE
+void atomic_fence()
+{
+#if defined __ATOMIC_SEQ_CST
+    __atomic_thread_fence( __ATOMIC_SEQ_CST );
+#elif defined WIN32
+    MemoryBarrier();
+#endif
+}
+/**@endcond */
+
 // -------------------------------------------------------------------------- //
 // the different levels of logging
 
@@ -410,9 +929,29 @@ static const unsigned warning = 4;
 static const unsigned error = 5;
 }
 
+/**@brief How logger::kv() writes the pairs of a message, see set_structured_format()
+ * - structured::json writes one JSON object, as in {"user":42,"name":"bob"}
+ * - structured::logfmt writes the pairs separated by spaces, as in user=42 name=bob */
+namespace structured
+{
+static const unsigned json = 0;
+static const unsigned logfmt = 1;
+}
+
+/**@brief When colors are written, see set_color_policy()
+ * - colors::automatic writes them to the terminals only, the default
+ * - colors::always writes them to every sink, as before
+ * - colors::never writes them nowhere */
+namespace colors
+{
+static const unsigned automatic = 0;
+static const unsigned always = 1;
+static const unsigned never = 2;
+}
+
 #ifdef WIN32
 /** @todo make it exception-safe */
-static inline
+QLOG_INLINE
 void * get_console_function( char * name )
 {
     static HMODULE kernel32=( HMODULE )0xffffffff;
@@ -441,6 +980,46 @@ typedef cout_type & ( *standard_endline )( cout_type & );
 
 // -------------------------------------------------------------------------- //
 
+#ifdef QLOG_ASYNC
+/**@cond GENERATE_INTERNAL_DOCUMENTATION */
+struct async_backend;
+/**@endcond */
+
+/**@brief How the writer thread waits for messages, see set_writer_wait()
+ * - writer_wait::sleep sleeps until a logger wakes it up, which costs the logger a system call
+ * - writer_wait::spin_then_sleep polls the ring for a while before it sleeps, pausing longer
+ *   and longer between two looks: the loggers do not wake it up while it polls
+ * - writer_wait::busy_poll never sleeps, taking a processor to itself, and is never woken up */
+namespace writer_wait
+{
+static const unsigned sleep = 0;
+static const unsigned spin_then_sleep = 1;
+static const unsigned busy_poll = 2;
+}
+
+/**@cond GENERATE_INTERNAL_DOCUMENTATION
+ * @struct writer_options
+ * @brief Where and how the writer thread runs, see set_writer_affinity(), set_writer_priority()
+ *        and set_writer_wait() */
+struct writer_options
+{
+    unsigned m_wait;
+    unsigned m_spin_microseconds; ///< How long writer_wait::spin_then_sleep polls
+    unsigned m_sleep_milliseconds; ///< The longest the writer sleeps between two looks at the ring
+    size_t m_cpu_count; ///< 0 to leave the writer where the system puts it
+    unsigned m_cpus[QLOG_WRITER_MAX_CPUS];
+    bool m_prioritized; ///< Whether set_writer_priority() was called
+    bool m_realtime;
+    int m_priority;
+};
+/**@endcond */
+#endif
+
+#ifndef WIN32
+/**@brief The signals set_crash_handler() catches */
+static const int fatal_signals[] = { SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT };
+#endif
+
 /**
  * @cond GENERATE_INTERNAL_DOCUMENTATION
  * @struct user_global_settings
@@ -449,9 +1028,35 @@ typedef cout_type & ( *standard_endline )( cout_type & );
 template<typename T>
 struct user_global_settings
 {
-    static unsigned loglevel; ///< The current level of logging
+    static atomic_integer<unsigned> loglevel; ///< The current level of logging
     static bool initialized;
 
+    static bool flush_batched; ///< Whether set_flush_policy() replaced the flush of std::endl
+    static size_t flush_bytes; ///< Flush when that many bytes are pending, if not 0
+    static unsigned flush_milliseconds; ///< Flush when what is pending is that old, if not 0
+    static unsigned flush_level; ///< Flush at once after a message of that level
+    static unsigned structured_format; ///< How logger::kv() writes its pairs
+    static unsigned color_policy; ///< Which sinks get the colors, see set_color_policy()
+    static size_t backtrace_records; ///< How many filtered messages each thread keeps, 0 for none
+    static unsigned backtrace_level; ///< The lowest level of the messages kept
+    static unsigned backtrace_trigger; ///< The level of the messages that write the ones kept first
+    static unsigned backtrace_generation; ///< Changed by set_backtrace() and destroy(), so that the threads forget what they kept
+
+#ifdef QLOG_ASYNC
+    static async_backend * backend; ///< The writer thread, when running asynchronously
+    static size_t async_capacity; ///< The number of slots in the ring, 0 when synchronous
+    static unsigned async_overflow; ///< What to do when the ring is full
+    static bool deferred_formatting; ///< Whether the writer thread formats the messages
+    static writer_options writer; ///< Where and how the writer thread runs
+#endif
+
+#ifndef WIN32
+    static bool crash_handler; ///< Whether init() installs on_fatal_signal()
+    static bool crash_handler_installed;
+    static atomic_integer<unsigned> crashing; ///< How many threads entered on_fatal_signal()
+    static struct sigaction previous_actions[sizeof( fatal_signals ) / sizeof( *fatal_signals )];
+#endif
+
 #ifdef WIN32
     static HANDLE console_handle;
     static console_function set_text_attribute;
@@ -464,596 +1069,7145 @@ struct user_global_settings
 /**@private
   *@brief The current level of logging */
 template<typename T>
-unsigned user_global_settings<T>::loglevel = loglevel::error;
+atomic_integer<unsigned> user_global_settings<T>::loglevel = { loglevel::error };
 
 /**@private
   *@brief Whether the library is initialized */
 template<typename T>
 bool user_global_settings<T>::initialized = false;
 
-#ifdef WIN32
 /**@private
-  *@brief A handle to the console */
+  *@brief The flush policy set by set_flush_policy() */
 template<typename T>
-HANDLE user_global_settings<T>::console_handle = INVALID_HANDLE_VALUE;
+bool user_global_settings<T>::flush_batched = false;
 
-/**@private
-  *@brief A function pointer a function that will set console attributes */
 template<typename T>
-console_function user_global_settings<T>::set_text_attribute = 0;
-#endif
+size_t user_global_settings<T>::flush_bytes = 0;
 
-typedef user_global_settings<int> settings;
+template<typename T>
+unsigned user_global_settings<T>::flush_milliseconds = 0;
 
-#ifdef __GNUC__
-#   define QLOG_SUPPRESS_NOT_USED_WARN __attribute__ ((unused))
-#else
-#   define QLOG_SUPPRESS_NOT_USED_WARN
-#endif
+template<typename T>
+unsigned user_global_settings<T>::flush_level = loglevel::disabled;
 
-static QLOG_SUPPRESS_NOT_USED_WARN void set_loglevel( unsigned );
-static QLOG_SUPPRESS_NOT_USED_WARN unsigned get_loglevel();
+/**@private
+  *@brief The format set by set_structured_format() */
+template<typename T>
+unsigned user_global_settings<T>::structured_format = structured::json;
 
-static inline
-void set_loglevel( unsigned level )
-{
-    settings::loglevel = level;
-}
+/**@private
+  *@brief The policy set by set_color_policy() */
+template<typename T>
+unsigned user_global_settings<T>::color_policy = colors::automatic;
 
-static inline
-unsigned get_loglevel()
-{
-    return settings::loglevel;
-}
+/**@private
+  *@brief The number of messages set by set_backtrace() */
+template<typename T>
+size_t user_global_settings<T>::backtrace_records = 0;
 
-// -------------------------------------------------------------------------- //
-/**@struct decoration
- * @cond GENERATE_INTERNAL_DOCUMENTATION
- */
-struct decoration
-{
-    virtual ~decoration() throw() { }
-    virtual void apply( std::ostream & _ostr ) = 0;
-};
+/**@private
+  *@brief The lowest level set by set_backtrace() */
+template<typename T>
+unsigned user_global_settings<T>::backtrace_level = loglevel::debug;
 
-struct text_decoration : public decoration
-{
-    explicit
-    text_decoration( const char * _txt )
-        :m_txt( _txt )
-    {
-        QLOG_ASSERT( _txt );
-    }
+/**@private
+  *@brief The trigger set by set_backtrace() */
+template<typename T>
+unsigned user_global_settings<T>::backtrace_trigger = loglevel::error;
 
-    text_decoration( text_decoration & _copy )
-        :m_txt( _copy.m_txt )
-    {
-    }
+template<typename T>
+unsigned user_global_settings<T>::backtrace_generation = 0;
 
-    text_decoration & operator=( text_decoration & _obj )
-    {
-        m_txt = _obj.m_txt;
-        return *this;
-    }
+#ifdef QLOG_ASYNC
+/**@private
+  *@brief The asynchronous backend, if any */
+template<typename T>
+async_backend * user_global_settings<T>::backend = 0;
 
-    /**@todo can std::ostream << throw? what does it do if ostr has a bad bit set */
-    virtual void apply( std::ostream & _ostr )
-    {
-        _ostr << m_txt;
-    }
+/**@private
+  *@brief The capacity of the asynchronous ring requested by set_async() */
+template<typename T>
+size_t user_global_settings<T>::async_capacity = 0;
 
-    virtual ~text_decoration() throw()
-    {
-        QLOG_ASSERT( m_txt );
-    }
+/**@private
+  *@brief The overflow policy requested by set_async() */
+template<typename T>
+unsigned user_global_settings<T>::async_overflow = 0;
 
-private:
-    const char * m_txt;
-};
+/**@private
+  *@brief Whether set_deferred_formatting() has been called */
+template<typename T>
+bool user_global_settings<T>::deferred_formatting = false;
 
-// -------------------------------------------------------------------------- //
-template <unsigned loglevel, bool append>
-struct decorater
-{
-    decorater()
-    {
-    }
+/**@private
+  *@brief What set_writer_affinity(), set_writer_priority() and set_writer_wait() asked for */
+template<typename T>
+writer_options user_global_settings<T>::writer = { writer_wait::sleep, 0, 10, 0, { 0 }, false, false, 0 };
+#endif
+
+#ifndef WIN32
+/**@private
+  *@brief Whether set_crash_handler() has been called */
+template<typename T>
+bool user_global_settings<T>::crash_handler = false;
+
+template<typename T>
+bool user_global_settings<T>::crash_handler_installed = false;
+
+template<typename T>
+atomic_integer<unsigned> user_global_settings<T>::crashing = { 0 };
+
+/**@private
+  *@brief The handlers of the fatal signals before init() */
+template<typename T>
+struct sigaction user_global_settings<T>::previous_actions[sizeof( fatal_signals ) / sizeof( *fatal_signals )];
+#endif
+
+#ifdef WIN32
+/**@private
+  *@brief A handle to the console */
+template<typename T>
+HANDLE user_global_settings<T>::console_handle = INVALID_HANDLE_VALUE;
+
+/**@private
+  *@brief A function pointer a function that will set console attributes */
+template<typename T>
+console_function user_global_settings<T>::set_text_attribute = 0;
+#endif
+
+typedef user_global_settings<int> settings;
+
+struct sink_list;
+
+// -------------------------------------------------------------------------- //
+/**@struct module_node
+ * @cond GENERATE_INTERNAL_DOCUMENTATION
+ * @brief What the registry knows of a named module, such as "net.http".
+ *
+ * The nodes are never freed, so that the handles can keep a pointer to
+ * them. The threshold a message is compared to is computed when a level
+ * changes, not when the message is logged. The structure is an aggregate so
+ * that the static fallback node is initialized before any code runs.
+ */
+struct module_node
+{
+    const char * m_name;
+    module_node * m_parent; ///< The module named after the last dot removed, 0 at the top
+    module_node * m_next; ///< The module registered before this one
+    atomic_integer<unsigned> m_level; ///< The level set for this module, 0 to inherit it
+    atomic_integer<unsigned> m_threshold; ///< The level in effect: its own, an ancestor's or the global one
+    sink_list * m_sinks; ///< The outputs of this module, 0 until one is added
+    bool m_routed; ///< Whether m_sinks holds one sink at least
+    sink_list * m_route; ///< Where the messages go: the outputs of the nearest routed module, or 0 for the logger's
+#   ifdef QLOG_MULTITHREAD
+    mutex * m_mutex; ///< Serializes the writes to m_sinks, which every level shares
+#   endif
+};
+
+/**@struct module_registry
+ * @brief The list of the modules, to which modules are added without a lock */
+template< typename T >
+struct module_registry
+{
+    /**@brief The first module of the list, as an integer so that atomic_integer can hold it */
+    static module_node * first()
+    {
+        return reinterpret_cast<module_node *>( m_first.load() );
+    }
 
-    /**@brief Registers a new decoration
-     * @param[in] _deco The new decoration to register
-     * @warning Only a limited number of decoration can be added (10 by default)
+    /**@brief Finds a module, or registers it along with its parents
+     * @param[in] _name The name of the module, dots separating the parents from the children
+     * @param[in] _size The length of the name
+     * @return 0 if memory cannot be obtained
      * @throw nothing */
-    void add_decoration( decoration & _deco )
+    static module_node * get( const char * _name, size_t _size )
     {
-        QLOG_ASSERT( m_last_index < QLOG_MAX_DECORATIONS );
-        try
+        size_t head = m_first.load();
+        module_node * found = find( reinterpret_cast<module_node *>( head ), 0, _name, _size );
+        if( found )
+            return found;
+
+        module_node * parent = 0;
+        for( size_t i = _size; i > 0; --i )
         {
-            m_list[m_last_index] = &_deco;
-            ++m_last_index;
+            if( '.' == _name[i - 1] )
+            {
+                parent = get( _name, i - 1 );
+                if( !parent )
+                    return 0;
+                break;
+            }
         }
-        catch( const std::bad_alloc & )
+
+        module_node * const node = create( _name, _size, parent );
+        if( !node )
+            return 0;
+
+        for( ;; )
         {
-            QLOG_ASSERT( 0 && "std::bad_alloc" );
+            node->m_next = reinterpret_cast<module_node *>( head );
+            const size_t previous = head;
+            if( m_first.compare_exchange( head, reinterpret_cast<size_t>( node ) ) )
+                return node;
+
+            // only the modules added meanwhile need to be looked at again
+            found = find( reinterpret_cast<module_node *>( head ), reinterpret_cast<module_node *>( previous ), _name, _size );
+            if( found )
+            {
+                delete[] node->m_name;
+                delete node;
+                return found;
+            }
         }
     }
 
-    /**@brief Apply all decorations to an output stream
-     * @param[in] _ostr The outstream to which decorations will be applied
-     * @throw nothing */
-    void apply_all( std::ostream & _ostr )
+    /**@brief Computes again the threshold and the route of every module, after a level or an output changed */
+    static void update()
     {
-        for( size_t i = 0; i < m_last_index; ++i )
-        {
-            m_list[i]->apply( _ostr );
-        }
+        m_unregistered.m_threshold.store_relaxed( settings::loglevel.load_relaxed() );
+        for( module_node * node = first(); node; node = node->m_next )
+            update( *node );
     }
 
-    /**@brief Deletes all the registered decorations
-     * @throw nothing */
-    void reset()
+    /**@brief Gives every module back its inherited level and the outputs of the loggers */
+    static void reset()
     {
-        for( size_t i = 0; i < m_last_index; ++i )
+        for( module_node * node = first(); node; node = node->m_next )
         {
-            delete m_list[i];
+            node->m_level.store_relaxed( 0 );
+            node->m_routed = false;
         }
-        m_last_index = 0;
+        update();
     }
-    static size_t m_last_index;
-    static decoration * m_list[QLOG_MAX_DECORATIONS];
-};
 
-template< unsigned loglevel, bool append >
-size_t decorater<loglevel, append>::m_last_index = 0;
+    /**@brief What the handles of the modules that could not be registered point to: it follows the global level */
+    static module_node m_unregistered;
 
-template< unsigned loglevel, bool append >
-decoration * decorater<loglevel, append>::m_list[QLOG_MAX_DECORATIONS];
-// -------------------------------------------------------------------------- //
-template< unsigned loglevel, bool append > inline
-decorater<loglevel, append> & operator << ( decorater<loglevel, append> & _dec, const char * _txt )
-{
-    QLOG_ASSERT( 0 != _txt );
+private:
+    static void update( module_node & _node )
+    {
+        const module_node * from = &_node;
+        while( from && 0 == from->m_level.load_relaxed() )
+            from = from->m_parent;
+        _node.m_threshold.store_relaxed( from ? from->m_level.load_relaxed() : settings::loglevel.load_relaxed() );
+
+        from = &_node;
+        while( from && !from->m_routed )
+            from = from->m_parent;
+        sink_list * const route = from ? from->m_sinks : 0;
+        if( _node.m_route != route )
+            _node.m_route = route;
+    }
 
-    try
+    /**@brief Looks for a module from a node of the list down to another one, excluded */
+    static module_node * find( module_node * _from, const module_node * _to, const char * _name, size_t _size )
     {
-        decoration * const newdeco = new text_decoration( _txt );
-        _dec.add_decoration( *newdeco );
+        for( module_node * node = _from; node != _to; node = node->m_next )
+        {
+            if( 0 == std::strncmp( node->m_name, _name, _size ) && '\0' == node->m_name[_size] )
+                return node;
+        }
+        return 0;
     }
-    catch( const std::bad_alloc & )
+
+    static module_node * create( const char * _name, size_t _size, module_node * _parent )
     {
-        QLOG_ASSERT( 0 && "std::bad_alloc" );
+        module_node * node = 0;
+        try
+        {
+            node = new module_node();
+            char * const name = new char[_size + 1];
+            std::memcpy( name, _name, _size );
+            name[_size] = '\0';
+            node->m_name = name;
+        }
+        catch( const std::bad_alloc & )
+        {
+            delete node;
+            return 0;
+        }
+
+        node->m_parent = _parent;
+        update( *node );
+        return node;
     }
 
-    return _dec;
+    static atomic_integer<size_t> m_first;
+};
+
+template< typename T >
+atomic_integer<size_t> module_registry<T>::m_first = { 0 };
+
+template< typename T >
+module_node module_registry<T>::m_unregistered = { "", 0, 0, { 0 }, { loglevel::error }, 0, false, 0
+#   ifdef QLOG_MULTITHREAD
+    , 0
+#   endif
+};
+
+typedef module_registry<int> modules;
+/** @endcond */
+
+#ifdef __GNUC__
+#   define QLOG_SUPPRESS_NOT_USED_WARN __attribute__ ((unused))
+#else
+#   define QLOG_SUPPRESS_NOT_USED_WARN
+#endif
+
+#ifndef QLOG_SINGLE_INSTANCE
+static QLOG_SUPPRESS_NOT_USED_WARN void set_loglevel( unsigned );
+static QLOG_SUPPRESS_NOT_USED_WARN unsigned get_loglevel();
+#endif
+
+QLOG_INLINE
+void set_loglevel( unsigned level )
+{
+    settings::loglevel.store( level );
+    modules::update();
+}
+
+QLOG_INLINE
+unsigned get_loglevel()
+{
+    return settings::loglevel.load_relaxed();
 }
-/**@endcond */
 
 // -------------------------------------------------------------------------- //
-/**@struct logger
- * @brief An object that logs messages
- * @tparam level The level of detail the object logs at */
-template< unsigned level >
-struct logger
+/**@struct record_buffer
+ * @cond GENERATE_INTERNAL_DOCUMENTATION
+ * @brief A stream buffer that keeps a whole message in memory.
+ *
+ * The first QLOG_RECORD_BUFFER_SIZE bytes are stored inline, larger messages
+ * make the buffer grow on the heap. If memory cannot be obtained, the message
+ * is truncated rather than throwing. A flush of the stream (as in std::endl)
+ * is remembered so that it can be forwarded to the real output later.
+ */
+struct record_buffer : public std::streambuf
 {
-    /**@brief Constructs a logger
-     * @warning This should almost never been used. 5 loggers are already created
-     *          by the library in each compile unit to be used by the user.
-     * @param[in] _disabled Whether this logger actually writes messages */
-    explicit
-    logger( bool _disabled = false )
-        :m_disabled( _disabled )
-        ,m_nbReceivers( 0 )
+    record_buffer()
+        :std::streambuf()
+        ,m_inline()
+        ,m_storage( m_inline )
+        ,m_capacity( sizeof( m_inline ) )
+        ,m_flush( false )
     {
+        setp( m_storage, m_storage + m_capacity );
     }
 
-    /**@brief Copies a logger
-     * @warning This should almost never been used. 5 loggers are already created
-     *          by the library in each compile unit to be used by the user.
-     * @param[in] _logger The logger to copy */
-    logger( const logger & _logger )
-        :m_disabled( _logger.m_disabled )
-        ,m_nbReceivers( _logger.m_nbReceivers )
+    virtual ~record_buffer()
     {
+        if( m_storage != m_inline )
+            delete[] m_storage;
     }
 
-    ~logger()
-    {
-        QLOG_ASSERT( 0 == m_nbReceivers );
-        reset_decoration();
-    }
+    const char * data() const { return pbase(); }
+    size_t size() const { return static_cast<size_t>( pptr() - pbase() ); }
+    bool flush_requested() const { return m_flush; }
 
-    /**@brief Removes all prepending or appending text */
-    void reset_decoration()
+    /**@brief Forgets the content but keeps the memory
+     * @throw nothing */
+    void clear()
     {
-        reset_prepend();
-        reset_append();
+        setp( m_storage, m_storage + m_capacity );
+        m_flush = false;
     }
 
-    /**@brief Removes all appending text */
-    void reset_append()
+    /**@brief Appends raw bytes, bypassing the stream machinery
+     * @return false if the bytes did not fit, in which case nothing is appended
+     * @throw nothing */
+    bool append( const void * _data, size_t _size )
     {
-        m_append.reset();
+        if( static_cast<size_t>( epptr() - pptr() ) < _size && !grow( _size ) )
+            return false;
+
+        std::memcpy( pptr(), _data, _size );
+        pbump( static_cast<int>( _size ) );
+        return true;
     }
 
-    /**@brief Removes all prepending text */
-    void reset_prepend()
+    /**@brief Replaces bytes that were already written
+     * @throw nothing */
+    void overwrite( size_t _offset, const void * _data, size_t _size )
     {
-        m_prepend.reset();
+        QLOG_ASSERT( _offset + _size <= size() );
+        std::memcpy( pbase() + _offset, _data, _size );
     }
 
-
-    /**@brief Assigns a logger
-     * @param[in] _copy Another logger
-     * @warning Assigning a logger is not permitted
-     * @return *this */
-    logger & operator=( const logger & _copy );
-
-    /**@brief Checks if the logger is able to log
-     * @return True if the logger can log */
-    bool isDisabled() const { return m_disabled; }
-
-    /**@brief Checks and outputs a message.
-     * @warning This is automatically be called by @c operator<<
-     * @param[in] _message The message to check and output
-     * @param[in] _first_part Set to true if a custom message should be appended
-     *
-     * Checking whether the message can be output consists in:
-     * - seeing whether the detail level of the logger is sufficient to output
-     *   the message: an warning logger cannot output message when the logging
-     *   level is set to error.
-     * - checking whether an output stream has been set.
-     * - checking whether the logger has been disabled during construction
-     *
-     * @see logger::logger(bool _disabled)
-     */
-    template< typename T >
-    void treat( const T & _message, bool _first_part ) const
+    /**@brief Makes room for bytes written in place, as append() would
+     * @return Where the new bytes go, the content being moved if needed, or 0
+     *         if they did not fit
+     * @throw nothing */
+    char * extend( size_t _size )
     {
-        if( can_log() )
-        {
-            QLOG_ASSERT( m_output );
-            if( _first_part )
-                m_prepend.apply_all( *m_output );
+        if( static_cast<size_t>( epptr() - pptr() ) < _size && !grow( _size ) )
+            return 0;
 
-            ( *m_output ) << _message;
-        }
+        char * const room = pptr();
+        pbump( static_cast<int>( _size ) );
+        return room;
     }
 
-    /**@brief Sets the destination of the messages
-     * @param[in] _output A std::ostream object that will receive the next messages
-     *
-     * Use this function if you want a certain logger to write its message to
-     * a customized output stream. The most frequent use is to direct messages
-     * to a file.
-     *
-     * @code{.cpp}
-     * #include <fstream>
-     * #include <string>
-     * #include "qlog.hpp"
-     *
-     * using namespace qlog;
-     *
-     * int main()
-     * {
-     *     const std::string filename("output.log");
-     *     std::ofstream output_file( filename.c_str() );
-     *
-     *     qlog::error.set_output( output_file );
-     *
-     *     qlog::error << "This message will be written in output.log" << std::endl;
-     * }
-     * @endcode
-     */
-    void set_output( std::ostream & _output )
+protected:
+    virtual int_type overflow( int_type _c )
     {
-        m_output = &_output;
+        if( traits_type::eq_int_type( _c, traits_type::eof() ) )
+            return traits_type::not_eof( _c );
+
+        if( !grow( 1 ) )
+            return traits_type::eof();
+
+        *pptr() = traits_type::to_char_type( _c );
+        pbump( 1 );
+        return _c;
     }
 
-    /**@brief Adds a custom text after all logged messages. */
-    decorater<level, true> & append()
+    virtual std::streamsize xsputn( const char * _data, std::streamsize _size )
     {
-        return m_append;
+        if( epptr() - pptr() < _size && !grow( static_cast<size_t>( _size ) ) )
+            _size = epptr() - pptr();
+
+        std::memcpy( pptr(), _data, static_cast<size_t>( _size ) );
+        pbump( static_cast<int>( _size ) );
+        return _size;
     }
 
-    /**@brief Adds a custom text before all logged messages. */
-    decorater<level, false> & prepend()
+    virtual int sync()
     {
-        return m_prepend;
+        m_flush = true;
+        return 0;
     }
 
-    /**@brief Informs the logger that std::endl, or other io manipulators, have been passed
-     * @cond GENERATE_INTERNAL_DOCUMENTATION
-     * @param[in] _func The io function, such as std::endl
-     * @param[in] _first_message Whether it is the first element of the << series.
-     * @private */
-    void signal( standard_endline _func, bool _first_message = false ) const
+private:
+    bool grow( size_t _needed )
     {
-        if( can_log() )
-        {
-            if( _first_message )
-            {
-#               ifdef QLOG_MULTITHREAD
-                lock();
-#               endif
-                m_prepend.apply_all( *m_output );
-            }
+        const size_t used = size();
+        size_t capacity = m_capacity * 2;
+        while( capacity < used + _needed )
+            capacity *= 2;
 
-            _func( *m_output );
+        try
+        {
+            char * const storage = new char[capacity];
+            std::memcpy( storage, m_storage, used );
+            if( m_storage != m_inline )
+                delete[] m_storage;
+
+            m_storage = storage;
+            m_capacity = capacity;
+            setp( m_storage, m_storage + m_capacity );
+            pbump( static_cast<int>( used ) );
+        }
+        catch( const std::bad_alloc & )
+        {
+            return false;
         }
+        return true;
     }
 
-    void signal_creation() const
+    record_buffer( const record_buffer & );
+    record_buffer & operator=( const record_buffer & );
+
+    char m_inline[QLOG_RECORD_BUFFER_SIZE];
+    char * m_storage;
+    size_t m_capacity;
+    bool m_flush;
+};
+
+/**@struct record_stream
+ * @brief An output stream writing into a record_buffer */
+struct record_stream : public std::ostream
+{
+    record_stream()
+        :std::ostream( 0 )
+        ,m_buffer()
+        ,m_classic( false )
     {
-        ++m_nbReceivers;
+        rdbuf( &m_buffer );
+        check_locale();
+        register_callback( &record_stream::on_event, 0 );
     }
 
-    void signal_destruction() const
+    record_buffer & buffer() { return m_buffer; }
+
+    /**@brief Whether integers would be written in decimal, unpadded, as in the C locale */
+    bool plain_integers() const
     {
-        QLOG_ASSERT( m_nbReceivers );
-        if (0 == --m_nbReceivers)
-        {
-            signal_end();
-#           ifdef QLOG_MULTITHREAD
-            unlock();
-#           endif
-        }
+        const std::ios_base::fmtflags base = flags() & std::ios_base::basefield;
+        return m_classic && 0 == width() && ( std::ios_base::dec == base || 0 == base )
+            && !( flags() & std::ios_base::showpos );
     }
 
-#   ifdef QLOG_MULTITHREAD
-    void lock() const
+    /**@brief Whether floating-point numbers would be written unpadded, as in the C locale */
+    bool plain_floats() const
     {
-        m_mutex->lock();
+        return m_classic && 0 == width();
     }
 
-    void unlock() const
+private:
+    record_stream( const record_stream & );
+    record_stream & operator=( const record_stream & );
+
+    static void on_event( std::ios_base::event _event, std::ios_base & _stream, int )
     {
-        m_mutex->unlock();
+        if( std::ios_base::imbue_event == _event )
+        {
+            record_stream * const stream = dynamic_cast<record_stream *>( &_stream );
+            if( stream )
+                stream->check_locale();
+        }
     }
 
-    bool init_mutex()
+    void check_locale()
     {
-        bool ret = false;
-        QLOG_ASSERT( 0 == m_mutex );
         try
         {
-            m_mutex = new mutex();
-            ret = true;
-        } catch (...)
+            const std::numpunct<char> & punctuation = std::use_facet< std::numpunct<char> >( getloc() );
+            m_classic = ( '.' == punctuation.decimal_point() ) && punctuation.grouping().empty();
+        }
+        catch( ... )
         {
-            m_mutex = 0;
-            ret = false;
+            m_classic = false;
         }
-
-        return ret;
     }
 
-    void destroy_mutex()
+    record_buffer m_buffer;
+    bool m_classic; ///< Whether the locale writes numbers as the C locale does
+};
+
+// -------------------------------------------------------------------------- //
+/**@cond GENERATE_INTERNAL_DOCUMENTATION
+ * @brief Writes the digits of an unsigned integer, two at a time
+ * @param[out] _output Room for 20 characters
+ * @return The number of digits */
+template< typename T > inline
+size_t format_unsigned( char * _output, T _value )
+{
+    static const char pairs[] =
+        "00010203040506070809" "10111213141516171819"
+        "20212223242526272829" "30313233343536373839"
+        "40414243444546474849" "50515253545556575859"
+        "60616263646566676869" "70717273747576777879"
+        "80818283848586878889" "90919293949596979899";
+
+    char digits[24];
+    char * const end = digits + sizeof( digits );
+    char * first = end;
+    while( _value >= 100 )
+    {
+        const size_t pair = static_cast<size_t>( _value % 100 ) * 2;
+        _value /= 100;
+        *--first = pairs[pair + 1];
+        *--first = pairs[pair];
+    }
+
+    if( _value >= 10 )
+    {
+        const size_t pair = static_cast<size_t>( _value ) * 2;
+        *--first = pairs[pair + 1];
+        *--first = pairs[pair];
+    }
+    else
+    {
+        *--first = static_cast<char>( '0' + _value );
+    }
+
+    const size_t size = static_cast<size_t>( end - first );
+    std::memcpy( _output, first, size );
+    return size;
+}
+
+template< typename T > inline
+void encode_unsigned( record_buffer & _record, T _value )
+{
+    char text[24];
+    _record.append( text, format_unsigned( text, _value ) );
+}
+
+/**@tparam U The unsigned type holding the magnitude of the value */
+template< typename U, typename T > inline
+void encode_signed( record_buffer & _record, T _value )
+{
+    char text[24];
+    size_t size = 0;
+    U magnitude = static_cast<U>( _value );
+    if( _value < 0 )
+    {
+        text[size++] = '-';
+        magnitude = static_cast<U>( 0 ) - magnitude;
+    }
+    size += format_unsigned( text + size, magnitude );
+    _record.append( text, size );
+}
+
+/**@brief Writes a floating-point number as the stream would, with snprintf() rather than std::num_put
+ * @param[in] _long Whether the value is a long double
+ *
+ * Integral values of the default notation that need no exponent are written
+ * as integers. */
+template< typename T > inline
+void encode_floating( record_stream & _stream, T _value, bool _long )
+{
+    const std::ios_base::fmtflags flags = _stream.flags();
+    const std::ios_base::fmtflags notation = flags & std::ios_base::floatfield;
+    const int precision = static_cast<int>( _stream.precision() );
+    if( 0 == notation && !( flags & ( std::ios_base::showpoint | std::ios_base::showpos ) ) )
+    {
+        const T magnitude = _value < 0 ? -_value : _value;
+        const unsigned long integral = magnitude < 4294967296.0 ? static_cast<unsigned long>( magnitude ) : 0;
+        if( integral && static_cast<T>( integral ) == magnitude )
+        {
+            char text[24];
+            size_t size = 0;
+            if( _value < 0 )
+                text[size++] = '-';
+            const size_t digits = format_unsigned( text + size, integral );
+            // beyond the precision, the number is written with an exponent
+            if( digits <= static_cast<size_t>( precision < 0 ? 6 : precision > 0 ? precision : 1 ) )
+            {
+                _stream.buffer().append( text, size + digits );
+                return;
+            }
+        }
+    }
+
+    char format[8];
+    size_t length = 0;
+    format[length++] = '%';
+    if( flags & std::ios_base::showpos )
+        format[length++] = '+';
+    if( flags & std::ios_base::showpoint )
+        format[length++] = '#';
+    format[length++] = '.';
+    format[length++] = '*';
+    if( _long )
+        format[length++] = 'L';
+    const bool uppercase = ( 0 != ( flags & std::ios_base::uppercase ) );
+    if( std::ios_base::fixed == notation )
+        format[length++] = 'f';
+    else if( std::ios_base::scientific == notation )
+        format[length++] = uppercase ? 'E' : 'e';
+    else
+        format[length++] = uppercase ? 'G' : 'g';
+    format[length] = '\0';
+
+    char text[64];
+    const int size = QLOG_SNPRINTF( text, sizeof( text ), format, precision, _value );
+    bool ok = ( size > 0 && static_cast<size_t>( size ) < sizeof( text ) );
+
+    // the C locale of the program may have another decimal point
+    for( int i = 0; ok && i < size; ++i )
+        ok = ( 0 != std::strchr( "0123456789.+-eEinfaINFA", text[i] ) );
+
+    if( ok )
+        _stream.buffer().append( text, static_cast<size_t>( size ) );
+    else
+        _stream << _value;
+}
+
+template< typename U, typename T > inline
+void format_signed( record_stream & _stream, T _value )
+{
+    if( _stream.plain_integers() )
+        encode_signed<U>( _stream.buffer(), _value );
+    else
+        _stream << _value;
+}
+
+template< typename T > inline
+void format_unsigned_value( record_stream & _stream, T _value )
+{
+    if( _stream.plain_integers() )
+        encode_unsigned( _stream.buffer(), _value );
+    else
+        _stream << _value;
+}
+
+template< typename T > inline
+void format_floating( record_stream & _stream, T _value, bool _long )
+{
+    // std::ios_base::fixed | std::ios_base::scientific is the hexadecimal notation of C++11
+    if( _stream.plain_floats() && ( _stream.flags() & std::ios_base::floatfield ) != std::ios_base::floatfield )
+        encode_floating( _stream, _value, _long );
+    else
+        _stream << _value;
+}
+
+/**@brief Writes a value to a stream, as operator<< does
+ *
+ * Numbers written to a record_stream skip the std::num_put facet of the
+ * locale when it would not change anything: integers are converted by
+ * format_unsigned() and floating-point numbers by snprintf(), into the buffer. */
+template< typename Stream, typename T > inline
+void format_value( Stream & _stream, const T & _value )
+{
+    _stream << _value;
+}
+
+inline void format_value( record_stream & _stream, short _value ) { format_signed<unsigned long>( _stream, _value ); }
+inline void format_value( record_stream & _stream, unsigned short _value ) { format_unsigned_value( _stream, _value ); }
+inline void format_value( record_stream & _stream, int _value ) { format_signed<unsigned long>( _stream, _value ); }
+inline void format_value( record_stream & _stream, unsigned int _value ) { format_unsigned_value( _stream, _value ); }
+inline void format_value( record_stream & _stream, long _value ) { format_signed<unsigned long>( _stream, _value ); }
+inline void format_value( record_stream & _stream, unsigned long _value ) { format_unsigned_value( _stream, _value ); }
+#ifdef QLOG_HAS_LONG_LONG
+inline void format_value( record_stream & _stream, long long _value ) { format_signed<unsigned long long>( _stream, _value ); }
+inline void format_value( record_stream & _stream, unsigned long long _value ) { format_unsigned_value( _stream, _value ); }
+#endif
+inline void format_value( record_stream & _stream, float _value ) { format_floating( _stream, static_cast<double>( _value ), false ); }
+inline void format_value( record_stream & _stream, double _value ) { format_floating( _stream, _value, false ); }
+inline void format_value( record_stream & _stream, long double _value ) { format_floating( _stream, _value, true ); }
+/**@endcond */
+
+
+// -------------------------------------------------------------------------- //
+/**@cond GENERATE_INTERNAL_DOCUMENTATION
+ * @brief The tags of the arguments stored in a binary record.
+ *
+ * A binary record is a sequence of arguments, each made of a one-byte tag
+ * followed by the raw bytes of the value. Text is stored as its length
+ * (an unsigned) followed by the characters. std::endl has a tag of its own,
+ * and other manipulators are stored as function pointers, which only the
+ * process that wrote the record can use. A record_header precedes each
+ * record. */
+namespace argument
+{
+static const char text = 't';
+static const char manipulator = 'm';
+static const char boolean = 'b';
+static const char character = 'c';
+static const char signed_character = 'a';
+static const char unsigned_character = 'A';
+static const char short_integer = 'h';
+static const char unsigned_short_integer = 'H';
+static const char integer = 'i';
+static const char unsigned_integer = 'I';
+static const char long_integer = 'l';
+static const char unsigned_long_integer = 'L';
+static const char long_long_integer = 'x';
+static const char unsigned_long_long_integer = 'X';
+static const char single_precision = 'f';
+static const char double_precision = 'd';
+static const char extended_precision = 'e';
+static const char pointer = 'p';
+static const char format = 'F';
+static const char endline = 'n';
+}
+
+/**@struct record_header
+ * @brief What precedes each binary record
+ *
+ * Binary records are meant to be decoded on the platform that wrote them:
+ * the header and the values are stored with their native size and
+ * endianness. */
+struct record_header
+{
+    unsigned m_size; ///< The length of the record, header included
+    unsigned m_level;
+    time_t m_seconds; ///< When the message was logged, see current_time()
+    unsigned long m_nanoseconds;
+    unsigned long m_thread; ///< The id of the thread that logged the message
+};
+
+/**@brief What a file of binary records may start with, see binary_sink */
+static const char binary_file_magic[8] = { 'Q', 'L', 'O', 'G', 'B', 'I', 'N', '1' };
+
+/**@brief The formatting state of a stream, which manipulators change */
+struct format_state
+{
+    std::ios_base::fmtflags m_flags;
+    std::streamsize m_precision;
+    std::streamsize m_width;
+    char m_fill;
+
+    bool operator==( const format_state & _other ) const
+    {
+        return m_flags == _other.m_flags && m_precision == _other.m_precision
+            && m_width == _other.m_width && m_fill == _other.m_fill;
+    }
+
+    /**@brief The state of a newly constructed stream */
+    static format_state initial()
+    {
+        const format_state state = { std::ios_base::dec | std::ios_base::skipws, 6, 0, ' ' };
+        return state;
+    }
+
+    static format_state of( const std::ostream & _stream )
+    {
+        const format_state state = { _stream.flags(), _stream.precision(), _stream.width(), _stream.fill() };
+        return state;
+    }
+
+    void apply( std::ostream & _stream ) const
+    {
+        _stream.flags( m_flags );
+        _stream.precision( m_precision );
+        _stream.width( m_width );
+        _stream.fill( m_fill );
+    }
+};
+
+template< typename T > inline
+void capture_value( record_buffer & _record, char _tag, const T & _value )
+{
+    char bytes[1 + sizeof( T )];
+    bytes[0] = _tag;
+    std::memcpy( bytes + 1, &_value, sizeof( T ) );
+    _record.append( bytes, sizeof( bytes ) );
+}
+
+/**@brief Starts a text argument whose characters are written next
+ * @return What end_text() needs to know */
+inline
+size_t begin_text( record_buffer & _record )
+{
+    char bytes[1 + sizeof( unsigned )];
+    bytes[0] = argument::text;
+    std::memset( bytes + 1, 0, sizeof( unsigned ) );
+    return _record.append( bytes, sizeof( bytes ) ) ? _record.size() : 0;
+}
+
+/**@brief Ends a text argument by writing its length */
+inline
+void end_text( record_buffer & _record, size_t _start )
+{
+    if( 0 == _start )
+        return;
+
+    const unsigned length = static_cast<unsigned>( _record.size() - _start );
+    _record.overwrite( _start - sizeof( unsigned ), &length, sizeof( unsigned ) );
+}
+
+inline
+void capture_text( record_buffer & _record, const char * _text, size_t _size )
+{
+    const size_t start = begin_text( _record );
+    if( start )
+    {
+        _record.append( _text, _size );
+        end_text( _record, start );
+    }
+}
+
+/**@brief Stores a value the writer will format, which consumes the width like formatting does */
+template< typename T > inline
+void capture_argument( record_stream & _stream, char _tag, const T & _value )
+{
+    capture_value( _stream.buffer(), _tag, _value );
+    _stream.width( 0 );
+}
+
+/**@brief Stores the formatting state of the stream in a binary record */
+inline
+void capture_format( record_stream & _stream )
+{
+    capture_value( _stream.buffer(), argument::format, format_state::of( _stream ) );
+}
+
+/**@brief Stores an argument in a binary record
+ *
+ * The types the stream would format are stored as they are. Anything else
+ * is formatted right away and stored as text, and if that changed the
+ * formatting state, like manipulators do, the new state is stored too. */
+template< typename T > inline
+void capture_formatted( record_stream & _stream, const T & _value )
+{
+    const format_state before = format_state::of( _stream );
+    const size_t start = begin_text( _stream.buffer() );
+    _stream << _value;
+    end_text( _stream.buffer(), start );
+
+    if( !( format_state::of( _stream ) == before ) )
+        capture_format( _stream );
+}
+
+template< typename T > inline
+void capture( record_stream & _stream, const T & _value )
+{
+    capture_formatted( _stream, _value );
+}
+
+inline void capture( record_stream & _stream, bool _value ) { capture_argument( _stream, argument::boolean, _value ); }
+inline void capture( record_stream & _stream, char _value ) { capture_argument( _stream, argument::character, _value ); }
+inline void capture( record_stream & _stream, signed char _value ) { capture_argument( _stream, argument::signed_character, _value ); }
+inline void capture( record_stream & _stream, unsigned char _value ) { capture_argument( _stream, argument::unsigned_character, _value ); }
+inline void capture( record_stream & _stream, short _value ) { capture_argument( _stream, argument::short_integer, _value ); }
+inline void capture( record_stream & _stream, unsigned short _value ) { capture_argument( _stream, argument::unsigned_short_integer, _value ); }
+inline void capture( record_stream & _stream, int _value ) { capture_argument( _stream, argument::integer, _value ); }
+inline void capture( record_stream & _stream, unsigned _value ) { capture_argument( _stream, argument::unsigned_integer, _value ); }
+inline void capture( record_stream & _stream, long _value ) { capture_argument( _stream, argument::long_integer, _value ); }
+inline void capture( record_stream & _stream, unsigned long _value ) { capture_argument( _stream, argument::unsigned_long_integer, _value ); }
+#ifdef QLOG_HAS_LONG_LONG
+inline void capture( record_stream & _stream, long long _value ) { capture_argument( _stream, argument::long_long_integer, _value ); }
+inline void capture( record_stream & _stream, unsigned long long _value ) { capture_argument( _stream, argument::unsigned_long_long_integer, _value ); }
+#endif
+inline void capture( record_stream & _stream, float _value ) { capture_argument( _stream, argument::single_precision, _value ); }
+inline void capture( record_stream & _stream, double _value ) { capture_argument( _stream, argument::double_precision, _value ); }
+inline void capture( record_stream & _stream, long double _value ) { capture_argument( _stream, argument::extended_precision, _value ); }
+inline void capture( record_stream & _stream, const void * _value ) { capture_argument( _stream, argument::pointer, _value ); }
+
+inline
+void capture( record_stream & _stream, standard_endline _value )
+{
+    if( static_cast<standard_endline>( std::endl ) == _value )
+    {
+        const char tag = argument::endline;
+        _stream.buffer().append( &tag, 1 );
+    }
+    else
+    {
+        capture_value( _stream.buffer(), argument::manipulator, _value );
+    }
+}
+
+inline
+void capture( record_stream & _stream, const char * _value )
+{
+    if( _stream.width() )
+        capture_formatted( _stream, _value ); // padded
+    else if( _value )
+        capture_text( _stream.buffer(), _value, std::strlen( _value ) );
+}
+
+inline
+void capture( record_stream & _stream, char * _value )
+{
+    capture( _stream, static_cast<const char *>( _value ) );
+}
+
+inline
+void capture( record_stream & _stream, const std::string & _value )
+{
+    if( _stream.width() )
+        capture_formatted( _stream, _value ); // padded
+    else
+        capture_text( _stream.buffer(), _value.data(), _value.size() );
+}
+
+template< typename T, typename Stream > inline
+bool decode_value( const char * _data, size_t _size, size_t & _position, Stream & _output )
+{
+    T value;
+    if( _size - _position < sizeof( T ) )
+        return false;
+
+    std::memcpy( &value, _data + _position, sizeof( T ) );
+    _position += sizeof( T );
+    format_value( _output, value );
+    return true;
+}
+
+/**@brief Formats the arguments of a binary record, as the stream would have done it
+ * @param[in] _data The arguments
+ * @param[in] _size The length of the arguments
+ * @param[out] _output Where the text is written
+ * @param[in] _trusted Whether the record was written by this very process,
+ *            which makes its manipulators usable
+ * @return false if the record is corrupted */
+template< typename Stream > inline
+bool decode_arguments( const char * _data, size_t _size, Stream & _output, bool _trusted )
+{
+    size_t position = 0;
+    bool ok = true;
+    while( ok && position < _size )
+    {
+        switch( _data[position++] )
+        {
+        case argument::text:
+        {
+            unsigned length = 0;
+            ok = ( _size - position >= sizeof( unsigned ) );
+            if( ok )
+            {
+                std::memcpy( &length, _data + position, sizeof( unsigned ) );
+                position += sizeof( unsigned );
+                ok = ( _size - position >= length );
+            }
+            if( ok )
+            {
+                _output.write( _data + position, static_cast<std::streamsize>( length ) );
+                position += length;
+            }
+            break;
+        }
+        case argument::manipulator:
+        {
+            standard_endline manipulator = 0;
+            ok = ( _size - position >= sizeof( standard_endline ) );
+            if( ok )
+            {
+                std::memcpy( &manipulator, _data + position, sizeof( standard_endline ) );
+                position += sizeof( standard_endline );
+                if( _trusted )
+                    manipulator( _output );
+            }
+            break;
+        }
+        case argument::endline:
+            std::endl( _output );
+            break;
+        case argument::boolean: ok = decode_value<bool>( _data, _size, position, _output ); break;
+        case argument::character: ok = decode_value<char>( _data, _size, position, _output ); break;
+        case argument::signed_character: ok = decode_value<signed char>( _data, _size, position, _output ); break;
+        case argument::unsigned_character: ok = decode_value<unsigned char>( _data, _size, position, _output ); break;
+        case argument::short_integer: ok = decode_value<short>( _data, _size, position, _output ); break;
+        case argument::unsigned_short_integer: ok = decode_value<unsigned short>( _data, _size, position, _output ); break;
+        case argument::integer: ok = decode_value<int>( _data, _size, position, _output ); break;
+        case argument::unsigned_integer: ok = decode_value<unsigned>( _data, _size, position, _output ); break;
+        case argument::long_integer: ok = decode_value<long>( _data, _size, position, _output ); break;
+        case argument::unsigned_long_integer: ok = decode_value<unsigned long>( _data, _size, position, _output ); break;
+#ifdef QLOG_HAS_LONG_LONG
+        case argument::long_long_integer: ok = decode_value<long long>( _data, _size, position, _output ); break;
+        case argument::unsigned_long_long_integer: ok = decode_value<unsigned long long>( _data, _size, position, _output ); break;
+#endif
+        case argument::single_precision: ok = decode_value<float>( _data, _size, position, _output ); break;
+        case argument::double_precision: ok = decode_value<double>( _data, _size, position, _output ); break;
+        case argument::extended_precision: ok = decode_value<long double>( _data, _size, position, _output ); break;
+        case argument::pointer: ok = decode_value<const void *>( _data, _size, position, _output ); break;
+        case argument::format:
+        {
+            format_state state;
+            ok = ( _size - position >= sizeof( format_state ) );
+            if( ok )
+            {
+                std::memcpy( &state, _data + position, sizeof( format_state ) );
+                position += sizeof( format_state );
+                state.apply( _output );
+            }
+            break;
+        }
+        default: ok = false; break;
+        }
+    }
+    return ok;
+}
+
+/**@brief The length of the argument a binary record holds at some position, its tag included
+ * @param[in] _data The argument
+ * @param[in] _size The length of the arguments from _data on
+ * @return 0 if the argument is corrupted */
+inline
+size_t argument_size( const char * _data, size_t _size )
+{
+    size_t size = 0;
+    switch( _size ? _data[0] : 0 )
+    {
+    case argument::text:
+    {
+        unsigned length = 0;
+        if( _size < 1 + sizeof( unsigned ) )
+            return 0;
+        std::memcpy( &length, _data + 1, sizeof( unsigned ) );
+        size = sizeof( unsigned ) + length;
+        break;
+    }
+    case argument::manipulator: size = sizeof( standard_endline ); break;
+    case argument::endline: break;
+    case argument::boolean: size = sizeof( bool ); break;
+    case argument::character:
+    case argument::signed_character:
+    case argument::unsigned_character: size = sizeof( char ); break;
+    case argument::short_integer:
+    case argument::unsigned_short_integer: size = sizeof( short ); break;
+    case argument::integer:
+    case argument::unsigned_integer: size = sizeof( int ); break;
+    case argument::long_integer:
+    case argument::unsigned_long_integer: size = sizeof( long ); break;
+#ifdef QLOG_HAS_LONG_LONG
+    case argument::long_long_integer:
+    case argument::unsigned_long_long_integer: size = sizeof( long long ); break;
+#endif
+    case argument::single_precision: size = sizeof( float ); break;
+    case argument::double_precision: size = sizeof( double ); break;
+    case argument::extended_precision: size = sizeof( long double ); break;
+    case argument::pointer: size = sizeof( const void * ); break;
+    case argument::format: size = sizeof( format_state ); break;
+    default: return 0;
+    }
+    return _size - 1 >= size ? 1 + size : 0;
+}
+
+/**@brief Formats consecutive binary records
+ * @param[in] _data The records, each one starting with its record_header
+ * @param[in] _size The length of the records
+ * @param[out] _output Where the text is written
+ * @param[in] _trusted Whether the records were written by this very process
+ * @param[out] _used The number of bytes that make whole records, if not null
+ * @return false if the records are corrupted */
+template< typename Stream > inline
+bool decode_records( const char * _data, size_t _size, Stream & _output, bool _trusted, size_t * _used = 0 )
+{
+    size_t position = 0;
+    bool ok = true;
+    while( ok && _size - position >= sizeof( record_header ) )
+    {
+        record_header header;
+        std::memcpy( &header, _data + position, sizeof( record_header ) );
+        if( header.m_size > _size - position )
+            break;
+
+        format_state::initial().apply( _output );
+        ok = header.m_size >= sizeof( record_header )
+          && decode_arguments( _data + position + sizeof( record_header ), header.m_size - sizeof( record_header ), _output, _trusted );
+        if( ok )
+            position += header.m_size;
+    }
+
+    if( _used )
+        *_used = position;
+    return ok;
+}
+/**@endcond */
+
+// -------------------------------------------------------------------------- //
+/**@struct timestamp
+ * @brief A decoration writing the date and time at which a message is logged
+ *
+ * timestamp, thread_id, level_tag and source_location are prefix fields: put
+ * in prepend() or append(), they are rendered again for every message.
+ *
+ * @code{.cpp}
+ * qlog::info.prepend() << qlog::timestamp( 3 ) << " [" << qlog::thread_id() << "] "
+ *                      << qlog::level_tag() << " " << qlog::source_location() << ": ";
+ * QLOG_INFO << "started" << std::endl;
+ * // 2014-03-01 12:30:45.123 [4242] INFO main.cpp:12: started
+ * @endcode
+ *
+ * The date is only formatted again when the second changes.
+ */
+struct timestamp
+{
+    /**@param[in] _precision The number of digits after the seconds, up to 9
+     * @param[in] _utc Pass true to write UTC rather than local time */
+    explicit
+    timestamp( unsigned _precision = 3, bool _utc = false )
+        :m_precision( _precision > 9 ? 9 : _precision )
+        ,m_utc( _utc )
+    {
+    }
+
+    unsigned getPrecision() const { return m_precision; }
+    bool isUtc() const { return m_utc; }
+
+private:
+    unsigned m_precision;
+    bool m_utc;
+};
+
+/**@struct thread_id
+ * @brief A decoration writing the id of the thread logging the message
+ *
+ * The id is the one the system shows (gettid() on linux, GetCurrentThreadId()
+ * on windows). It is only formatted once per thread. */
+struct thread_id
+{
+};
+
+/**@struct level_tag
+ * @brief A decoration writing the level of the logger: DEBUG, TRACE, INFO, WARNING or ERROR */
+struct level_tag
+{
+};
+
+/**@struct source_location
+ * @brief A decoration writing the file name and line of the message, as in main.cpp:12
+ *
+ * The location is only known to the messages logged with QLOG_HERE, which the
+ * QLOG_DEBUG family of macros use. Nothing is written for the other messages. */
+struct source_location
+{
+};
+
+/**@struct module_name
+ * @brief A decoration writing the name of the module of the message, as in net.http
+ *
+ * Only the messages logged through a module, see qlog::module, have one:
+ * nothing is written for the other messages. */
+struct module_name
+{
+};
+
+/**@struct location
+ * @brief Where a message is logged from, see QLOG_HERE */
+struct location
+{
+    location( const char * _file, unsigned _line )
+        :m_file( _file )
+        ,m_line( _line )
+    {
+    }
+
+    const char * m_file;
+    unsigned m_line;
+};
+
+/**@brief Tells a message where it is logged from: @code qlog::info << QLOG_HERE << "text"; @endcode */
+#ifdef QLOG_NAMESPACE
+#   define QLOG_HERE ::QLOG_NAMESPACE::location( __FILE__, __LINE__ )
+#else
+#   define QLOG_HERE ::qlog::location( __FILE__, __LINE__ )
+#endif
+
+// -------------------------------------------------------------------------- //
+/**@struct field_cache
+ * @cond GENERATE_INTERNAL_DOCUMENTATION
+ * @brief What a thread remembers between two renderings of the prefix fields. */
+struct field_cache
+{
+    field_cache()
+        :m_second( 0 )
+        ,m_utc( false )
+        ,m_time_size( 0 )
+        ,m_thread_size( 0 )
+        ,m_thread_id( 0 )
+    {
+    }
+
+    time_t m_second; ///< The second m_time is the text of
+    bool m_utc;
+    size_t m_time_size;
+    char m_time[32];
+    size_t m_thread_size; ///< 0 until the id of the thread is known
+    char m_thread[24];
+    unsigned long m_thread_id;
+};
+
+/**@brief Writes a number in decimal
+ * @return The number of characters written, at most 20 */
+inline
+size_t format_decimal( char * _output, unsigned long _value )
+{
+    return format_unsigned( _output, _value );
+}
+
+inline
+void current_time( time_t & _seconds, unsigned long & _nanoseconds )
+{
+#   ifdef WIN32
+    FILETIME now;
+    GetSystemTimeAsFileTime( &now );
+    const unsigned __int64 ticks = ( ( static_cast<unsigned __int64>( now.dwHighDateTime ) << 32 ) | now.dwLowDateTime )
+                                 - 116444736000000000ULL; // from 1601 to 1970, in 100ns
+    _seconds = static_cast<time_t>( ticks / 10000000 );
+    _nanoseconds = static_cast<unsigned long>( ticks % 10000000 ) * 100;
+#   else
+    struct timespec now;
+    clock_gettime( CLOCK_REALTIME, &now );
+    _seconds = now.tv_sec;
+    _nanoseconds = static_cast<unsigned long>( now.tv_nsec );
+#   endif
+}
+
+/**@brief A clock that only goes forward, for the flush policy */
+inline
+unsigned long monotonic_milliseconds()
+{
+#   ifdef WIN32
+    return GetTickCount();
+#   else
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return static_cast<unsigned long>( now.tv_sec ) * 1000 + static_cast<unsigned long>( now.tv_nsec ) / 1000000;
+#   endif
+}
+
+#if defined QLOG_STATS || defined QLOG_ASYNC
+/**@brief A monotonic clock in nanoseconds, for the lock waits counted by QLOG_STATS and the
+ *        spinning of the writer thread */
+inline
+size_t monotonic_nanoseconds()
+{
+#   ifdef WIN32
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER now;
+    QueryPerformanceFrequency( &frequency );
+    QueryPerformanceCounter( &now );
+    return static_cast<size_t>( static_cast<double>( now.QuadPart ) * 1e9 / static_cast<double>( frequency.QuadPart ) );
+#   else
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return static_cast<size_t>( now.tv_sec ) * 1000000000UL + static_cast<size_t>( now.tv_nsec );
+#   endif
+}
+#endif
+
+inline
+unsigned long current_thread_id()
+{
+#   ifdef WIN32
+    return GetCurrentThreadId();
+#   elif defined __linux__
+    return static_cast<unsigned long>( syscall( SYS_gettid ) );
+#   elif defined QLOG_MULTITHREAD_CPP11
+    return static_cast<unsigned long>( std::hash<std::thread::id>()( std::this_thread::get_id() ) );
+#   elif defined QLOG_MULTITHREAD_PTHREAD
+    unsigned long id = 0;
+    const pthread_t self = pthread_self();
+    std::memcpy( &id, &self, sizeof( id ) < sizeof( self ) ? sizeof( id ) : sizeof( self ) );
+    return id;
+#   else
+    return static_cast<unsigned long>( getpid() );
+#   endif
+}
+
+/**@brief Renders a timestamp
+ * @return The number of characters written to _output, which must hold 42 */
+inline
+size_t format_time( field_cache & _cache, char * _output, unsigned _precision, bool _utc )
+{
+    time_t seconds = 0;
+    unsigned long nanoseconds = 0;
+    current_time( seconds, nanoseconds );
+
+    if( 0 == _cache.m_time_size || seconds != _cache.m_second || _utc != _cache.m_utc )
+    {
+        struct tm parts;
+#       ifdef WIN32
+        const bool ok = 0 == ( _utc ? gmtime_s( &parts, &seconds ) : localtime_s( &parts, &seconds ) );
+#       else
+        const bool ok = 0 != ( _utc ? gmtime_r( &seconds, &parts ) : localtime_r( &seconds, &parts ) );
+#       endif
+        _cache.m_time_size = ok ? std::strftime( _cache.m_time, sizeof( _cache.m_time ), "%Y-%m-%d %H:%M:%S", &parts ) : 0;
+        _cache.m_second = seconds;
+        _cache.m_utc = _utc;
+    }
+
+    std::memcpy( _output, _cache.m_time, _cache.m_time_size );
+    size_t size = _cache.m_time_size;
+    if( _precision )
+    {
+        for( unsigned i = _precision; i < 9; ++i )
+            nanoseconds /= 10;
+
+        _output[size] = '.';
+        for( unsigned i = _precision; i > 0; --i )
+        {
+            _output[size + i] = static_cast<char>( '0' + nanoseconds % 10 );
+            nanoseconds /= 10;
+        }
+        size += 1 + _precision;
+    }
+    return size;
+}
+
+/**@brief Renders the id of the calling thread
+ * @return The text, formatted on the first call only */
+inline
+const char * format_thread( field_cache & _cache, size_t & _size )
+{
+    if( 0 == _cache.m_thread_size )
+    {
+        _cache.m_thread_id = current_thread_id();
+        _cache.m_thread_size = format_decimal( _cache.m_thread, _cache.m_thread_id );
+    }
+
+    _size = _cache.m_thread_size;
+    return _cache.m_thread;
+}
+
+/**@brief The id of the calling thread, only asked to the system once */
+inline
+unsigned long cached_thread_id( field_cache & _cache )
+{
+    size_t size = 0;
+    format_thread( _cache, size );
+    return _cache.m_thread_id;
+}
+
+/**@brief The text of the level_tag decoration */
+inline
+const char * level_name( unsigned _level )
+{
+    switch( _level )
+    {
+    case loglevel::debug: return "DEBUG";
+    case loglevel::trace: return "TRACE";
+    case loglevel::info: return "INFO";
+    case loglevel::warning: return "WARNING";
+    case loglevel::error: return "ERROR";
+    default: return "";
+    }
+}
+/**@endcond */
+
+// -------------------------------------------------------------------------- //
+/**@struct backtrace_ring
+ * @brief The last binary records a thread logged below the level, see set_backtrace().
+ *
+ * The records follow each other in a circular buffer, which is only
+ * allocated when the first one is kept. The oldest records are forgotten to
+ * make room for the new ones. */
+struct backtrace_ring
+{
+    backtrace_ring()
+        :m_data( 0 )
+        ,m_capacity( 0 )
+        ,m_begin( 0 )
+        ,m_end( 0 )
+        ,m_count( 0 )
+        ,m_generation( 0 )
+    {
+    }
+
+    ~backtrace_ring()
+    {
+        delete[] m_data;
+    }
+
+    /**@brief Whether some records are kept, set_backtrace() not having been called since */
+    bool empty( unsigned _generation ) const { return 0 == m_count || _generation != m_generation; }
+
+    /**@brief Keeps a record, forgetting the oldest ones if needed
+     * @param[in] _generation The current settings::backtrace_generation
+     * @param[in] _records The most records to keep
+     * @throw nothing
+     *
+     * A record longer than the whole ring is cut, see push_cut(). */
+    void push( const char * _record, size_t _size, unsigned _generation, size_t _records )
+    {
+        if( !prepare( _generation, _records ) )
+            return;
+
+        if( _size > m_capacity )
+        {
+            push_cut( _record, _size );
+            return;
+        }
+
+        while( m_count && ( m_count >= _records || m_capacity - ( m_end - m_begin ) < _size ) )
+        {
+            unsigned oldest = 0;
+            copy_out( m_begin, reinterpret_cast<char *>( &oldest ), sizeof( oldest ) );
+            m_begin += oldest;
+            --m_count;
+        }
+
+        const size_t offset = m_end % m_capacity;
+        const size_t first = _size < m_capacity - offset ? _size : m_capacity - offset;
+        std::memcpy( m_data + offset, _record, first );
+        std::memcpy( m_data, _record + first, _size - first );
+        m_end += _size;
+        ++m_count;
+    }
+
+    /**@brief Appends the records kept to a buffer, the oldest first, and forgets them
+     * @return false if there are none
+     * @throw nothing */
+    bool take( record_buffer & _output, unsigned _generation )
+    {
+        if( empty( _generation ) )
+            return false;
+
+        char * const room = _output.extend( m_end - m_begin );
+        if( room )
+            copy_out( m_begin, room, m_end - m_begin );
+        m_begin = m_end = 0;
+        m_count = 0;
+        return 0 != room;
+    }
+
+private:
+    backtrace_ring( const backtrace_ring & );
+    backtrace_ring & operator=( const backtrace_ring & );
+
+    /**@brief Keeps the start of a record longer than the ring, which it fills alone
+     *
+     * The arguments that fit are kept whole, but for a text one, which can be
+     * cut. The record then ends with a text argument saying it was cut. */
+    void push_cut( const char * _record, size_t _size )
+    {
+        static const char marker[] = " [...]\n";
+        const size_t marker_size = 1 + sizeof( unsigned ) + sizeof( marker ) - 1;
+        if( m_capacity < sizeof( record_header ) + marker_size )
+            return;
+
+        m_begin = m_end = 0;
+        m_count = 0;
+
+        const size_t limit = m_capacity - marker_size;
+        size_t position = sizeof( record_header );
+        std::memcpy( m_data, _record, position );
+        while( position < _size )
+        {
+            const size_t length = argument_size( _record + position, _size - position );
+            if( 0 == length )
+                break;
+
+            if( position + length <= limit )
+            {
+                std::memcpy( m_data + position, _record + position, length );
+                position += length;
+                continue;
+            }
+
+            if( argument::text == _record[position] && position + 1 + sizeof( unsigned ) < limit )
+            {
+                const unsigned kept = static_cast<unsigned>( limit - position - 1 - sizeof( unsigned ) );
+                std::memcpy( m_data + position, _record + position, limit - position );
+                std::memcpy( m_data + position + 1, &kept, sizeof( unsigned ) );
+                position = limit;
+            }
+            break;
+        }
+
+        const unsigned text = sizeof( marker ) - 1;
+        m_data[position] = argument::text;
+        std::memcpy( m_data + position + 1, &text, sizeof( unsigned ) );
+        std::memcpy( m_data + position + 1 + sizeof( unsigned ), marker, text );
+        position += marker_size;
+
+        const unsigned size = static_cast<unsigned>( position );
+        std::memcpy( m_data, &size, sizeof( unsigned ) );
+        m_end = position;
+        m_count = 1;
+    }
+
+    /**@brief Makes the buffer as big as the settings say, forgetting what it held before they changed */
+    bool prepare( unsigned _generation, size_t _records )
+    {
+        if( m_data && _generation == m_generation )
+            return true;
+
+        const size_t capacity = _records * QLOG_BACKTRACE_RECORD_SIZE;
+        if( capacity != m_capacity )
+        {
+            delete[] m_data;
+            m_data = 0;
+            m_capacity = 0;
+            try
+            {
+                m_data = new char[capacity];
+                m_capacity = capacity;
+            }
+            catch( const std::bad_alloc & )
+            {
+                return false;
+            }
+        }
+
+        m_generation = _generation;
+        m_begin = m_end = 0;
+        m_count = 0;
+        return true;
+    }
+
+    void copy_out( size_t _position, char * _output, size_t _size ) const
+    {
+        const size_t offset = _position % m_capacity;
+        const size_t first = _size < m_capacity - offset ? _size : m_capacity - offset;
+        std::memcpy( _output, m_data + offset, first );
+        std::memcpy( _output + first, m_data, _size - first );
+    }
+
+    char * m_data;
+    size_t m_capacity;
+    size_t m_begin; ///< Where the oldest record starts, counting every byte ever kept
+    size_t m_end;
+    size_t m_count;
+    unsigned m_generation; ///< The settings::backtrace_generation m_data was prepared for
+};
+
+/**@struct record_state
+ * @brief What a thread needs to assemble a message.
+ *
+ * Each thread formats its messages in its own record_state, so that the
+ * loggers only need to be locked to write the finished message. A message
+ * logged while another one is assembled, by an argument that logs itself,
+ * gets a nested record_state, see available(). */
+struct record_state
+{
+    record_state()
+        :m_stream()
+        ,m_receivers( 0 )
+        ,m_binary( false )
+        ,m_colored( false )
+        ,m_pairs( 0 )
+        ,m_location( 0, 0 )
+        ,m_module( 0 )
+        ,m_cache()
+        ,m_traced( false )
+        ,m_backtrace()
+        ,m_outer( 0 )
+        ,m_nested( 0 )
+    {
+    }
+
+    ~record_state()
+    {
+        delete m_nested;
+    }
+
+    /**@brief Where the thread can start a message: here, unless a message is assembled here already
+     * @return 0 if a nested record_state was needed and could not be created
+     * @throw nothing */
+    record_state * available()
+    {
+        record_state * state = this;
+        while( state->m_receivers )
+        {
+            if( !state->m_nested )
+            {
+                try
+                {
+                    state->m_nested = new record_state();
+                }
+                catch( const std::bad_alloc & )
+                {
+                    return 0;
+                }
+                state->m_nested->m_outer = state;
+            }
+            state = state->m_nested;
+        }
+        return state;
+    }
+
+    /**@brief The backtrace ring of the thread, which the nested record_state share */
+    backtrace_ring & backtrace()
+    {
+        record_state * state = this;
+        while( state->m_outer )
+            state = state->m_outer;
+        return state->m_backtrace;
+    }
+
+    record_stream m_stream;
+    unsigned m_receivers; ///< 1 while a receiver holds the current message
+    bool m_binary; ///< Whether the arguments of the current message are captured rather than formatted
+    bool m_colored; ///< Whether the escape sequences of the colors are written, see set_color_policy()
+    unsigned m_pairs; ///< The number of key-value pairs written since the last text, see logger::kv()
+    location m_location; ///< Where the current message comes from, if known
+    const module_node * m_module; ///< The module the current message is logged through, if any
+    field_cache m_cache;
+    bool m_traced; ///< Whether the current message goes to m_backtrace rather than to the outputs
+    backtrace_ring m_backtrace;
+
+private:
+    record_state( const record_state & );
+    record_state & operator=( const record_state & );
+
+    record_state * m_outer; ///< The record_state this one is nested in, 0 for the first of the thread
+    record_state * m_nested; ///< Created the first time a message is logged while one is assembled here
+};
+
+/**@struct thread_records
+ * @brief Gives each thread its record_state.
+ *
+ * C++11 thread_local is used when available, then pthread keys. Otherwise,
+ * and only in multithread mode, the record_state of a thread is leaked when
+ * the thread ends.
+ */
+template< typename T >
+struct thread_records
+{
+    /**@brief The record_state of the calling thread
+     * @return 0 if it could not be created
+     * @throw nothing */
+    static record_state * get()
+    {
+#   if !defined QLOG_MULTITHREAD
+        static record_state state;
+        return &state;
+#   elif defined QLOG_HAS_THREAD_LOCAL
+        static thread_local record_state state;
+        return &state;
+#   elif defined QLOG_MULTITHREAD_PTHREAD
+        pthread_once( &m_once, &thread_records::create_key );
+        record_state * state = static_cast<record_state*>( pthread_getspecific( m_key ) );
+        if( !state )
+        {
+            state = create();
+            if( state && 0 != pthread_setspecific( m_key, state ) )
+            {
+                delete state;
+                state = 0;
+            }
+        }
+        return state;
+#   else
+        static QLOG_THREAD_LOCAL_POINTER record_state * state = 0;
+        if( !state )
+            state = create();
+        return state;
+#   endif
+    }
+
+    /**@brief Where the calling thread can start a message, see record_state::available()
+     * @return 0 if it could not be created
+     * @throw nothing */
+    static record_state * acquire()
+    {
+        record_state * const state = get();
+        return state ? state->available() : 0;
+    }
+
+private:
+    static record_state * create()
+    {
+        try
+        {
+            return new record_state();
+        }
+        catch( const std::bad_alloc & )
+        {
+            return 0;
+        }
+    }
+
+#   if defined QLOG_MULTITHREAD && !defined QLOG_HAS_THREAD_LOCAL && defined QLOG_MULTITHREAD_PTHREAD
+    static void create_key()
+    {
+        pthread_key_create( &m_key, &thread_records::destroy );
+    }
+
+    static void destroy( void * _state )
+    {
+        delete static_cast<record_state*>( _state );
+    }
+
+    static pthread_key_t m_key;
+    static pthread_once_t m_once;
+#   endif
+};
+
+#if defined QLOG_MULTITHREAD && !defined QLOG_HAS_THREAD_LOCAL && defined QLOG_MULTITHREAD_PTHREAD
+template< typename T >
+pthread_key_t thread_records<T>::m_key;
+
+template< typename T >
+pthread_once_t thread_records<T>::m_once = PTHREAD_ONCE_INIT;
+#endif
+
+typedef thread_records<int> records;
+/**@endcond */
+
+#ifdef QLOG_STATS
+// -------------------------------------------------------------------------- //
+/**@struct level_stats
+ * @brief What the loggers of a level did since init(), see get_stats() */
+struct level_stats
+{
+    size_t m_emitted; ///< Messages written, or handed to the writer thread
+    size_t m_filtered; ///< Messages rejected because of the level of logging
+    size_t m_bytes; ///< Bytes of the messages emitted, decorations included
+    size_t m_lock_wait_nanoseconds; ///< Time the logging threads spent waiting for the lock of the logger
+};
+
+/**@struct stats
+ * @brief A snapshot of the counters of the library, see get_stats() */
+struct stats
+{
+    level_stats m_levels[loglevel::error + 1]; ///< Indexed by level, as in m_levels[loglevel::info]
+    size_t m_queue_depth; ///< The slots of the asynchronous ring in use
+    size_t m_queue_high_water; ///< The most slots in use the writer thread has found
+    size_t m_dropped; ///< The messages the overflow policy discarded
+};
+
+/**@struct stats_counters
+ * @cond GENERATE_INTERNAL_DOCUMENTATION
+ * @brief The counters of a level, on a cache line of their own.
+ *
+ * Each level has QLOG_STATS_STRIPES of them, and each thread updates the one
+ * stats_stripe() gave it with relaxed atomic additions. The first
+ * QLOG_STATS_STRIPES threads have a stripe of their own, so the additions
+ * meet no contention; the next ones share the stripes. get_stats() adds
+ * them up.
+ */
+struct QLOG_CACHE_ALIGNED stats_counters
+{
+    atomic_integer<size_t> m_emitted;
+    atomic_integer<size_t> m_filtered;
+    atomic_integer<size_t> m_bytes;
+    atomic_integer<size_t> m_lock_wait;
+};
+
+/**@brief The number of the next thread to ask for a stripe */
+template< typename T >
+struct stats_threads
+{
+    static atomic_integer<unsigned> m_next;
+};
+
+template< typename T >
+atomic_integer<unsigned> stats_threads<T>::m_next = { 0 };
+
+/**@brief The number of the calling thread, given to the threads in turn
+ * @return Its stripe modulo QLOG_STATS_STRIPES: the stripe is its own if the number is lower */
+inline
+unsigned stats_stripe()
+{
+#   if !defined QLOG_MULTITHREAD
+    return 0;
+#   else
+#       ifdef QLOG_HAS_THREAD_LOCAL
+    static thread_local unsigned number = 0;
+#       else
+    static QLOG_THREAD_LOCAL_POINTER unsigned number = 0;
+#       endif
+    // 0 means not given yet
+    if( !number )
+        number = stats_threads<int>::m_next.fetch_add_relaxed( 1 ) + 1;
+    return number - 1;
+#   endif
+}
+
+/**@brief Adds to a counter of the stripe of a thread
+ *
+ * Always an atomic addition: a stripe shared by a late thread would lose
+ * the updates of a plain load and store by its first one. */
+inline
+void stats_add( atomic_integer<size_t> & _counter, size_t _value )
+{
+    _counter.fetch_add_relaxed( _value );
+}
+/**@endcond */
+#endif
+
+// -------------------------------------------------------------------------- //
+/**@struct sink
+ * @brief Where a logger writes its messages
+ *
+ * set_output( std::ostream & ) makes a logger write to an ostream_sink. The
+ * other sinks write to their destination without going through a
+ * std::ostream, and a class of your own can derive from sink as well.
+ *
+ * write() receives each message in one piece, prepended and appended text
+ * included. In multithread mode it is called with a lock held for the
+ * destination of the sink, so that two sinks writing to the same place, for
+ * loggers of different levels for instance, never write at the same time. In
+ * asynchronous mode it is only called by the writer thread, with as many
+ * messages at once as possible.
+ *
+ * @code{.cpp}
+ * qlog::fd_sink standard_error( 2 );
+ * qlog::set_output( standard_error );
+ * @endcode
+ */
+struct QLOG_VISIBLE sink
+{
+    virtual ~sink() { }
+
+    /**@brief Writes messages
+     * @param[in] _data The text
+     * @param[in] _size The length of the text */
+    virtual void write( const char * _data, size_t _size ) = 0;
+
+    /**@brief Makes what was written so far reach its destination, as std::endl does */
+    virtual void flush() = 0;
+
+    /**@brief Whether the sink wants binary records rather than text, see binary_sink */
+    virtual bool binary() const { return false; }
+
+    /**@brief What the sink writes to: sinks with the same destination are never written to at once
+     * @return The sink itself by default */
+    virtual size_t destination() const { return reinterpret_cast<size_t>( this ); }
+
+    /**@brief Whether the sink writes to a terminal, which is given the colors, see set_color_policy()
+     *
+     * It is asked once, when the sink is added to a logger. */
+    virtual bool terminal() const { return false; }
+
+    /**@brief Writes messages from a signal handler, see set_crash_handler()
+     *
+     * Only async-signal-safe functions can be called, and nothing is locked:
+     * the default drops the messages, as a std::ostream or a FILE * cannot
+     * be written to safely. */
+    virtual void write_on_crash( const char *, size_t ) { }
+
+    /**@brief Makes what was written reach its destination from a signal handler, see set_crash_handler() */
+    virtual void flush_on_crash() { }
+};
+
+#ifdef QLOG_MULTITHREAD
+/**@struct shared_sink_locks
+ * @cond GENERATE_INTERNAL_DOCUMENTATION
+ * @brief The locks serializing the writes to a destination, whatever the logger.
+ *
+ * A destination is given one of QLOG_SINK_LOCKS locks: sinks writing to
+ * different places seldom share one, and loggers of different levels writing
+ * to the same place always do. The locks are created by init().
+ */
+template< typename T >
+struct shared_sink_locks
+{
+    static mutex * get( const sink & _sink )
+    {
+        const size_t key = _sink.destination();
+        // the low bits of addresses carry little information
+        return m_locks[( key ^ ( key >> 4 ) ^ ( key >> 12 ) ) % QLOG_SINK_LOCKS];
+    }
+
+    static bool create()
+    {
+        try
+        {
+            for( size_t i = 0; i < QLOG_SINK_LOCKS; ++i )
+                m_locks[i] = new mutex();
+        }
+        catch( ... )
+        {
+            destroy();
+            return false;
+        }
+        return true;
+    }
+
+    static void destroy()
+    {
+        for( size_t i = 0; i < QLOG_SINK_LOCKS; ++i )
+        {
+            delete m_locks[i];
+            m_locks[i] = 0;
+        }
+    }
+
+    static mutex * m_locks[QLOG_SINK_LOCKS];
+};
+
+template< typename T >
+mutex * shared_sink_locks<T>::m_locks[QLOG_SINK_LOCKS] = { 0 };
+
+typedef shared_sink_locks<int> sink_locks;
+/**@endcond */
+#endif
+
+// -------------------------------------------------------------------------- //
+/**@struct ostream_sink
+ * @brief A sink writing to a std::ostream: this is what set_output( std::ostream & ) uses
+ *
+ * Whether the stream is a terminal cannot be told from the stream itself, so
+ * the caller says it; qlog.hpp leaves <iostream> and its static initializer
+ * out of the compile units that include it. */
+struct ostream_sink : public sink
+{
+    /**@param[in] _output The stream written to
+     * @param[in] _terminal Whether the stream writes to a terminal, see terminal() */
+    explicit
+    ostream_sink( std::ostream * _output = 0, bool _terminal = false )
+        :m_output( _output )
+        ,m_terminal( _terminal )
+    {
+    }
+
+    virtual ~ostream_sink() { }
+
+    void set_stream( std::ostream & _output, bool _terminal = false )
+    {
+        m_output = &_output;
+        m_terminal = _terminal;
+    }
+
+    std::ostream * get_stream() const { return m_output; }
+
+    virtual void write( const char * _data, size_t _size )
+    {
+        QLOG_ASSERT( m_output );
+        m_output->write( _data, static_cast<std::streamsize>( _size ) );
+    }
+
+    virtual void flush()
+    {
+        QLOG_ASSERT( m_output );
+        m_output->flush();
+    }
+
+    virtual size_t destination() const { return reinterpret_cast<size_t>( m_output ); }
+
+    /**@brief What the constructor or set_stream() was told */
+    virtual bool terminal() const { return m_terminal; }
+
+private:
+    ostream_sink( const ostream_sink & );
+    ostream_sink & operator=( const ostream_sink & );
+
+    std::ostream * m_output;
+    bool m_terminal;
+};
+
+// -------------------------------------------------------------------------- //
+/**@struct file_sink
+ * @brief A sink writing to a FILE *, which the sink does not close */
+struct file_sink : public sink
+{
+    explicit
+    file_sink( FILE * _file )
+        :m_file( _file )
+    {
+        QLOG_ASSERT( _file );
+    }
+
+    virtual ~file_sink() { }
+
+    virtual void write( const char * _data, size_t _size )
+    {
+        std::fwrite( _data, 1, _size, m_file );
+    }
+
+    virtual void flush()
+    {
+        std::fflush( m_file );
+    }
+
+    virtual size_t destination() const { return reinterpret_cast<size_t>( m_file ); }
+
+    virtual bool terminal() const
+    {
+#       ifndef WIN32
+        return 1 == isatty( fileno( m_file ) );
+#       else
+        return false;
+#       endif
+    }
+
+private:
+    file_sink( const file_sink & );
+    file_sink & operator=( const file_sink & );
+
+    FILE * m_file;
+};
+
+// -------------------------------------------------------------------------- //
+/**@brief Copies text without its ANSI escape sequences, such as \\033[31m
+ * @cond GENERATE_INTERNAL_DOCUMENTATION
+ * @param[in] _data The text
+ * @param[in] _size The length of the text
+ * @param[out] _output Where the text is copied */
+inline
+void strip_escapes( const char * _data, size_t _size, record_buffer & _output )
+{
+    _output.clear();
+    const char * const end = _data + _size;
+    while( _data < end )
+    {
+        const char * const escape = static_cast<const char *>( std::memchr( _data, '\033', static_cast<size_t>( end - _data ) ) );
+        const char * const stop = escape ? escape : end;
+        _output.append( _data, static_cast<size_t>( stop - _data ) );
+        if( !escape )
+            break;
+
+        // an escape, a bracket and parameters up to the final byte
+        _data = escape + 1;
+        if( _data < end && '[' == *_data )
+        {
+            for( ++_data; _data < end && ( *_data < 0x40 || *_data > 0x7e ); ++_data )
+            {
+            }
+            if( _data < end )
+                ++_data;
+        }
+    }
+}
+/** @endcond */
+
+// -------------------------------------------------------------------------- //
+/**@struct sink_list
+ * @brief A sink writing to several sinks: each logger writes to one
+ *
+ * A message is formatted once, and the same text is given to every sink of
+ * the list. Up to QLOG_MAX_SINKS sinks can be added, without allocating
+ * memory. The list also applies the flush policy, see set_flush_policy().
+ *
+ * When the list holds a binary sink, the loggers write binary records: the
+ * list gives them as they are to the binary sinks, and formats them once for
+ * the others.
+ *
+ * The colors are only written when a sink of the list is a terminal. When
+ * some others are not, the escape sequences are taken out of the text they
+ * are given. */
+struct sink_list : public sink
+{
+    sink_list()
+        :m_size( 0 )
+        ,m_binary( 0 )
+        ,m_terminals( 0 )
+        ,m_pending( 0 )
+        ,m_pending_since( 0 )
+        ,m_decoded()
+        ,m_plain()
+    {
+    }
+
+    virtual ~sink_list() { }
+
+    /**@brief Adds a sink to the list, unless it is already there
+     * @return false if the list is full
+     * @throw nothing */
+    bool add( sink & _sink )
+    {
+        for( size_t i = 0; i < m_size; ++i )
+        {
+            if( m_sinks[i] == &_sink )
+                return true;
+        }
+
+        if( QLOG_MAX_SINKS == m_size )
+            return false;
+
+        m_terminal[m_size] = _sink.terminal();
+        if( m_terminal[m_size] )
+            ++m_terminals;
+        m_sinks[m_size++] = &_sink;
+        if( _sink.binary() )
+            ++m_binary;
+        return true;
+    }
+
+    /**@brief Removes a sink from the list, if it is there */
+    void remove( sink & _sink )
+    {
+        for( size_t i = 0; i < m_size; ++i )
+        {
+            if( m_sinks[i] == &_sink )
+            {
+                if( _sink.binary() )
+                    --m_binary;
+                if( m_terminal[i] )
+                    --m_terminals;
+                for( ++i; i < m_size; ++i )
+                {
+                    m_sinks[i - 1] = m_sinks[i];
+                    m_terminal[i - 1] = m_terminal[i];
+                }
+                --m_size;
+            }
+        }
+    }
+
+    void clear() { m_size = 0; m_binary = 0; m_terminals = 0; }
+    bool empty() const { return 0 == m_size; }
+    size_t size() const { return m_size; }
+
+    /**@brief Whether one of the sinks wants binary records */
+    virtual bool binary() const { return 0 != m_binary; }
+
+    /**@brief Whether the messages written to the list carry their colors */
+    bool colored() const
+    {
+        if( colors::automatic == settings::color_policy )
+            return 0 != m_terminals;
+        return colors::always == settings::color_policy;
+    }
+
+    /**@brief Writes text to the sinks that are not binary */
+    virtual void write( const char * _data, size_t _size )
+    {
+        // only colored text goes to terminals and other sinks at once
+        const bool strip = colors::automatic == settings::color_policy && m_terminals;
+        bool stripped = false;
+        for( size_t i = 0; i < m_size; ++i )
+        {
+            if( m_sinks[i]->binary() )
+                continue;
+
+            if( !strip || m_terminal[i] )
+            {
+                write_to( *m_sinks[i], _data, _size );
+                continue;
+            }
+
+            if( !stripped )
+            {
+                strip_escapes( _data, _size, m_plain );
+                stripped = true;
+            }
+            write_to( *m_sinks[i], m_plain.data(), m_plain.size() );
+        }
+    }
+
+    virtual void flush()
+    {
+        for( size_t i = 0; i < m_size; ++i )
+        {
+#           ifdef QLOG_MULTITHREAD
+            mutex * const lock = sink_locks::get( *m_sinks[i] );
+            if( lock )
+                lock->lock();
+#           endif
+            m_sinks[i]->flush();
+#           ifdef QLOG_MULTITHREAD
+            if( lock )
+                lock->unlock();
+#           endif
+        }
+
+        m_pending = 0;
+    }
+
+    /**@brief Writes text to the sinks that are not binary, from a signal handler */
+    virtual void write_on_crash( const char * _data, size_t _size )
+    {
+        for( size_t i = 0; i < m_size; ++i )
+        {
+            if( !m_sinks[i]->binary() )
+                m_sinks[i]->write_on_crash( _data, _size );
+        }
+    }
+
+    /**@brief Writes binary records to the binary sinks, from a signal handler
+     *
+     * Formatting them for the other sinks is not async-signal-safe: those
+     * only get the messages that were text already. */
+    void write_records_on_crash( const char * _data, size_t _size )
+    {
+        for( size_t i = 0; i < m_size; ++i )
+        {
+            if( m_sinks[i]->binary() )
+                m_sinks[i]->write_on_crash( _data, _size );
+        }
+    }
+
+    virtual void flush_on_crash()
+    {
+        for( size_t i = 0; i < m_size; ++i )
+            m_sinks[i]->flush_on_crash();
+    }
+
+    /**@brief Writes messages, and flushes the sinks if the flush policy says so
+     * @param[in] _data The text, or the binary records
+     * @param[in] _size The length of the data
+     * @param[in] _endline Whether one of the messages asked for a flush, with std::endl
+     * @param[in] _level The highest level of the messages
+     * @param[in] _binary Whether the data are binary records
+     * @return true if the sinks were flushed */
+    bool write_messages( const char * _data, size_t _size, bool _endline, unsigned _level, bool _binary = false )
+    {
+        if( _size && _binary )
+            _endline = write_records( _data, _size ) || _endline;
+        else if( _size )
+            write( _data, _size );
+
+        if( 0 == m_pending && settings::flush_milliseconds )
+            m_pending_since = monotonic_milliseconds();
+
+        m_pending += _size;
+        if( must_flush( _endline, _level ) )
+        {
+            flush();
+            return true;
+        }
+        return false;
+    }
+
+    /**@brief Flushes the sinks if what they hold is older than the flush policy allows
+     * @return true if nothing is left to flush */
+    bool expire()
+    {
+        if( 0 == m_pending )
+            return true;
+
+        if( settings::flush_batched && settings::flush_milliseconds
+            && monotonic_milliseconds() - m_pending_since >= settings::flush_milliseconds )
+        {
+            flush();
+            return true;
+        }
+        return false;
+    }
+
+private:
+    /**@brief Writes to a sink, with its destination locked */
+    static void write_to( sink & _sink, const char * _data, size_t _size )
+    {
+#       ifdef QLOG_MULTITHREAD
+        mutex * const lock = sink_locks::get( _sink );
+        if( lock )
+            lock->lock();
+#       endif
+        _sink.write( _data, _size );
+#       ifdef QLOG_MULTITHREAD
+        if( lock )
+            lock->unlock();
+#       endif
+    }
+
+    /**@brief Gives binary records to the binary sinks, and their text to the others
+     * @return whether the records asked for a flush */
+    bool write_records( const char * _data, size_t _size )
+    {
+        for( size_t i = 0; i < m_size; ++i )
+        {
+            if( m_sinks[i]->binary() )
+                write_to( *m_sinks[i], _data, _size );
+        }
+
+        if( m_binary == m_size )
+            return false;
+
+        record_buffer & decoded = m_decoded.buffer();
+        decoded.clear();
+        decode_records( _data, _size, m_decoded, true );
+        write( decoded.data(), decoded.size() );
+        return decoded.flush_requested();
+    }
+
+    bool must_flush( bool _endline, unsigned _level )
+    {
+        if( !settings::flush_batched )
+            return _endline;
+
+        if( _level >= settings::flush_level )
+            return true;
+
+        if( settings::flush_bytes && m_pending >= settings::flush_bytes )
+            return true;
+
+        if( settings::flush_milliseconds )
+            return monotonic_milliseconds() - m_pending_since >= settings::flush_milliseconds;
+
+        return false;
+    }
+
+    sink_list( const sink_list & );
+    sink_list & operator=( const sink_list & );
+
+    sink * m_sinks[QLOG_MAX_SINKS];
+    bool m_terminal[QLOG_MAX_SINKS]; ///< What terminal() said when the sink was added
+    size_t m_size;
+    size_t m_binary; ///< The number of binary sinks
+    size_t m_terminals; ///< The number of sinks writing to a terminal
+    size_t m_pending; ///< Bytes written since the last flush
+    unsigned long m_pending_since; ///< When the oldest byte not flushed was written, see monotonic_milliseconds()
+    record_stream m_decoded; ///< The text of binary records, for the sinks that are not binary
+    record_buffer m_plain; ///< The text without its escape sequences, for the sinks that are not terminals
+};
+
+// -------------------------------------------------------------------------- //
+/**@struct binary_sink
+ * @brief A sink writing binary records to another sink, to be decoded later
+ *
+ * The loggers writing to a binary_sink do not format their messages: the
+ * arguments are copied as they are, after a record_header holding the level,
+ * the time and the thread of the message. The qlog-decode program turns such
+ * a file back into text. Anything written before the first record is
+ * preceded by binary_file_magic, which tells qlog-decode what the file is.
+ *
+ * @code{.cpp}
+ * qlog::rotating_file_sink file( "myprogram.qlog" );
+ * qlog::binary_sink records( file );
+ * qlog::set_output( records );
+ * @endcode
+ *
+ * @note Manipulators other than std::endl are not kept: std::hex and the
+ *       like are, as the format of the stream is recorded. The records use the sizes and the byte order of the machine that wrote
+ *       them.
+ */
+struct binary_sink : public sink
+{
+    explicit
+    binary_sink( sink & _destination )
+        :m_destination( _destination )
+        ,m_started( false )
+    {
+    }
+
+    virtual ~binary_sink() { }
+
+    virtual bool binary() const { return true; }
+
+    virtual void write( const char * _data, size_t _size )
+    {
+        if( !m_started )
+        {
+            m_destination.write( binary_file_magic, sizeof( binary_file_magic ) );
+            m_started = true;
+        }
+        m_destination.write( _data, _size );
+    }
+
+    virtual void flush()
+    {
+        m_destination.flush();
+    }
+
+    virtual void write_on_crash( const char * _data, size_t _size )
+    {
+        if( !m_started )
+        {
+            m_destination.write_on_crash( binary_file_magic, sizeof( binary_file_magic ) );
+            m_started = true;
+        }
+        m_destination.write_on_crash( _data, _size );
+    }
+
+    virtual void flush_on_crash()
+    {
+        m_destination.flush_on_crash();
+    }
+
+    /**@brief The destination of the sink written to, which shares its lock */
+    virtual size_t destination() const { return m_destination.destination(); }
+
+private:
+    binary_sink( const binary_sink & );
+    binary_sink & operator=( const binary_sink & );
+
+    sink & m_destination;
+    bool m_started;
+};
+
+// -------------------------------------------------------------------------- //
+/**@brief What a LZ4 frame starts with, see lz4_sink */
+static const char lz4_frame_magic[4] = { '\x04', '\x22', '\x4D', '\x18' };
+
+/**@cond GENERATE_INTERNAL_DOCUMENTATION
+ * @brief Reads 4 bytes in little endian order */
+inline
+unsigned lz4_read_le32( const unsigned char * _data )
+{
+    return static_cast<unsigned>( _data[0] ) | ( static_cast<unsigned>( _data[1] ) << 8 )
+        | ( static_cast<unsigned>( _data[2] ) << 16 ) | ( static_cast<unsigned>( _data[3] ) << 24 );
+}
+
+inline
+void lz4_write_le32( unsigned char * _output, unsigned _value )
+{
+    _output[0] = static_cast<unsigned char>( _value & 0xFF );
+    _output[1] = static_cast<unsigned char>( ( _value >> 8 ) & 0xFF );
+    _output[2] = static_cast<unsigned char>( ( _value >> 16 ) & 0xFF );
+    _output[3] = static_cast<unsigned char>( ( _value >> 24 ) & 0xFF );
+}
+
+/**@brief The byte checking a frame descriptor: the second byte of xxHash32, as the LZ4 frame format says
+ * @param[in] _data The descriptor, less than 16 bytes long */
+inline
+unsigned char lz4_descriptor_checksum( const unsigned char * _data, size_t _size )
+{
+    const unsigned prime1 = 2654435761U;
+    const unsigned prime2 = 2246822519U;
+    const unsigned prime3 = 3266489917U;
+    const unsigned prime4 = 668265263U;
+    const unsigned prime5 = 374761393U;
+
+    unsigned hash = prime5 + static_cast<unsigned>( _size );
+    size_t i = 0;
+    for( ; i + 4 <= _size; i += 4 )
+    {
+        hash += lz4_read_le32( _data + i ) * prime3;
+        hash = ( ( hash << 17 ) | ( hash >> 15 ) ) * prime4;
+    }
+    for( ; i < _size; ++i )
+    {
+        hash += _data[i] * prime5;
+        hash = ( ( hash << 11 ) | ( hash >> 21 ) ) * prime1;
+    }
+    hash ^= hash >> 15;
+    hash *= prime2;
+    hash ^= hash >> 13;
+    hash *= prime3;
+    hash ^= hash >> 16;
+    return static_cast<unsigned char>( ( hash >> 8 ) & 0xFF );
+}
+
+/**@brief The most bytes that lz4_compress_block() writes for an input of a given size */
+inline
+size_t lz4_compress_bound( size_t _size )
+{
+    return _size + _size / 255 + 16;
+}
+
+/**@brief Writes the length of literals or of a match past the 15 the token holds */
+inline
+unsigned char * lz4_write_length( unsigned char * _output, size_t _length )
+{
+    for( ; _length >= 255; _length -= 255 )
+        *_output++ = 255;
+    *_output++ = static_cast<unsigned char>( _length );
+    return _output;
+}
+
+/**@brief Compresses a block of at most 4 MB into the LZ4 block format, greedily, with a hash of 4096 positions
+ * @param[out] _output At least lz4_compress_bound( _size ) bytes
+ * @param[out] _table 4096 unsigned integers, overwritten
+ * @return The compressed length
+ * @throw nothing */
+inline
+size_t lz4_compress_block( const char * _input, size_t _size, char * _output, unsigned * _table )
+{
+    static const size_t minimum_match = 4;
+    static const size_t last_literals = 5; ///< The last bytes of a block are never part of a match
+    static const size_t match_start_limit = 12; ///< Nor do the last 12 bytes start one
+
+    const unsigned char * const input = reinterpret_cast<const unsigned char *>( _input );
+    const unsigned char * const end = input + _size;
+    const unsigned char * anchor = input;
+    unsigned char * output = reinterpret_cast<unsigned char *>( _output );
+    std::memset( _table, 0, 4096 * sizeof( unsigned ) );
+
+    if( _size > match_start_limit )
+    {
+        const unsigned char * const match_limit = end - match_start_limit;
+        const unsigned char * const extend_limit = end - last_literals;
+        for( const unsigned char * position = input; position < match_limit; )
+        {
+            const unsigned sequence = lz4_read_le32( position );
+            const unsigned hash = ( sequence * 2654435761U ) >> 20;
+            const unsigned char * const candidate = input + _table[hash];
+            _table[hash] = static_cast<unsigned>( position - input );
+
+            if( candidate >= position || position - candidate > 65535 || lz4_read_le32( candidate ) != sequence )
+            {
+                // the longer nothing matches, the faster the data is skipped
+                position += 1 + ( static_cast<size_t>( position - anchor ) >> 6 );
+                continue;
+            }
+
+            size_t length = minimum_match;
+            while( position + length < extend_limit && position[length] == candidate[length] )
+                ++length;
+
+            unsigned char * const token = output++;
+            const size_t literals = static_cast<size_t>( position - anchor );
+            *token = static_cast<unsigned char>( ( literals < 15 ? literals : 15 ) << 4 );
+            if( literals >= 15 )
+                output = lz4_write_length( output, literals - 15 );
+            std::memcpy( output, anchor, literals );
+            output += literals;
+
+            const size_t offset = static_cast<size_t>( position - candidate );
+            *output++ = static_cast<unsigned char>( offset & 0xFF );
+            *output++ = static_cast<unsigned char>( offset >> 8 );
+            const size_t extra = length - minimum_match;
+            *token = static_cast<unsigned char>( *token | ( extra < 15 ? extra : 15 ) );
+            if( extra >= 15 )
+                output = lz4_write_length( output, extra - 15 );
+
+            position += length;
+            anchor = position;
+        }
+    }
+
+    const size_t literals = static_cast<size_t>( end - anchor );
+    *output++ = static_cast<unsigned char>( ( literals < 15 ? literals : 15 ) << 4 );
+    if( literals >= 15 )
+        output = lz4_write_length( output, literals - 15 );
+    std::memcpy( output, anchor, literals );
+    output += literals;
+    return static_cast<size_t>( output - reinterpret_cast<unsigned char *>( _output ) );
+}
+
+/**@brief Reads the length of literals or of a match past the 15 the token holds
+ * @return false if the input ends first */
+inline
+bool lz4_read_length( const unsigned char *& _input, const unsigned char * _end, size_t & _length )
+{
+    unsigned char byte = 255;
+    while( 255 == byte )
+    {
+        if( _input == _end )
+            return false;
+        byte = *_input++;
+        _length += byte;
+    }
+    return true;
+}
+
+/**@brief Decompresses a LZ4 block at the end of a string, whose content the matches may refer to
+ * @param[in] _maximum The most bytes the block may decompress to
+ * @return false if the block is corrupted, in which case the string is left as it was
+ * @throw std::bad_alloc */
+inline
+bool lz4_decompress_block( const char * _data, size_t _size, std::string & _output, size_t _maximum )
+{
+    const size_t start = _output.size();
+    _output.resize( start + _maximum );
+
+    const unsigned char * input = reinterpret_cast<const unsigned char *>( _data );
+    const unsigned char * const input_end = input + _size;
+    size_t position = start;
+    const size_t output_end = start + _maximum;
+    bool ok = true;
+    while( ok && input < input_end )
+    {
+        const unsigned token = *input++;
+        size_t literals = token >> 4;
+        ok = ( 15 != literals || lz4_read_length( input, input_end, literals ) )
+            && literals <= static_cast<size_t>( input_end - input ) && literals <= output_end - position;
+        if( !ok )
+            break;
+        _output.replace( position, literals, reinterpret_cast<const char *>( input ), literals );
+        input += literals;
+        position += literals;
+
+        // the last sequence has no match
+        if( input == input_end )
+            break;
+
+        ok = ( input_end - input >= 2 );
+        if( !ok )
+            break;
+        const size_t offset = static_cast<size_t>( input[0] ) | ( static_cast<size_t>( input[1] ) << 8 );
+        input += 2;
+        size_t length = ( token & 15 ) + 4;
+        ok = 0 != offset && offset <= position && ( 19 != length || lz4_read_length( input, input_end, length ) )
+            && length <= output_end - position;
+        if( !ok )
+            break;
+
+        // a match may overlap what it writes: copied a byte at a time
+        for( size_t i = 0; i < length; ++i, ++position )
+            _output[position] = _output[position - offset];
+    }
+
+    _output.resize( ok ? position : start );
+    return ok;
+}
+/** @endcond */
+
+/**@brief Decompresses consecutive LZ4 frames, such as the ones written by lz4_sink or the lz4 program
+ *
+ * Skippable frames are skipped, and the checksums are not verified.
+ * @param[out] _output Where the decompressed data is appended
+ * @param[out] _used Where the length of the whole frames is stored: when the
+ *             program that wrote the data stopped in the middle of a frame,
+ *             what precedes it is decompressed all the same
+ * @return false if a frame is corrupted
+ * @throw std::bad_alloc */
+inline
+bool lz4_decompress( const char * _data, size_t _size, std::string & _output, size_t * _used = 0 )
+{
+    const unsigned char * const data = reinterpret_cast<const unsigned char *>( _data );
+    size_t position = 0;
+    bool ok = true;
+    while( ok && _size - position >= 4 )
+    {
+        const unsigned magic = lz4_read_le32( data + position );
+        if( 0x184D2A50 == ( magic & 0xFFFFFFF0 ) )
+        {
+            // a skippable frame
+            if( _size - position < 8 || lz4_read_le32( data + position + 4 ) > _size - position - 8 )
+                break;
+            position += 8 + lz4_read_le32( data + position + 4 );
+            continue;
+        }
+
+        ok = ( 0x184D2204 == magic );
+        if( !ok || _size - position < 7 )
+            break;
+
+        const unsigned char flags = data[position + 4];
+        const unsigned char block_maximum = data[position + 5];
+        const size_t descriptor = 2 + ( ( flags & 0x08 ) ? 8 : 0 ) + ( ( flags & 0x01 ) ? 4 : 0 );
+        ok = ( 0x40 == ( flags & 0xC0 ) ) && block_maximum >= 0x40 && block_maximum <= 0x70;
+        if( !ok || _size - position < 4 + descriptor + 1 )
+            break;
+        ok = ( lz4_descriptor_checksum( data + position + 4, descriptor ) == data[position + 4 + descriptor] );
+        if( !ok )
+            break;
+
+        const size_t maximum = static_cast<size_t>( 1 ) << ( 8 + 2 * ( block_maximum >> 4 ) );
+        const size_t block_checksum = ( flags & 0x10 ) ? 4 : 0;
+        size_t block = position + 4 + descriptor + 1;
+        bool finished = false;
+        while( ok && _size - block >= 4 )
+        {
+            const unsigned header = lz4_read_le32( data + block );
+            if( 0 == header )
+            {
+                finished = true;
+                block += 4 + ( ( flags & 0x04 ) ? 4 : 0 );
+                break;
+            }
+
+            const size_t length = header & 0x7FFFFFFF;
+            ok = ( length <= maximum );
+            if( !ok || _size - block - 4 < length + block_checksum )
+                break;
+
+            if( header & 0x80000000 )
+                _output.append( _data + block + 4, length );
+            else
+                ok = lz4_decompress_block( _data + block + 4, length, _output, maximum );
+            block += 4 + length + block_checksum;
+        }
+
+        // the last frame may be cut short: its whole blocks are kept, its length is not counted
+        if( !finished )
+            break;
+        position = block;
+    }
+
+    if( _used )
+        *_used = position;
+    return ok;
+}
+
+// -------------------------------------------------------------------------- //
+/**@struct lz4_sink
+ * @brief A sink compressing what it writes to another sink, in LZ4 frames
+ *
+ * The messages are gathered into blocks, each one compressed into a LZ4
+ * frame of its own and written at once: the data can be cut between any two
+ * frames, by a rotating_file_sink for instance, and still be decompressed,
+ * and a file is appended to by starting another frame. The lz4 program reads
+ * the files, and qlog-decode decompresses them before decoding them.
+ *
+ * A block is written when it is full, or when the sink is flushed: a flush
+ * policy that does not flush after each message (see set_flush_policy())
+ * makes bigger blocks, which compress better. In asynchronous mode, the
+ * messages are compressed by the writer thread.
+ *
+ * @code{.cpp}
+ * qlog::rotating_file_sink file( "myprogram.qlog.lz4", 100 * 1024 * 1024 );
+ * qlog::lz4_sink compressed( file );
+ * qlog::binary_sink records( compressed );
+ * qlog::set_output( records );
+ * @endcode
+ *
+ * @note The crash handler writes the block being filled and the messages
+ *       that were still waiting without compressing them.
+ */
+struct lz4_sink : public sink
+{
+    /**@brief Makes the blocks
+     * @param[in] _destination Where the frames go
+     * @param[in] _block_size The most bytes compressed at once: 64 KB, 256 KB, 1 MB or 4 MB */
+    explicit
+    lz4_sink( sink & _destination, size_t _block_size = 64 * 1024 )
+        :m_destination( _destination )
+        ,m_block_size( 64 * 1024 )
+        ,m_block_id( 4 )
+        ,m_input( 0 )
+        ,m_output( 0 )
+        ,m_table( 0 )
+        ,m_size( 0 )
+    {
+        while( m_block_size < _block_size && m_block_id < 7 )
+        {
+            m_block_size *= 4;
+            ++m_block_id;
+        }
+
+        try
+        {
+            m_input = new char[m_block_size];
+            m_output = new char[frame_overhead + lz4_compress_bound( m_block_size )];
+            m_table = new unsigned[4096];
+        }
+        catch( const std::bad_alloc & )
+        {
+            QLOG_ASSERT( 0 && "std::bad_alloc" );
+        }
+    }
+
+    /**@brief Writes the block being filled */
+    virtual ~lz4_sink()
+    {
+        write_block();
+        delete[] m_input;
+        delete[] m_output;
+        delete[] m_table;
+    }
+
+    virtual void write( const char * _data, size_t _size )
+    {
+        if( !m_table )
+            return;
+
+        while( _size )
+        {
+            const size_t length = _size < m_block_size - m_size ? _size : m_block_size - m_size;
+            std::memcpy( m_input + m_size, _data, length );
+            m_size += length;
+            _data += length;
+            _size -= length;
+
+            if( m_block_size == m_size )
+                write_block();
+        }
+    }
+
+    /**@brief Writes the block being filled, then flushes the destination */
+    virtual void flush()
+    {
+        write_block();
+        m_destination.flush();
+    }
+
+    /**@brief Writes the block being filled and the messages in frames of uncompressed blocks */
+    virtual void write_on_crash( const char * _data, size_t _size )
+    {
+        if( m_input && m_size )
+            write_uncompressed( m_input, m_size );
+        m_size = 0;
+
+        while( _size )
+        {
+            const size_t length = _size < m_block_size ? _size : m_block_size;
+            write_uncompressed( _data, length );
+            _data += length;
+            _size -= length;
+        }
+    }
+
+    virtual void flush_on_crash()
+    {
+        m_destination.flush_on_crash();
+    }
+
+private:
+    lz4_sink( const lz4_sink & );
+    lz4_sink & operator=( const lz4_sink & );
+
+    /**@brief What a frame adds to its block: magic, descriptor, checksum, block length and end mark */
+    static const size_t frame_overhead = 4 + 2 + 1 + 4 + 4;
+
+    /**@brief Writes the magic and the descriptor of a frame
+     * @return The length written */
+    size_t frame_header( unsigned char * _output ) const
+    {
+        std::memcpy( _output, lz4_frame_magic, sizeof( lz4_frame_magic ) );
+        _output[4] = 0x60; // version 1, independent blocks
+        _output[5] = static_cast<unsigned char>( m_block_id << 4 );
+        _output[6] = lz4_descriptor_checksum( _output + 4, 2 );
+        return 7;
+    }
+
+    /**@brief Compresses the block being filled into a frame, which is kept uncompressed if it is not smaller */
+    void write_block()
+    {
+        if( !m_table || !m_size )
+            return;
+
+        unsigned char * const output = reinterpret_cast<unsigned char *>( m_output );
+        const size_t header = frame_header( output );
+        size_t length = lz4_compress_block( m_input, m_size, m_output + header + 4, m_table );
+        unsigned block = static_cast<unsigned>( length );
+        if( length >= m_size )
+        {
+            std::memcpy( m_output + header + 4, m_input, m_size );
+            length = m_size;
+            block = static_cast<unsigned>( m_size ) | 0x80000000U;
+        }
+        lz4_write_le32( output + header, block );
+        lz4_write_le32( output + header + 4 + length, 0 );
+        m_destination.write( m_output, header + 4 + length + 4 );
+        m_size = 0;
+    }
+
+    /**@brief Writes a frame of a single uncompressed block, calling async-signal-safe functions only */
+    void write_uncompressed( const char * _data, size_t _size )
+    {
+        unsigned char header[11];
+        const size_t length = frame_header( header );
+        lz4_write_le32( header + length, static_cast<unsigned>( _size ) | 0x80000000U );
+        const unsigned char end[4] = { 0, 0, 0, 0 };
+        m_destination.write_on_crash( reinterpret_cast<const char *>( header ), sizeof( header ) );
+        m_destination.write_on_crash( _data, _size );
+        m_destination.write_on_crash( reinterpret_cast<const char *>( end ), sizeof( end ) );
+    }
+
+    sink & m_destination;
+    size_t m_block_size;
+    unsigned m_block_id; ///< The maximum block size of the frame descriptor: 4 for 64 KB to 7 for 4 MB
+    char * m_input; ///< The block being filled
+    char * m_output; ///< The frame of the compressed block
+    unsigned * m_table; ///< The positions of the compressor, see lz4_compress_block()
+    size_t m_size; ///< The length of the block being filled
+};
+
+#ifndef WIN32
+// -------------------------------------------------------------------------- //
+/**@struct fd_sink
+ * @brief A sink calling write(2) on a file descriptor, which the sink does not close
+ *
+ * Nothing is buffered: every message, or every batch of messages in
+ * asynchronous mode, is a single system call, and flush() has nothing to do. */
+struct fd_sink : public sink
+{
+    explicit
+    fd_sink( int _fd )
+        :m_fd( _fd )
+        ,m_terminal( 1 == isatty( _fd ) )
+    {
+    }
+
+    virtual ~fd_sink() { }
+
+    virtual void write( const char * _data, size_t _size )
+    {
+        while( _size )
+        {
+            const ssize_t written = ::write( m_fd, _data, _size );
+            if( written < 0 )
+            {
+                if( EINTR == errno )
+                    continue;
+                return;
+            }
+
+            _data += written;
+            _size -= static_cast<size_t>( written );
+        }
+    }
+
+    virtual void flush()
+    {
+    }
+
+    virtual size_t destination() const { return static_cast<size_t>( m_fd ); }
+
+    virtual bool terminal() const { return m_terminal; }
+
+    /**@brief Writes messages from a signal handler: write(2) is async-signal-safe */
+    virtual void write_on_crash( const char * _data, size_t _size )
+    {
+        fd_sink::write( _data, _size );
+    }
+
+private:
+    int m_fd;
+    bool m_terminal; ///< Whether the descriptor was a terminal when the sink was made
+};
+
+// -------------------------------------------------------------------------- //
+/**@struct rotating_file_sink
+ * @brief A sink writing to memory-mapped files, renamed once they are big or old enough
+ *
+ * The file is grown and mapped one segment at a time, so writing a message
+ * is a copy to memory. When the file reaches its maximum size, or has been
+ * open for too long, it is renamed to path.1, path.1 to path.2 and so on,
+ * up to the number of history files to keep, and a new file is started.
+ *
+ * In asynchronous mode, the writer thread is the only one to write, map a
+ * segment or rotate the files: the loggers are never kept waiting by it.
+ *
+ * @code{.cpp}
+ * qlog::rotating_file_sink file( "myprogram.log", 10 * 1024 * 1024, 5 );
+ * qlog::set_output( file );
+ * @endcode
+ *
+ * @note If the program crashes, the end of the last segment is left filled
+ *       with null bytes, unless set_crash_handler() was called.
+ */
+struct rotating_file_sink : public sink
+{
+    /**@brief Opens the file, appending to it if it exists
+     * @param[in] _path The name of the current file
+     * @param[in] _max_size The size at which the file is renamed, 0 for no limit
+     * @param[in] _max_files The number of renamed files to keep
+     * @param[in] _max_seconds The age at which the file is renamed, 0 for no limit
+     * @param[in] _segment_size The number of bytes mapped at once, rounded up to the page size */
+    explicit
+    rotating_file_sink( const char * _path, size_t _max_size = 0, unsigned _max_files = 5,
+                        unsigned _max_seconds = 0, size_t _segment_size = 1024 * 1024 )
+        :m_path( _path )
+        ,m_fd( -1 )
+        ,m_map( 0 )
+        ,m_segment_size( _segment_size )
+        ,m_segment_offset( 0 )
+        ,m_position( 0 )
+        ,m_max_size( _max_size )
+        ,m_max_files( _max_files )
+        ,m_max_seconds( _max_seconds )
+        ,m_opened( 0 )
+        ,m_crash_size( 0 )
+    {
+        const size_t page = static_cast<size_t>( sysconf( _SC_PAGESIZE ) );
+        m_segment_size = ( m_segment_size + page - 1 ) / page * page;
+        if( 0 == m_segment_size )
+            m_segment_size = page;
+
+        open_file();
+    }
+
+    virtual ~rotating_file_sink()
+    {
+        close_file();
+    }
+
+    /**@brief Whether the file could be opened */
+    bool is_open() const { return m_fd >= 0; }
+
+    /**@brief The number of bytes written to the current file */
+    size_t size() const { return m_segment_offset + m_position; }
+
+    virtual void write( const char * _data, size_t _size )
+    {
+        if( must_rotate( _size ) )
+            rotate();
+
+        while( _size && m_fd >= 0 )
+        {
+            if( m_segment_size == m_position || !m_map )
+            {
+                if( !map_segment( m_map ? m_segment_offset + m_segment_size : m_segment_offset ) )
+                    return;
+            }
+
+            const size_t length = _size < m_segment_size - m_position ? _size : m_segment_size - m_position;
+            std::memcpy( m_map + m_position, _data, length );
+            m_position += length;
+            _data += length;
+            _size -= length;
+        }
+    }
+
+    /**@brief Hands the written pages to the system, without waiting for the disk */
+    virtual void flush()
+    {
+        if( m_map )
+            msync( m_map, m_segment_size, MS_ASYNC );
+    }
+
+    /**@brief Writes messages from a signal handler
+     *
+     * Nothing is mapped: what does not fit in the current segment is written
+     * after it with pwrite(2). */
+    virtual void write_on_crash( const char * _data, size_t _size )
+    {
+        if( m_fd < 0 )
+            return;
+
+        if( m_map && 0 == m_crash_size )
+        {
+            const size_t length = _size < m_segment_size - m_position ? _size : m_segment_size - m_position;
+            std::memcpy( m_map + m_position, _data, length );
+            m_position += length;
+            _data += length;
+            _size -= length;
+        }
+
+        while( _size )
+        {
+            const ssize_t written = pwrite( m_fd, _data, _size, static_cast<off_t>( size() + m_crash_size ) );
+            if( written < 0 )
+            {
+                if( EINTR == errno )
+                    continue;
+                return;
+            }
+
+            m_crash_size += static_cast<size_t>( written );
+            _data += written;
+            _size -= static_cast<size_t>( written );
+        }
+    }
+
+    /**@brief Gives back what was allocated but not written, from a signal handler */
+    virtual void flush_on_crash()
+    {
+        if( m_fd >= 0 && 0 != ftruncate( m_fd, static_cast<off_t>( size() + m_crash_size ) ) )
+        {
+            // nothing better to do
+        }
+    }
+
+private:
+    rotating_file_sink( const rotating_file_sink & );
+    rotating_file_sink & operator=( const rotating_file_sink & );
+
+    bool must_rotate( size_t _size ) const
+    {
+        if( m_fd < 0 || 0 == size() )
+            return false;
+
+        if( m_max_size && size() + _size > m_max_size )
+            return true;
+
+        return m_max_seconds && std::time( 0 ) - m_opened >= static_cast<time_t>( m_max_seconds );
+    }
+
+    void open_file()
+    {
+        m_fd = ::open( m_path.c_str(), O_RDWR | O_CREAT, 0644 );
+        m_opened = std::time( 0 );
+        m_map = 0;
+        m_segment_offset = 0;
+        m_position = 0;
+
+        struct stat status;
+        if( m_fd >= 0 && 0 == fstat( m_fd, &status ) )
+        {
+            // appending to an existing file
+            const size_t existing = static_cast<size_t>( status.st_size );
+            m_segment_offset = existing / m_segment_size * m_segment_size;
+            m_position = existing - m_segment_offset;
+        }
+    }
+
+    void close_file()
+    {
+        if( m_fd < 0 )
+            return;
+
+        if( m_map )
+            munmap( m_map, m_segment_size );
+        m_map = 0;
+
+        // gives back what was allocated but not written
+        if( 0 != ftruncate( m_fd, static_cast<off_t>( size() ) ) )
+        {
+            // nothing better to do
+        }
+        ::close( m_fd );
+        m_fd = -1;
+    }
+
+    /**@brief Maps the segment of the file starting at an offset, growing the file if needed */
+    bool map_segment( size_t _offset )
+    {
+        if( m_map )
+            munmap( m_map, m_segment_size );
+        m_map = 0;
+
+        const off_t end = static_cast<off_t>( _offset + m_segment_size );
+        struct stat status;
+        bool ok = ( 0 == fstat( m_fd, &status ) );
+        if( ok && status.st_size < end )
+        {
+#           ifdef __linux__
+            ok = ( 0 == posix_fallocate( m_fd, static_cast<off_t>( _offset ), static_cast<off_t>( m_segment_size ) ) );
+            if( !ok )
+#           endif
+            ok = ( 0 == ftruncate( m_fd, end ) );
+        }
+
+        void * const map = ok ? mmap( 0, m_segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, static_cast<off_t>( _offset ) ) : MAP_FAILED;
+        if( MAP_FAILED == map )
+        {
+            close_file();
+            return false;
+        }
+
+        if( _offset != m_segment_offset )
+            m_position = 0;
+        m_map = static_cast<char *>( map );
+        m_segment_offset = _offset;
+        return true;
+    }
+
+    std::string history_name( unsigned _index ) const
+    {
+        char suffix[24];
+        suffix[0] = '.';
+        const size_t length = 1 + format_decimal( suffix + 1, _index );
+        return m_path + std::string( suffix, length );
+    }
+
+    void rotate()
+    {
+        close_file();
+
+        try
+        {
+            if( m_max_files )
+            {
+                for( unsigned i = m_max_files - 1; i > 0; --i )
+                    std::rename( history_name( i ).c_str(), history_name( i + 1 ).c_str() );
+                std::rename( m_path.c_str(), history_name( 1 ).c_str() );
+            }
+            else
+            {
+                std::remove( m_path.c_str() );
+            }
+        }
+        catch( const std::bad_alloc & )
+        {
+            QLOG_ASSERT( 0 && "std::bad_alloc" );
+        }
+
+        // if the file could not be renamed, it is appended to
+        open_file();
+    }
+
+    std::string m_path;
+    int m_fd;
+    char * m_map;
+    size_t m_segment_size;
+    size_t m_segment_offset; ///< Where the mapped segment starts in the file
+    size_t m_position; ///< Where the next byte goes in the mapped segment
+    size_t m_max_size;
+    unsigned m_max_files;
+    unsigned m_max_seconds;
+    time_t m_opened;
+    size_t m_crash_size; ///< What write_on_crash() wrote after the mapped segment
+};
+
+/**@brief The first bytes of a ring created by shm_ring_sink */
+static const char shm_ring_magic[8] = { 'Q', 'L', 'O', 'G', 'S', 'H', 'M', '1' };
+
+/**@struct shm_ring_header
+ * @cond GENERATE_INTERNAL_DOCUMENTATION
+ * @brief The beginning of the shared memory of a shm_ring_sink, followed by the ring itself.
+ *
+ * The positions only ever grow: the bytes between m_read and m_written are
+ * the ones the collector has not read yet. The sink is the only one to
+ * advance m_written and the collector the only one to advance m_read, each
+ * on a cache line of its own.
+ */
+struct shm_ring_header
+{
+    char m_magic[8];
+    size_t m_capacity; ///< The size of the ring, a power of 2
+    atomic_integer<size_t> m_closed; ///< Whether the sink was destroyed
+    atomic_integer<size_t> m_dropped; ///< Writes that did not fit in the ring
+    char m_padding[64 - sizeof( m_magic ) - 3 * sizeof( size_t )];
+    atomic_integer<size_t> m_written; ///< Bytes written by the sink since the ring was created
+    char m_written_padding[64 - sizeof( size_t )];
+    atomic_integer<size_t> m_read; ///< Bytes read by the collector since the ring was created
+    char m_read_padding[64 - sizeof( size_t )];
+};
+/**@endcond */
+
+// -------------------------------------------------------------------------- //
+/**@struct shm_ring_sink
+ * @brief A sink copying the messages to a ring in shared memory, read by another process
+ *
+ * Writing a message is a copy and an atomic store: the qlog-collect program,
+ * or a shm_ring_reader of your own, reads the ring from another process and
+ * does the writing to disk or to syslog. When the ring is full, the messages
+ * are dropped rather than waited for (see dropped()).
+ *
+ * The name follows the rules of shm_open(3): a slash followed by at most
+ * NAME_MAX characters. A ring with the same name is replaced, and the ring is
+ * unlinked when the sink is destroyed: the collector keeps reading what is
+ * left in it.
+ *
+ * @code{.cpp}
+ * qlog::shm_ring_sink ring( "/myprogram" );  // qlog-collect /myprogram myprogram.log
+ * qlog::set_output( ring );
+ * @endcode
+ *
+ * @note The sink must be the only one writing to the ring, and the collector
+ *       run on a machine with the same sizes and byte order.
+ */
+struct shm_ring_sink : public sink
+{
+    /**@brief Creates the ring
+     * @param[in] _name The name of the shared memory object
+     * @param[in] _capacity The size of the ring, rounded up to a power of 2 */
+    explicit
+    shm_ring_sink( const char * _name, size_t _capacity = 1024 * 1024 )
+        :m_name( _name )
+        ,m_header( 0 )
+        ,m_data( 0 )
+        ,m_capacity( 1 )
+    {
+        while( m_capacity < _capacity )
+            m_capacity *= 2;
+
+        shm_unlink( _name );
+        const int fd = shm_open( _name, O_RDWR | O_CREAT | O_EXCL, 0600 );
+        if( fd < 0 )
+            return;
+
+        // the object is filled with zeros: every position starts at 0
+        void * map = MAP_FAILED;
+        if( 0 == ftruncate( fd, static_cast<off_t>( sizeof( shm_ring_header ) + m_capacity ) ) )
+            map = mmap( 0, sizeof( shm_ring_header ) + m_capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+        ::close( fd );
+
+        if( MAP_FAILED == map )
+        {
+            shm_unlink( _name );
+            return;
+        }
+
+        m_header = static_cast<shm_ring_header *>( map );
+        m_data = static_cast<char *>( map ) + sizeof( shm_ring_header );
+        m_header->m_capacity = m_capacity;
+        atomic_fence();
+        std::memcpy( m_header->m_magic, shm_ring_magic, sizeof( shm_ring_magic ) );
+    }
+
+    virtual ~shm_ring_sink()
+    {
+        if( !m_header )
+            return;
+
+        m_header->m_closed.store( 1 );
+        munmap( m_header, sizeof( shm_ring_header ) + m_capacity );
+        shm_unlink( m_name.c_str() );
+    }
+
+    /**@brief Whether the ring could be created */
+    bool is_open() const { return 0 != m_header; }
+
+    /**@brief The number of writes dropped because the collector was late */
+    size_t dropped() const { return m_header ? m_header->m_dropped.load_relaxed() : 0; }
+
+    /**@brief Copies messages to the ring, unless they do not fit in what the collector has read */
+    virtual void write( const char * _data, size_t _size )
+    {
+        if( !m_header )
+            return;
+
+        const size_t written = m_header->m_written.load_relaxed();
+        if( _size > m_capacity - ( written - m_header->m_read.load() ) )
+        {
+            m_header->m_dropped.fetch_add_relaxed( 1 );
+            return;
+        }
+
+        const size_t start = written & ( m_capacity - 1 );
+        const size_t first = _size < m_capacity - start ? _size : m_capacity - start;
+        std::memcpy( m_data + start, _data, first );
+        std::memcpy( m_data, _data + first, _size - first );
+        m_header->m_written.store( written + _size );
+    }
+
+    /**@brief Nothing to do: the collector sees the messages as soon as they are written */
+    virtual void flush()
+    {
+    }
+
+    /**@brief Writes messages from a signal handler: this is only a copy and an atomic store */
+    virtual void write_on_crash( const char * _data, size_t _size )
+    {
+        shm_ring_sink::write( _data, _size );
+    }
+
+private:
+    shm_ring_sink( const shm_ring_sink & );
+    shm_ring_sink & operator=( const shm_ring_sink & );
+
+    std::string m_name;
+    shm_ring_header * m_header;
+    char * m_data;
+    size_t m_capacity;
+};
+
+// -------------------------------------------------------------------------- //
+/**@struct shm_ring_reader
+ * @brief Reads, from another process, what a shm_ring_sink writes
+ *
+ * This is what qlog-collect uses. A single reader must read a given ring.
+ */
+struct shm_ring_reader
+{
+    /**@brief Opens an existing ring
+     * @param[in] _name The name given to the shm_ring_sink */
+    explicit
+    shm_ring_reader( const char * _name )
+        :m_name( _name )
+        ,m_header( 0 )
+        ,m_data( 0 )
+        ,m_size( 0 )
+        ,m_inode( 0 )
+    {
+        const int fd = shm_open( _name, O_RDWR, 0 );
+        if( fd < 0 )
+            return;
+
+        struct stat status;
+        void * map = MAP_FAILED;
+        if( 0 == fstat( fd, &status ) && static_cast<size_t>( status.st_size ) > sizeof( shm_ring_header ) )
+        {
+            m_size = static_cast<size_t>( status.st_size );
+            m_inode = status.st_ino;
+            map = mmap( 0, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+        }
+        ::close( fd );
+
+        if( MAP_FAILED == map )
+            return;
+
+        m_header = static_cast<shm_ring_header *>( map );
+        atomic_fence();
+        if( 0 != std::memcmp( m_header->m_magic, shm_ring_magic, sizeof( shm_ring_magic ) )
+            || sizeof( shm_ring_header ) + m_header->m_capacity != m_size
+            || 0 != ( m_header->m_capacity & ( m_header->m_capacity - 1 ) ) )
+        {
+            munmap( map, m_size );
+            m_header = 0;
+            return;
+        }
+        m_data = static_cast<char *>( map ) + sizeof( shm_ring_header );
+    }
+
+    ~shm_ring_reader()
+    {
+        if( m_header )
+            munmap( m_header, m_size );
+    }
+
+    /**@brief Whether the ring could be opened */
+    bool is_open() const { return 0 != m_header; }
+
+    /**@brief Whether the sink was destroyed: once read() returns 0, nothing more will come */
+    bool closed() const { return m_header && 0 != m_header->m_closed.load(); }
+
+    /**@brief The number of writes the sink dropped because the ring was full */
+    size_t dropped() const { return m_header ? m_header->m_dropped.load_relaxed() : 0; }
+
+    /**@brief Whether a new ring now has the name, a new run of the program having replaced this one */
+    bool replaced() const
+    {
+        const int fd = shm_open( m_name.c_str(), O_RDONLY, 0 );
+        if( fd < 0 )
+            return false;
+
+        struct stat status;
+        const bool other = ( 0 == fstat( fd, &status ) && status.st_ino != m_inode );
+        ::close( fd );
+        return other;
+    }
+
+    /**@brief Copies what the sink wrote since the last call, and gives the room back to the sink
+     * @param[out] _data Where to copy it
+     * @param[in] _size The room there is at _data
+     * @return The number of bytes copied */
+    size_t read( char * _data, size_t _size )
+    {
+        if( !m_header )
+            return 0;
+
+        const size_t read = m_header->m_read.load_relaxed();
+        const size_t capacity = m_header->m_capacity;
+        size_t available = m_header->m_written.load() - read;
+        if( available > capacity )
+            available = capacity; // only a broken sink would do that
+        if( _size > available )
+            _size = available;
+
+        const size_t start = read & ( capacity - 1 );
+        const size_t first = _size < capacity - start ? _size : capacity - start;
+        std::memcpy( _data, m_data + start, first );
+        std::memcpy( _data + first, m_data, _size - first );
+        m_header->m_read.store( read + _size );
+        return _size;
+    }
+
+private:
+    shm_ring_reader( const shm_ring_reader & );
+    shm_ring_reader & operator=( const shm_ring_reader & );
+
+    std::string m_name;
+    shm_ring_header * m_header;
+    const char * m_data;
+    size_t m_size;
+    ino_t m_inode;
+};
+
+#ifdef QLOG_NETWORK
+/**@brief How network_sink frames the messages
+ * - network::udp_syslog sends each RFC 5424 message in a datagram of its own (RFC 5426)
+ * - network::tcp_syslog precedes each RFC 5424 message with its length in decimal and a space (RFC 6587)
+ * - network::tcp_length_prefixed precedes the text of each message, without a syslog header, with its length on
+ *   4 bytes in network order */
+namespace network
+{
+static const unsigned udp_syslog = 0;
+static const unsigned tcp_syslog = 1;
+static const unsigned tcp_length_prefixed = 2;
+}
+
+// -------------------------------------------------------------------------- //
+/**@struct network_sink
+ * @brief A sink sending the messages to a collector, as syslog messages or as length-prefixed text
+ *
+ * The sink is a binary one: it is given the level and the time of each
+ * message, from which the syslog header is made. The messages of a write are
+ * sent together, in one sendmmsg() on linux for the datagrams and in one
+ * sendmsg() for a stream. The socket never blocks: what cannot be sent yet
+ * waits in a buffer of a bounded size, and the messages that do not fit in
+ * it are dropped (see dropped()). A lost connection is made again, waiting
+ * twice as long after each failure, up to 30 seconds.
+ *
+ * In asynchronous mode, the writer thread is the only one to talk to the
+ * network: the loggers are never kept waiting by the collector.
+ *
+ * @code{.cpp}
+ * #define QLOG_NETWORK
+ * #include "qlog.hpp"
+ *
+ * qlog::network_sink collector( "logs.example.com", "514", qlog::network::tcp_syslog, "myprogram" );
+ * qlog::set_output( collector );
+ * @endcode
+ *
+ * @note The name of the collector is resolved once, by the constructor.
+ */
+struct network_sink : public sink
+{
+    /**@brief Resolves the collector and starts connecting to it
+     * @param[in] _host The name or the address of the collector
+     * @param[in] _port Its port, or the name of its service
+     * @param[in] _protocol network::udp_syslog, network::tcp_syslog or network::tcp_length_prefixed
+     * @param[in] _app_name The APP-NAME of the syslog messages
+     * @param[in] _facility The syslog facility: 1 (user) by default, 16 to 23 for local0 to local7
+     * @param[in] _buffer_size The most bytes waiting to be sent */
+    network_sink( const char * _host, const char * _port, unsigned _protocol = network::udp_syslog,
+                  const char * _app_name = "-", unsigned _facility = 1, size_t _buffer_size = 1024 * 1024 )
+        :m_protocol( _protocol )
+        ,m_facility( _facility )
+        ,m_header()
+        ,m_address()
+        ,m_address_size( 0 )
+        ,m_fd( -1 )
+        ,m_connecting( false )
+        ,m_retry_at( 0 )
+        ,m_backoff( minimum_backoff )
+        ,m_buffer( 0 )
+        ,m_capacity( _buffer_size )
+        ,m_begin( 0 )
+        ,m_end( 0 )
+        ,m_sent( 0 )
+        ,m_dropped( 0 )
+        ,m_text()
+    {
+        try
+        {
+            // what follows the time in every syslog message: HOSTNAME APP-NAME PROCID MSGID STRUCTURED-DATA
+            char host[256];
+            if( 0 != gethostname( host, sizeof( host ) ) || !host[0] )
+                std::strcpy( host, "-" );
+            host[sizeof( host ) - 1] = '\0';
+            char pid[24];
+            pid[format_decimal( pid, static_cast<unsigned long>( getpid() ) )] = '\0';
+            m_header = std::string( " " ) + host + " " + ( *_app_name ? _app_name : "-" ) + " " + pid + " - - ";
+
+            m_buffer = new char[m_capacity];
+        }
+        catch( const std::bad_alloc & )
+        {
+            QLOG_ASSERT( 0 && "std::bad_alloc" );
+            m_capacity = 0;
+        }
+
+        struct addrinfo hints;
+        std::memset( &hints, 0, sizeof( hints ) );
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = ( network::udp_syslog == m_protocol ) ? SOCK_DGRAM : SOCK_STREAM;
+        struct addrinfo * found = 0;
+        if( 0 == getaddrinfo( _host, _port, &hints, &found ) && found )
+        {
+            if( found->ai_addrlen <= sizeof( m_address ) )
+            {
+                std::memcpy( &m_address, found->ai_addr, found->ai_addrlen );
+                m_address_size = found->ai_addrlen;
+            }
+            freeaddrinfo( found );
+        }
+
+        connect_if_needed();
+    }
+
+    /**@brief Sends what it can of the messages still waiting, then closes the connection */
+    virtual ~network_sink()
+    {
+        send_waiting();
+        disconnect();
+        delete[] m_buffer;
+    }
+
+    /**@brief Whether the name of the collector could be resolved */
+    bool is_resolved() const { return 0 != m_address_size; }
+
+    /**@brief Whether the sink is connected to the collector: always true once the socket of udp_syslog is open */
+    bool connected() const { return m_fd >= 0 && !m_connecting; }
+
+    /**@brief The number of messages dropped because the buffer was full */
+    unsigned long dropped() const { return m_dropped; }
+
+    /**@brief The number of bytes waiting to be sent */
+    size_t pending() const { return m_end - m_begin; }
+
+    virtual bool binary() const { return true; }
+
+    virtual void write( const char * _data, size_t _size )
+    {
+        for( size_t position = 0; _size - position >= sizeof( record_header ); )
+        {
+            record_header header;
+            std::memcpy( &header, _data + position, sizeof( header ) );
+            if( header.m_size < sizeof( header ) || header.m_size > _size - position )
+                break;
+
+            m_text.buffer().clear();
+            decode_records( _data + position, header.m_size, m_text, true );
+            queue( header, m_text.buffer().data(), m_text.buffer().size() );
+            position += header.m_size;
+        }
+
+        send_waiting();
+    }
+
+    /**@brief Sends what can be sent without waiting */
+    virtual void flush()
+    {
+        send_waiting();
+    }
+
+private:
+    network_sink( const network_sink & );
+    network_sink & operator=( const network_sink & );
+
+    static const unsigned long minimum_backoff = 100;
+    static const unsigned long maximum_backoff = 30000;
+
+    /**@brief The most messages given to one system call */
+    static const unsigned batch_size = 64;
+
+    static unsigned severity( unsigned _level )
+    {
+        switch( _level )
+        {
+        case loglevel::error:
+            return 3;
+        case loglevel::warning:
+            return 4;
+        case loglevel::info:
+            return 6;
+        default:
+            return 7;
+        }
+    }
+
+    /**@brief Writes <PRI>1 TIMESTAMP, the time being in UTC with microseconds
+     * @param[in] _capacity The size of _output: 128 bytes hold any value of the fields
+     * @return The length written, cut to fit _capacity */
+    size_t syslog_prefix( char * _output, size_t _capacity, const record_header & _header ) const
+    {
+        struct tm date;
+        gmtime_r( &_header.m_seconds, &date );
+        const int length = QLOG_SNPRINTF( _output, _capacity, "<%u>1 %04d-%02d-%02dT%02d:%02d:%02d.%06luZ",
+                                          m_facility * 8 + severity( _header.m_level ),
+                                          date.tm_year + 1900, date.tm_mon + 1, date.tm_mday,
+                                          date.tm_hour, date.tm_min, date.tm_sec, _header.m_nanoseconds / 1000 );
+        if( length <= 0 )
+            return 0;
+        return static_cast<size_t>( length ) < _capacity ? static_cast<size_t>( length ) : _capacity - 1;
+    }
+
+    /**@brief Frames a message at the end of the buffer, or drops it if the buffer is full */
+    void queue( const record_header & _header, const char * _text, size_t _size )
+    {
+        char syslog[128];
+        char prefix[24 + sizeof( syslog )];
+        size_t prefix_size = 0;
+        size_t header_size = 0;
+        if( network::tcp_length_prefixed == m_protocol )
+        {
+            prefix_size = 4;
+            prefix[0] = static_cast<char>( ( _size >> 24 ) & 0xFF );
+            prefix[1] = static_cast<char>( ( _size >> 16 ) & 0xFF );
+            prefix[2] = static_cast<char>( ( _size >> 8 ) & 0xFF );
+            prefix[3] = static_cast<char>( _size & 0xFF );
+        }
+        else
+        {
+            // a syslog message does not end with a newline
+            while( _size && ( '\n' == _text[_size - 1] || '\r' == _text[_size - 1] ) )
+                --_size;
+
+            const size_t syslog_size = syslog_prefix( syslog, sizeof( syslog ), _header );
+            header_size = m_header.size();
+            if( network::tcp_syslog == m_protocol )
+            {
+                prefix_size = format_decimal( prefix, static_cast<unsigned long>( syslog_size + header_size + _size ) );
+                prefix[prefix_size++] = ' ';
+            }
+            std::memcpy( prefix + prefix_size, syslog, syslog_size );
+            prefix_size += syslog_size;
+        }
+
+        char * const room = reserve( prefix_size + header_size + _size );
+        if( !room )
+        {
+            ++m_dropped;
+            return;
+        }
+
+        std::memcpy( room, prefix, prefix_size );
+        std::memcpy( room + prefix_size, m_header.data(), header_size );
+        std::memcpy( room + prefix_size + header_size, _text, _size );
+    }
+
+    /**@brief Makes room for a message of the given length at the end of the buffer
+     * @return Where the message goes, or 0 if it does not fit */
+    char * reserve( size_t _size )
+    {
+        const size_t needed = sizeof( unsigned ) + _size;
+        if( needed > m_capacity - ( m_end - m_begin ) )
+            return 0;
+
+        if( needed > m_capacity - m_end )
+        {
+            std::memmove( m_buffer, m_buffer + m_begin, m_end - m_begin );
+            m_end -= m_begin;
+            m_begin = 0;
+        }
+
+        const unsigned length = static_cast<unsigned>( _size );
+        std::memcpy( m_buffer + m_end, &length, sizeof( length ) );
+        char * const room = m_buffer + m_end + sizeof( length );
+        m_end += needed;
+        return room;
+    }
+
+    /**@brief The length of the message starting at an offset of the buffer */
+    unsigned length_at( size_t _offset ) const
+    {
+        unsigned length;
+        std::memcpy( &length, m_buffer + _offset, sizeof( length ) );
+        return length;
+    }
+
+    /**@brief Forgets the first message of the buffer */
+    void pop()
+    {
+        m_begin += sizeof( unsigned ) + length_at( m_begin );
+        m_sent = 0;
+        if( m_begin == m_end )
+        {
+            m_begin = 0;
+            m_end = 0;
+        }
+    }
+
+    /**@brief Opens the socket, or checks whether the connection was made
+     * @return whether the sink is connected */
+    bool connect_if_needed()
+    {
+        if( connected() )
+            return true;
+
+        if( m_fd < 0 )
+        {
+            if( !m_address_size )
+                return false;
+
+            // waiting before trying again
+            if( m_retry_at && static_cast<long>( monotonic_milliseconds() - m_retry_at ) < 0 )
+                return false;
+
+            m_fd = socket( reinterpret_cast<const struct sockaddr *>( &m_address )->sa_family,
+                           ( network::udp_syslog == m_protocol ) ? SOCK_DGRAM : SOCK_STREAM, 0 );
+            if( m_fd < 0 )
+            {
+                failed();
+                return false;
+            }
+
+            fcntl( m_fd, F_SETFD, FD_CLOEXEC );
+            fcntl( m_fd, F_SETFL, fcntl( m_fd, F_GETFL ) | O_NONBLOCK );
+#           ifdef SO_NOSIGPIPE
+            const int on = 1;
+            setsockopt( m_fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof( on ) );
+#           endif
+
+            if( 0 == ::connect( m_fd, reinterpret_cast<const struct sockaddr *>( &m_address ), m_address_size ) )
+            {
+                succeeded();
+                return true;
+            }
+
+            if( EINPROGRESS != errno )
+            {
+                failed();
+                return false;
+            }
+            m_connecting = true;
+        }
+
+        // the connection is being made
+        struct pollfd writable;
+        writable.fd = m_fd;
+        writable.events = POLLOUT;
+        writable.revents = 0;
+        if( poll( &writable, 1, 0 ) <= 0 )
+            return false;
+
+        int error = 0;
+        socklen_t length = sizeof( error );
+        if( 0 != getsockopt( m_fd, SOL_SOCKET, SO_ERROR, &error, &length ) || error )
+        {
+            failed();
+            return false;
+        }
+
+        succeeded();
+        return true;
+    }
+
+    void succeeded()
+    {
+        m_connecting = false;
+        m_retry_at = 0;
+        m_backoff = minimum_backoff;
+    }
+
+    /**@brief Closes the socket and waits longer before trying again */
+    void failed()
+    {
+        disconnect();
+
+        // 0 means no wait
+        m_retry_at = monotonic_milliseconds() + m_backoff;
+        if( !m_retry_at )
+            m_retry_at = 1;
+        m_backoff *= 2;
+        if( m_backoff > maximum_backoff )
+            m_backoff = maximum_backoff;
+    }
+
+    void disconnect()
+    {
+        if( m_fd >= 0 )
+            ::close( m_fd );
+        m_fd = -1;
+        m_connecting = false;
+
+        // the collector has to be given whole messages
+        m_sent = 0;
+    }
+
+    void send_waiting()
+    {
+        if( m_begin == m_end || !connect_if_needed() )
+            return;
+
+        if( network::udp_syslog == m_protocol )
+            send_datagrams();
+        else
+            send_stream();
+    }
+
+    /**@brief Sends the waiting messages, a datagram each, as long as the socket takes them */
+    void send_datagrams()
+    {
+        while( m_begin != m_end )
+        {
+#           ifdef __linux__
+            struct iovec vectors[batch_size];
+            struct mmsghdr messages[batch_size];
+            unsigned count = 0;
+            for( size_t offset = m_begin; offset != m_end && count < batch_size; ++count )
+            {
+                const unsigned length = length_at( offset );
+                vectors[count].iov_base = m_buffer + offset + sizeof( unsigned );
+                vectors[count].iov_len = length;
+                std::memset( &messages[count], 0, sizeof( messages[count] ) );
+                messages[count].msg_hdr.msg_iov = &vectors[count];
+                messages[count].msg_hdr.msg_iovlen = 1;
+                offset += sizeof( unsigned ) + length;
+            }
+
+            const int sent = sendmmsg( m_fd, messages, count, MSG_DONTWAIT );
+            for( int i = 0; i < sent; ++i )
+                pop();
+#           else
+            const int sent = ( send( m_fd, m_buffer + m_begin + sizeof( unsigned ), length_at( m_begin ), 0 ) >= 0 ) ? 1 : -1;
+            if( sent > 0 )
+                pop();
+#           endif
+
+            if( sent < 0 )
+            {
+                if( EAGAIN == errno || EWOULDBLOCK == errno || ENOBUFS == errno )
+                    return;
+                if( EINTR == errno )
+                    continue;
+
+                // a datagram too long, or the error of an earlier one (ECONNREFUSED): never tried twice
+                pop();
+                ++m_dropped;
+            }
+        }
+    }
+
+    /**@brief Sends the waiting messages on the connection, as long as it takes them */
+    void send_stream()
+    {
+        while( m_begin != m_end )
+        {
+            struct iovec vectors[batch_size];
+            int count = 0;
+            for( size_t offset = m_begin; offset != m_end && count < static_cast<int>( batch_size ); ++count )
+            {
+                const unsigned length = length_at( offset );
+                const size_t skipped = ( offset == m_begin ) ? m_sent : 0;
+                vectors[count].iov_base = m_buffer + offset + sizeof( unsigned ) + skipped;
+                vectors[count].iov_len = length - skipped;
+                offset += sizeof( unsigned ) + length;
+            }
+
+            struct msghdr message;
+            std::memset( &message, 0, sizeof( message ) );
+            message.msg_iov = vectors;
+            message.msg_iovlen = count;
+#           ifdef MSG_NOSIGNAL
+            ssize_t sent = sendmsg( m_fd, &message, MSG_NOSIGNAL | MSG_DONTWAIT );
+#           else
+            ssize_t sent = sendmsg( m_fd, &message, MSG_DONTWAIT );
+#           endif
+            if( sent < 0 )
+            {
+                if( EINTR == errno )
+                    continue;
+                if( EAGAIN != errno && EWOULDBLOCK != errno && ENOBUFS != errno )
+                    failed();
+                return;
+            }
+
+            for( int i = 0; i < count && sent > 0; ++i )
+            {
+                if( static_cast<size_t>( sent ) < vectors[i].iov_len )
+                {
+                    m_sent += static_cast<size_t>( sent );
+                    return;
+                }
+                sent -= static_cast<ssize_t>( vectors[i].iov_len );
+                pop();
+            }
+        }
+    }
+
+    unsigned m_protocol;
+    unsigned m_facility;
+    std::string m_header; ///< What follows the time in the syslog messages
+    struct sockaddr_storage m_address;
+    socklen_t m_address_size; ///< 0 if the collector could not be resolved
+    int m_fd;
+    bool m_connecting; ///< Whether the connection is still being made
+    unsigned long m_retry_at; ///< When to connect again, see monotonic_milliseconds(), 0 for at once
+    unsigned long m_backoff; ///< How long to wait after the next failure
+    char * m_buffer; ///< The messages waiting to be sent, each after its length
+    size_t m_capacity;
+    size_t m_begin; ///< Where the first waiting message is in m_buffer
+    size_t m_end;
+    size_t m_sent; ///< The bytes of the first waiting message already sent, on a stream
+    unsigned long m_dropped;
+    record_stream m_text; ///< The text of the record being framed
+};
+#endif
+#endif
+
+#ifdef QLOG_ASYNC
+// -------------------------------------------------------------------------- //
+/**@cond GENERATE_INTERNAL_DOCUMENTATION
+ * @struct native_thread
+ * @brief The thread the asynchronous writer runs on */
+struct native_thread
+{
+    typedef void ( *entry_point )( void * );
+
+    native_thread()
+        :m_entry( 0 )
+        ,m_argument( 0 )
+        ,m_thread()
+    {
+    }
+
+    /**@brief Starts running _entry( _argument )
+     * @return false if the thread could not be created
+     * @throw nothing */
+    bool start( entry_point _entry, void * _argument )
+    {
+        m_entry = _entry;
+        m_argument = _argument;
+#   if defined QLOG_MULTITHREAD_CPP11
+        try
+        {
+            m_thread = std::thread( &native_thread::run, this );
+        }
+        catch( ... )
+        {
+            return false;
+        }
+        return true;
+#   elif defined QLOG_MULTITHREAD_PTHREAD
+        return 0 == pthread_create( &m_thread, 0, &native_thread::run, this );
+#   else
+        m_thread = CreateThread( 0, 0, &native_thread::run, this, 0, 0 );
+        return 0 != m_thread;
+#   endif
+    }
+
+    void join()
+    {
+#   if defined QLOG_MULTITHREAD_CPP11
+        m_thread.join();
+#   elif defined QLOG_MULTITHREAD_PTHREAD
+        pthread_join( m_thread, 0 );
+#   else
+        WaitForSingleObject( m_thread, INFINITE );
+        CloseHandle( m_thread );
+#   endif
+    }
+
+    /**@brief Gives the processor away to another thread */
+    static void yield()
+    {
+#   if defined QLOG_MULTITHREAD_CPP11
+        std::this_thread::yield();
+#   elif defined QLOG_MULTITHREAD_PTHREAD
+        sched_yield();
+#   else
+        SwitchToThread();
+#   endif
+    }
+
+    /**@brief Tells the processor that the thread is polling, which saves power and the other hyperthread */
+    static void relax()
+    {
+#   if defined __GNUC__ && ( defined __i386__ || defined __x86_64__ )
+        __builtin_ia32_pause();
+#   elif defined __GNUC__ && defined __aarch64__
+        __asm__ __volatile__( "yield" );
+#   elif defined WIN32
+        YieldProcessor();
+#   endif
+    }
+
+    /**@brief Keeps the calling thread on some processors
+     * @return false if the system refused, or cannot do it */
+    static bool set_affinity( const unsigned * _cpus, size_t _count )
+    {
+#   if defined __linux__
+        cpu_set_t set;
+        CPU_ZERO( &set );
+        for( size_t i = 0; i < _count; ++i )
+        {
+            if( _cpus[i] < CPU_SETSIZE )
+                CPU_SET( _cpus[i], &set );
+        }
+        return 0 == sched_setaffinity( 0, sizeof( set ), &set );
+#   elif defined WIN32
+        DWORD_PTR mask = 0;
+        for( size_t i = 0; i < _count; ++i )
+        {
+            if( _cpus[i] < sizeof( mask ) * 8 )
+                mask |= static_cast<DWORD_PTR>( 1 ) << _cpus[i];
+        }
+        return 0 != SetThreadAffinityMask( GetCurrentThread(), mask );
+#   else
+        ( void )_cpus;
+        ( void )_count;
+        return false;
+#   endif
+    }
+
+    /**@brief Changes the priority of the calling thread, see set_writer_priority()
+     * @return false if the system refused, or cannot do it */
+    static bool set_priority( int _priority, bool _realtime )
+    {
+#   ifdef WIN32
+        return 0 != SetThreadPriority( GetCurrentThread(), _realtime ? THREAD_PRIORITY_TIME_CRITICAL : _priority );
+#   else
+        if( _realtime )
+        {
+            struct sched_param parameters;
+            std::memset( &parameters, 0, sizeof( parameters ) );
+            parameters.sched_priority = _priority;
+            return 0 == pthread_setschedparam( pthread_self(), SCHED_FIFO, &parameters );
+        }
+#       ifdef __linux__
+        // the nice value of a thread of its own
+        return 0 == setpriority( PRIO_PROCESS, static_cast<id_t>( syscall( SYS_gettid ) ), _priority );
+#       else
+        return false;
+#       endif
+#   endif
+    }
+
+private:
+    native_thread( const native_thread & );
+    native_thread & operator=( const native_thread & );
+
+#   if defined QLOG_MULTITHREAD_CPP11
+    static void run( native_thread * _self )
+    {
+        _self->m_entry( _self->m_argument );
+    }
+#   elif defined QLOG_MULTITHREAD_PTHREAD
+    static void * run( void * _self )
+    {
+        native_thread * const self = static_cast<native_thread*>( _self );
+        self->m_entry( self->m_argument );
+        return 0;
+    }
+#   else
+    static DWORD WINAPI run( LPVOID _self )
+    {
+        native_thread * const self = static_cast<native_thread*>( _self );
+        self->m_entry( self->m_argument );
+        return 0;
+    }
+#   endif
+
+    entry_point m_entry;
+    void * m_argument;
+#   if defined QLOG_MULTITHREAD_CPP11
+    std::thread m_thread;
+#   elif defined QLOG_MULTITHREAD_PTHREAD
+    pthread_t m_thread;
+#   else
+    HANDLE m_thread;
+#   endif
+};
+
+// -------------------------------------------------------------------------- //
+/**@struct wakeup_event
+ * @brief An auto-reset event a thread can sleep on, with a timeout */
+struct wakeup_event
+{
+#   if defined QLOG_MULTITHREAD_CPP11
+    wakeup_event()
+        :m_mutex()
+        ,m_condition()
+        ,m_signaled( false )
+    {
+    }
+
+    void wait( unsigned _milliseconds )
+    {
+        std::unique_lock<std::mutex> lock( m_mutex );
+        if( !m_signaled )
+            m_condition.wait_for( lock, std::chrono::milliseconds( _milliseconds ) );
+        m_signaled = false;
+    }
+
+    void notify()
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        m_signaled = true;
+        m_condition.notify_all();
+    }
+
+private:
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+#   elif defined QLOG_MULTITHREAD_PTHREAD
+    wakeup_event()
+        :m_mutex()
+        ,m_condition()
+        ,m_signaled( false )
+    {
+        pthread_mutex_init( &m_mutex, 0 );
+        pthread_cond_init( &m_condition, 0 );
+    }
+
+    ~wakeup_event()
+    {
+        pthread_cond_destroy( &m_condition );
+        pthread_mutex_destroy( &m_mutex );
+    }
+
+    void wait( unsigned _milliseconds )
+    {
+        struct timeval now;
+        gettimeofday( &now, 0 );
+        struct timespec deadline;
+        const long nanoseconds = now.tv_usec * 1000L + static_cast<long>( _milliseconds % 1000 ) * 1000000L;
+        deadline.tv_sec = now.tv_sec + static_cast<time_t>( _milliseconds / 1000 ) + nanoseconds / 1000000000L;
+        deadline.tv_nsec = nanoseconds % 1000000000L;
+
+        pthread_mutex_lock( &m_mutex );
+        if( !m_signaled )
+            pthread_cond_timedwait( &m_condition, &m_mutex, &deadline );
+        m_signaled = false;
+        pthread_mutex_unlock( &m_mutex );
+    }
+
+    void notify()
+    {
+        pthread_mutex_lock( &m_mutex );
+        m_signaled = true;
+        pthread_cond_broadcast( &m_condition );
+        pthread_mutex_unlock( &m_mutex );
+    }
+
+private:
+    pthread_mutex_t m_mutex;
+    pthread_cond_t m_condition;
+#   else
+    wakeup_event()
+        :m_section()
+        ,m_condition()
+        ,m_signaled( false )
+    {
+        InitializeCriticalSection( &m_section );
+        InitializeConditionVariable( &m_condition );
+    }
+
+    ~wakeup_event()
+    {
+        DeleteCriticalSection( &m_section );
+    }
+
+    void wait( unsigned _milliseconds )
+    {
+        EnterCriticalSection( &m_section );
+        if( !m_signaled )
+            SleepConditionVariableCS( &m_condition, &m_section, _milliseconds );
+        m_signaled = false;
+        LeaveCriticalSection( &m_section );
+    }
+
+    void notify()
+    {
+        EnterCriticalSection( &m_section );
+        m_signaled = true;
+        WakeAllConditionVariable( &m_condition );
+        LeaveCriticalSection( &m_section );
+    }
+
+private:
+    CRITICAL_SECTION m_section;
+    CONDITION_VARIABLE m_condition;
+#   endif
+    wakeup_event( const wakeup_event & );
+    wakeup_event & operator=( const wakeup_event & );
+
+    bool m_signaled;
+};
+/**@endcond */
+
+// -------------------------------------------------------------------------- //
+/**@brief What happens to a message when the asynchronous ring is full
+ * - overflow::drop discards the new message
+ * - overflow::block makes the logging thread wait for some room
+ * - overflow::overwrite_oldest discards the oldest message not yet written */
+namespace overflow
+{
+static const unsigned drop = 0;
+static const unsigned block = 1;
+static const unsigned overwrite_oldest = 2;
+}
+
+/**@struct async_slot
+ * @cond GENERATE_INTERNAL_DOCUMENTATION
+ * @brief One cell of the asynchronous ring.
+ *
+ * A message longer than QLOG_ASYNC_SLOT_SIZE spreads over consecutive slots,
+ * in which case only the first slot's header is meaningful.
+ */
+struct async_slot
+{
+    atomic_integer<size_t> m_sequence;
+    atomic_integer<size_t> m_span; ///< Read before the message is claimed, while a producer may rewrite it
+    size_t m_size;
+    sink_list * m_output;
+    unsigned m_level;
+    bool m_flush;
+    bool m_binary; ///< Whether the message still has to be formatted, see decode_record()
+    char m_data[QLOG_ASYNC_SLOT_SIZE];
+};
+
+// -------------------------------------------------------------------------- //
+/**@struct async_backend
+ * @brief A bounded multi-producer, single-consumer ring and its writer thread.
+ *
+ * Producers claim slots by advancing the tail with a compare-and-swap, copy
+ * their message and publish it by updating each slot's sequence number. The
+ * writer thread is the only consumer: it moves whole messages into a local
+ * batch, gives the slots back, and only then writes the batch to the
+ * outputs. Producers therefore never wait on a stream.
+ *
+ * With overflow::overwrite_oldest, a producer facing a full ring takes the
+ * oldest message away from the writer by advancing the head itself. The
+ * writer claims each message the same way, with a compare-and-swap, before
+ * copying it: the slots of a claimed message are only rewritten once the
+ * writer gives them back.
+ *
+ * Binary messages are formatted by the sink_list they go to, by the writer.
+ */
+struct async_backend
+{
+    async_backend( size_t _capacity, unsigned _policy, const writer_options & _options )
+        :m_slots( 0 )
+        ,m_capacity( 1 )
+        ,m_policy( _policy )
+        ,m_options( _options )
+        ,m_head()
+        ,m_tail()
+        ,m_written()
+        ,m_dropped()
+        ,m_stop()
+        ,m_idle()
+        ,m_flush_waiters()
+        ,m_passes()
+        ,m_high_water()
+        ,m_staged()
+        ,m_staged_count()
+        ,m_writing()
+        ,m_crashed()
+        ,m_configured()
+        ,m_batch()
+        ,m_entries()
+        ,m_dirty()
+        ,m_thread()
+        ,m_wakeup()
+        ,m_drained()
+    {
+        while( m_capacity < _capacity )
+            m_capacity *= 2;
+    }
+
+    ~async_backend()
+    {
+        delete[] m_slots;
+    }
+
+    /**@brief Allocates the ring and starts the writer
+     * @return false if the backend cannot run
+     * @throw nothing */
+    bool start()
+    {
+        try
+        {
+            m_slots = new async_slot[m_capacity];
+            m_batch.reserve( QLOG_ASYNC_BATCH_SIZE + m_capacity * QLOG_ASYNC_SLOT_SIZE );
+            m_entries.reserve( m_capacity );
+        }
+        catch( const std::bad_alloc & )
+        {
+            return false;
+        }
+
+        for( size_t i = 0; i < m_capacity; ++i )
+            m_slots[i].m_sequence.store_relaxed( i );
+
+        return m_thread.start( &async_backend::run, this );
+    }
+
+    /**@brief Writes everything that is pending and joins the writer */
+    void stop()
+    {
+        m_stop.store( 1 );
+        m_wakeup.notify();
+        m_thread.join();
+    }
+
+    /**@brief Queues a message for the writer thread
+     * @param[in] _output Where the message will be written
+     * @param[in] _data The message
+     * @param[in] _size The length of the message
+     * @param[in] _level The level of the logger, for the flush policy
+     * @param[in] _flush Whether the message ended with std::endl
+     * @param[in] _binary Whether the message is a binary record rather than text
+     * @return false if the message was dropped
+     * @throw nothing */
+    bool push( sink_list * _output, const char * _data, size_t _size, unsigned _level, bool _flush, bool _binary = false )
+    {
+        size_t span = ( _size + QLOG_ASYNC_SLOT_SIZE - 1 ) / QLOG_ASYNC_SLOT_SIZE;
+        if( 0 == span )
+            span = 1;
+
+        if( span > m_capacity )
+        {
+            span = m_capacity;
+            _size = m_capacity * QLOG_ASYNC_SLOT_SIZE;
+        }
+
+        size_t position = m_tail.load_relaxed();
+        for( ;; )
+        {
+            // with overwrite_oldest, the slots are given back out of order: each one must be free
+            ptrdiff_t diff = 0;
+            for( size_t i = 0; i < span && 0 == diff; ++i )
+            {
+                const size_t slot = position + i;
+                diff = static_cast<ptrdiff_t>( m_slots[slot & ( m_capacity - 1 )].m_sequence.load() - slot );
+            }
+
+            if( 0 == diff )
+            {
+                if( m_tail.compare_exchange( position, position + span ) )
+                    break;
+            }
+            else if( diff < 0 )
+            {
+                if( !make_room() )
+                {
+                    m_dropped.fetch_add( 1 );
+                    return false;
+                }
+                position = m_tail.load_relaxed();
+            }
+            else
+            {
+                position = m_tail.load_relaxed();
+            }
+        }
+
+        async_slot & first = m_slots[position & ( m_capacity - 1 )];
+        first.m_span.store_relaxed( span );
+        first.m_size = _size;
+        first.m_output = _output;
+        first.m_level = _level;
+        first.m_flush = _flush;
+        first.m_binary = _binary;
+
+        for( size_t i = 0; i < span; ++i )
+        {
+            const size_t offset = i * QLOG_ASYNC_SLOT_SIZE;
+            const size_t length = _size - offset < QLOG_ASYNC_SLOT_SIZE ? _size - offset : QLOG_ASYNC_SLOT_SIZE;
+            if( _size > offset )
+                std::memcpy( m_slots[( position + i ) & ( m_capacity - 1 )].m_data, _data + offset, length );
+        }
+
+        // the first slot is published last: seeing it means the whole message is there
+        for( size_t i = span; i-- > 0; )
+            m_slots[( position + i ) & ( m_capacity - 1 )].m_sequence.store( position + i + 1 );
+
+        atomic_fence();
+        wake_writer();
+        return true;
+    }
+
+    /**@brief Waits until every message logged so far has been written and flushed */
+    void flush()
+    {
+        m_flush_waiters.fetch_add( 1 );
+        const size_t target = m_tail.load();
+        const size_t pass = m_passes.load();
+
+        // the pass running right now may have started before we asked for a flush
+        while( static_cast<ptrdiff_t>( m_written.load() - target ) < 0
+               || m_passes.load() - pass < 2 )
+        {
+            m_wakeup.notify();
+            m_drained.wait( 1 );
+        }
+        m_flush_waiters.fetch_add( static_cast<size_t>( -1 ) );
+    }
+
+    /**@brief The number of messages lost because of the overflow policy */
+    size_t dropped() const { return m_dropped.load_relaxed(); }
+
+    /**@brief The number of slots holding messages, or being filled */
+    size_t depth() const { return m_tail.load_relaxed() - m_head.load_relaxed(); }
+
+    /**@brief The highest depth() the writer thread has found when it woke up */
+    size_t high_water() const { return m_high_water.load_relaxed(); }
+
+    /**@brief Whether the writer thread runs where and with the priority it was asked to, once it has started */
+    bool configured() const { return 2 == m_configured.load(); }
+
+    /**@brief Writes the messages not written yet from a signal handler, see set_crash_handler()
+     *
+     * The writer thread is stopped first, once it is done with the messages
+     * it is writing, if any. The messages of its batch it has not written yet
+     * come first, then those published in the ring. Nothing is locked or
+     * allocated. */
+    void salvage()
+    {
+        m_crashed.store( 1 );
+        atomic_fence();
+
+        // the crash may be the writer's own: do not wait for it forever
+        for( unsigned i = 0; i < 100000 && 0 != m_writing.load(); ++i )
+            native_thread::yield();
+
+        const size_t count = m_staged_count.load();
+        for( size_t i = m_staged.load(); i < count; ++i )
+        {
+            const batch_entry & entry = m_entries[i];
+            salvage_message( entry.m_output, &m_batch[0] + entry.m_offset, entry.m_size, entry.m_binary );
+        }
+
+        const size_t tail = m_tail.load();
+        for( size_t position = m_head.load(); static_cast<ptrdiff_t>( tail - position ) > 0; )
+        {
+            const async_slot & first = m_slots[position & ( m_capacity - 1 )];
+            if( first.m_sequence.load() != position + 1 )
+                break;
+
+            // the slots of a message may wrap around the end of the ring
+            for( size_t i = 0; i < first.m_span.load_relaxed(); ++i )
+            {
+                const size_t offset = i * QLOG_ASYNC_SLOT_SIZE;
+                const size_t length = first.m_size - offset < QLOG_ASYNC_SLOT_SIZE ? first.m_size - offset : QLOG_ASYNC_SLOT_SIZE;
+                if( first.m_size > offset )
+                    salvage_message( first.m_output, m_slots[( position + i ) & ( m_capacity - 1 )].m_data, length, first.m_binary );
+            }
+            position += first.m_span.load_relaxed();
+        }
+    }
+
+private:
+    struct batch_entry
+    {
+        sink_list * m_output;
+        size_t m_offset;
+        size_t m_size;
+        unsigned m_level;
+        bool m_flush;
+        bool m_binary;
+    };
+
+    async_backend( const async_backend & );
+    async_backend & operator=( const async_backend & );
+
+    static void run( void * _self )
+    {
+        static_cast<async_backend*>( _self )->loop();
+    }
+
+    /**@brief Tells salvage() that the writer thread is going to write, or to take messages
+     *        out of the ring, unless salvage() has started
+     *
+     * Once it has, the writer thread never touches the outputs nor the ring again. */
+    void begin_writing()
+    {
+        m_writing.store( 1 );
+        atomic_fence();
+        if( 0 == m_crashed.load() )
+            return;
+
+        m_writing.store( 0 );
+        for( ;; )
+            m_wakeup.wait( 1000 );
+    }
+
+    void end_writing() { m_writing.store( 0 ); }
+
+    static void salvage_message( sink_list * _output, const char * _data, size_t _size, bool _binary )
+    {
+        if( !_output )
+            return;
+
+        if( _binary )
+            _output->write_records_on_crash( _data, _size );
+        else
+            _output->write_on_crash( _data, _size );
+    }
+
+    void loop()
+    {
+        configure();
+        for( ;; )
+        {
+            const bool stopping = ( 0 != m_stop.load() );
+            if( 0 != drain() )
+                continue;
+
+            if( stopping )
+                break;
+
+            expire_dirty();
+            if( poll() )
+                continue;
+
+            m_idle.store( 1 );
+            atomic_fence();
+            if( !has_message() )
+                m_wakeup.wait( m_options.m_sleep_milliseconds );
+            m_idle.store( 0 );
+        }
+    }
+
+    /**@brief Applies the affinity and the priority asked for, from the writer thread itself */
+    void configure()
+    {
+        bool configured = true;
+        if( m_options.m_cpu_count )
+            configured = native_thread::set_affinity( m_options.m_cpus, m_options.m_cpu_count );
+        if( m_options.m_prioritized )
+            configured = native_thread::set_priority( m_options.m_priority, m_options.m_realtime ) && configured;
+        m_configured.store( configured ? 2 : 1 );
+    }
+
+    /**@brief Looks at the ring the way the wait strategy says before the writer sleeps
+     * @return Whether the writer must not sleep: a message came, or it never sleeps */
+    bool poll()
+    {
+        if( writer_wait::busy_poll == m_options.m_wait )
+        {
+            native_thread::relax();
+            return true;
+        }
+
+        if( writer_wait::spin_then_sleep != m_options.m_wait )
+            return false;
+
+        // twice as many pauses each time, then the processor is given away between two looks
+        const size_t start = monotonic_nanoseconds();
+        const size_t duration = static_cast<size_t>( m_options.m_spin_microseconds ) * 1000;
+        for( unsigned pauses = 1; !has_message(); pauses = pauses < 64 ? 2 * pauses : pauses )
+        {
+            if( 0 != m_stop.load_relaxed() || monotonic_nanoseconds() - start >= duration )
+                return has_message();
+
+            if( pauses < 64 )
+            {
+                for( unsigned i = 0; i < pauses; ++i )
+                    native_thread::relax();
+            }
+            else
+            {
+                native_thread::yield();
+            }
+        }
+        return true;
+    }
+
+    bool has_message() const
+    {
+        const size_t head = m_head.load();
+        return m_slots[head & ( m_capacity - 1 )].m_sequence.load() == head + 1;
+    }
+
+    void wake_writer()
+    {
+        unsigned idle = 1;
+        if( 1 == m_idle.load_relaxed() && m_idle.compare_exchange( idle, 0 ) )
+            m_wakeup.notify();
+    }
+
+    /**@brief Applies the overflow policy when the ring is full
+     * @return false if the message has to be dropped */
+    bool make_room()
+    {
+        if( overflow::drop == m_policy )
+            return false;
+
+        if( overflow::overwrite_oldest == m_policy )
+        {
+            size_t head = m_head.load();
+            async_slot & oldest = m_slots[head & ( m_capacity - 1 )];
+            if( oldest.m_sequence.load() == head + 1 )
+            {
+                const size_t span = oldest.m_span.load_relaxed();
+                if( m_head.compare_exchange( head, head + span ) )
+                {
+                    release( head, span );
+                    m_dropped.fetch_add( 1 );
+                    return true;
+                }
+            }
+        }
+
+        m_wakeup.notify();
+        native_thread::yield();
+        return true;
+    }
+
+    void release( size_t _position, size_t _span )
+    {
+        for( size_t i = 0; i < _span; ++i )
+            m_slots[( _position + i ) & ( m_capacity - 1 )].m_sequence.store( _position + i + m_capacity );
+    }
+
+    /**@brief Moves the next message from the ring to the batch
+     * @return false if the ring is empty */
+    bool pop()
+    {
+        for( ;; )
+        {
+            size_t head = m_head.load();
+            const async_slot & first = m_slots[head & ( m_capacity - 1 )];
+            if( first.m_sequence.load() != head + 1 )
+                return false;
+
+            // a producer may take the oldest message away: claim it before reading the rest
+            const size_t span = first.m_span.load_relaxed();
+            if( overflow::overwrite_oldest == m_policy && !m_head.compare_exchange( head, head + span ) )
+                continue;
+
+            batch_entry entry;
+            entry.m_output = first.m_output;
+            entry.m_offset = m_batch.size();
+            entry.m_size = first.m_size;
+            entry.m_level = first.m_level;
+            entry.m_flush = first.m_flush;
+            entry.m_binary = first.m_binary;
+
+            m_batch.resize( entry.m_offset + entry.m_size );
+            for( size_t i = 0; i < span; ++i )
+            {
+                const size_t offset = i * QLOG_ASYNC_SLOT_SIZE;
+                const size_t length = entry.m_size - offset < QLOG_ASYNC_SLOT_SIZE ? entry.m_size - offset : QLOG_ASYNC_SLOT_SIZE;
+                if( entry.m_size > offset )
+                    std::memcpy( &m_batch[entry.m_offset + offset], m_slots[( head + i ) & ( m_capacity - 1 )].m_data, length );
+            }
+
+            if( overflow::overwrite_oldest != m_policy )
+                m_head.store( head + span );
+
+            release( head, span );
+            m_entries.push_back( entry );
+            m_staged_count.store( m_entries.size() );
+            return true;
+        }
+    }
+
+    /**@brief Writes a batch of messages to their outputs
+     * @return The number of messages written */
+    size_t drain()
+    {
+        const size_t depth = m_tail.load_relaxed() - m_head.load_relaxed();
+        if( depth > m_high_water.load_relaxed() )
+            m_high_water.store_relaxed( depth );
+
+        // salvage() finds each message either in the ring or in the batch, never in between
+        begin_writing();
+        m_staged_count.store( 0 );
+        m_staged.store( 0 );
+        m_batch.clear();
+        m_entries.clear();
+
+        while( m_batch.size() < QLOG_ASYNC_BATCH_SIZE && m_entries.size() < m_capacity && pop() )
+        {
+        }
+        end_writing();
+
+        // consecutive messages going to the same output are written at once
+        for( size_t i = 0; i < m_entries.size(); )
+        {
+            sink_list * const output = m_entries[i].m_output;
+            const bool binary = m_entries[i].m_binary;
+            const size_t offset = m_entries[i].m_offset;
+            size_t size = 0;
+            bool flush = false;
+            unsigned level = 0;
+            for( ; i < m_entries.size() && m_entries[i].m_output == output && m_entries[i].m_binary == binary; ++i )
+            {
+                size += m_entries[i].m_size;
+                flush = flush || m_entries[i].m_flush;
+                level = m_entries[i].m_level > level ? m_entries[i].m_level : level;
+            }
+
+            begin_writing();
+            if( output && !output->write_messages( size ? &m_batch[offset] : 0, size, flush, level, binary ) )
+                mark_dirty( output );
+            m_staged.store( i );
+            end_writing();
+        }
+
+        const bool flush_requested = ( 0 != m_flush_waiters.load() );
+        if( flush_requested )
+        {
+            begin_writing();
+            for( size_t i = 0; i < m_dirty.size(); ++i )
+                m_dirty[i]->flush();
+            m_dirty.clear();
+            end_writing();
+        }
+
+        m_written.store( m_head.load() );
+        m_passes.fetch_add( 1 );
+        if( flush_requested )
+            m_drained.notify();
+
+        return m_entries.size();
+    }
+
+    /**@brief Applies the time limit of the flush policy to the outputs not flushed yet */
+    void expire_dirty()
+    {
+        begin_writing();
+        for( size_t i = 0; i < m_dirty.size(); )
+        {
+            if( m_dirty[i]->expire() )
+            {
+                m_dirty[i] = m_dirty.back();
+                m_dirty.pop_back();
+            }
+            else
+            {
+                ++i;
+            }
+        }
+        end_writing();
+    }
+
+    void mark_dirty( sink_list * _output )
+    {
+        for( size_t i = 0; i < m_dirty.size(); ++i )
+        {
+            if( m_dirty[i] == _output )
+                return;
+        }
+
+        try
+        {
+            m_dirty.push_back( _output );
+        }
+        catch( const std::bad_alloc & )
+        {
+            _output->flush();
+        }
+    }
+
+    async_slot * m_slots;
+    size_t m_capacity;
+    const unsigned m_policy;
+    const writer_options m_options;
+
+    atomic_integer<size_t> m_head;
+    atomic_integer<size_t> m_tail;
+    atomic_integer<size_t> m_written;
+    atomic_integer<size_t> m_dropped;
+    atomic_integer<unsigned> m_stop;
+    atomic_integer<unsigned> m_idle;
+    atomic_integer<size_t> m_flush_waiters;
+    atomic_integer<size_t> m_passes;
+    atomic_integer<size_t> m_high_water; ///< Only written by the writer thread
+    atomic_integer<size_t> m_staged; ///< The first message of the batch not written yet, for salvage()
+    atomic_integer<size_t> m_staged_count; ///< The number of messages in the batch, for salvage()
+    atomic_integer<unsigned> m_writing; ///< Whether the writer thread is using the outputs
+    atomic_integer<unsigned> m_crashed; ///< Whether salvage() took the outputs over
+    atomic_integer<unsigned> m_configured; ///< 0 until the writer has started, 1 if configure() failed, 2 if not
+
+    // only touched by the writer thread
+    std::vector<char> m_batch;
+    std::vector<batch_entry> m_entries;
+    std::vector<sink_list *> m_dirty;
+
+    native_thread m_thread;
+    wakeup_event m_wakeup;
+    wakeup_event m_drained;
+};
+/**@endcond */
+#endif // QLOG_ASYNC
+
+// -------------------------------------------------------------------------- //
+/**@struct decorater
+ * @cond GENERATE_INTERNAL_DOCUMENTATION
+ * @brief The text a logger writes before or after each message.
+ *
+ * Every piece of decoration is concatenated in a single buffer when it is
+ * added, so that decorating a message is a single write. The first
+ * QLOG_DECORATION_BUFFER_SIZE bytes are stored inline. What cannot be
+ * computed in advance, such as a timestamp or a color on windows, is stored
+ * as a null character followed by one of the field tags and its parameters.
+ */
+namespace field
+{
+static const char attributes = 'a'; ///< followed by a WORD
+static const char time = 't'; ///< followed by the precision and whether it is UTC
+static const char thread = 'i';
+static const char location = 's';
+static const char module = 'm';
+static const char escape = 'e'; ///< followed by a length and the escape sequence of a color
+}
+
+template <unsigned loglevel, bool append>
+struct decorater
+{
+    decorater()
+    {
+    }
+
+    /**@brief Adds text to the decorations
+     * @param[in] _txt The text
+     * @param[in] _size The length of the text
+     * @throw nothing */
+    void add_text( const char * _txt, size_t _size )
+    {
+        if( reserve( _size ) )
+        {
+            std::memcpy( data() + m_size, _txt, _size );
+            m_size += _size;
+        }
+    }
+
+    /**@brief Adds a field rendered for each message
+     * @param[in] _tag What the field is, see the field namespace
+     * @param[in] _parameters What the field needs to be rendered
+     * @param[in] _size The length of _parameters
+     * @throw nothing */
+    void add_field( char _tag, const void * _parameters = 0, size_t _size = 0 )
+    {
+        if( reserve( 2 + _size ) )
+        {
+            data()[m_size] = '\0';
+            data()[m_size + 1] = _tag;
+            if( _size )
+                std::memcpy( data() + m_size + 2, _parameters, _size );
+            m_size += 2 + _size;
+            m_fields = true;
+        }
+    }
+
+    bool empty() const
+    {
+        return 0 == m_size;
+    }
+
+    /**@brief Apply all decorations to a message
+     * @param[in] _record The message to which decorations will be applied
+     * @throw nothing */
+    void apply_all( record_state & _record )
+    {
+        if( m_fields )
+            apply_fields( _record );
+        else if( m_size )
+            _record.m_stream.buffer().append( data(), m_size );
+    }
+
+    /**@brief Deletes all the registered decorations
+     * @throw nothing */
+    void reset()
+    {
+        delete[] m_heap;
+        m_heap = 0;
+        m_size = 0;
+        m_capacity = QLOG_DECORATION_BUFFER_SIZE;
+        m_fields = false;
+    }
+
+private:
+    static char * data()
+    {
+        return m_heap ? m_heap : m_inline;
+    }
+
+    /**@brief Makes room for more bytes
+     * @return false if memory cannot be obtained */
+    static bool reserve( size_t _size )
+    {
+        if( m_capacity - m_size >= _size )
+            return true;
+
+        size_t capacity = 2 * m_capacity;
+        while( capacity - m_size < _size )
+            capacity *= 2;
+
+        char * heap = 0;
+        try
+        {
+            heap = new char[capacity];
+        }
+        catch( const std::bad_alloc & )
+        {
+            return false;
+        }
+
+        std::memcpy( heap, data(), m_size );
+        delete[] m_heap;
+        m_heap = heap;
+        m_capacity = capacity;
+        return true;
+    }
+
+    static void apply_fields( record_state & _record )
+    {
+        record_buffer & output = _record.m_stream.buffer();
+        const char * const end = data() + m_size;
+        for( const char * txt = data(); txt < end; )
+        {
+            const char * const escape = static_cast<const char *>( std::memchr( txt, '\0', static_cast<size_t>( end - txt ) ) );
+            const char * const stop = escape ? escape : end;
+            output.append( txt, static_cast<size_t>( stop - txt ) );
+            if( !escape )
+                break;
+
+            txt = escape + 2;
+            switch( escape[1] )
+            {
+            case field::time:
+            {
+                char text[64];
+                output.append( text, format_time( _record.m_cache, text, static_cast<unsigned char>( txt[0] ), 0 != txt[1] ) );
+                txt += 2;
+                break;
+            }
+            case field::thread:
+            {
+                size_t size = 0;
+                const char * const text = format_thread( _record.m_cache, size );
+                output.append( text, size );
+                break;
+            }
+            case field::location:
+                if( _record.m_location.m_file )
+                {
+                    const char * file = _record.m_location.m_file;
+                    for( const char * c = file; *c; ++c )
+                    {
+                        if( '/' == *c || '\\' == *c )
+                            file = c + 1;
+                    }
+
+                    char line[24];
+                    line[0] = ':';
+                    output.append( file, std::strlen( file ) );
+                    output.append( line, 1 + format_decimal( line + 1, _record.m_location.m_line ) );
+                }
+                break;
+            case field::module:
+                if( _record.m_module )
+                    output.append( _record.m_module->m_name, std::strlen( _record.m_module->m_name ) );
+                break;
+            case field::escape:
+            {
+                const size_t size = static_cast<unsigned char>( txt[0] );
+                if( _record.m_colored )
+                    output.append( txt + 1, size );
+                txt += 1 + size;
+                break;
+            }
+#           ifdef WIN32
+            case field::attributes:
+            {
+                WORD attributes = 0;
+                std::memcpy( &attributes, txt, sizeof( WORD ) );
+                settings::set_text_attribute( settings::console_handle, attributes );
+                txt += sizeof( WORD );
+                break;
+            }
+#           endif
+            default:
+                QLOG_ASSERT( 0 && "unknown field" );
+                break;
+            }
+        }
+    }
+
+    static bool m_fields; ///< Whether there is more than text to write
+    static char m_inline[QLOG_DECORATION_BUFFER_SIZE];
+    static char * m_heap;
+    static size_t m_size;
+    static size_t m_capacity;
+};
+
+template< unsigned loglevel, bool append >
+char decorater<loglevel, append>::m_inline[QLOG_DECORATION_BUFFER_SIZE];
+
+template< unsigned loglevel, bool append >
+char * decorater<loglevel, append>::m_heap = 0;
+
+template< unsigned loglevel, bool append >
+size_t decorater<loglevel, append>::m_size = 0;
+
+template< unsigned loglevel, bool append >
+size_t decorater<loglevel, append>::m_capacity = QLOG_DECORATION_BUFFER_SIZE;
+
+template< unsigned loglevel, bool append >
+bool decorater<loglevel, append>::m_fields = false;
+// -------------------------------------------------------------------------- //
+template< unsigned loglevel, bool append > inline
+decorater<loglevel, append> & operator << ( decorater<loglevel, append> & _dec, const char * _txt )
+{
+    QLOG_ASSERT( 0 != _txt );
+    _dec.add_text( _txt, std::strlen( _txt ) );
+    return _dec;
+}
+
+template< unsigned loglevel, bool append > inline
+decorater<loglevel, append> & operator << ( decorater<loglevel, append> & _dec, const timestamp & _timestamp )
+{
+    const char parameters[2] = { static_cast<char>( _timestamp.getPrecision() ), static_cast<char>( _timestamp.isUtc() ) };
+    _dec.add_field( field::time, parameters, sizeof( parameters ) );
+    return _dec;
+}
+
+template< unsigned loglevel, bool append > inline
+decorater<loglevel, append> & operator << ( decorater<loglevel, append> & _dec, const thread_id & )
+{
+    _dec.add_field( field::thread );
+    return _dec;
+}
+
+template< unsigned loglevel, bool append > inline
+decorater<loglevel, append> & operator << ( decorater<loglevel, append> & _dec, const level_tag & )
+{
+    return _dec << level_name( loglevel );
+}
+
+template< unsigned loglevel, bool append > inline
+decorater<loglevel, append> & operator << ( decorater<loglevel, append> & _dec, const source_location & )
+{
+    _dec.add_field( field::location );
+    return _dec;
+}
+
+template< unsigned loglevel, bool append > inline
+decorater<loglevel, append> & operator << ( decorater<loglevel, append> & _dec, const module_name & )
+{
+    _dec.add_field( field::module );
+    return _dec;
+}
+/**@endcond */
+
+// -------------------------------------------------------------------------- //
+/**@struct lazy_value
+ * @brief A function whose result is only computed if the message is written, see lazy() */
+template< typename F >
+struct lazy_value
+{
+    explicit
+    lazy_value( const F & _function )
+        :m_function( _function )
+    {
+    }
+
+    /**@brief What computes the value to write */
+    const F & function() const { return m_function; }
+
+private:
+    F m_function;
+};
+
+/**@brief Defers the computation of a part of a message until the message is known to be written
+ * @param[in] _function A function object taking no argument, whose const operator() returns
+ *            what to write
+ * @return What to send to the logger with operator<<, logger::kv() or logger::log()
+ *
+ * A filtered message, whether its level is too low, its logger disabled or
+ * its condition false, never calls the function:
+ * @code{.cpp}
+ * qlog::debug( verbose ) << "state: " << qlog::lazy( [&]{ return dump( state ); } ) << std::endl;
+ * @endcode
+ */
+template< typename F > inline
+lazy_value<F> lazy( const F & _function )
+{
+    return lazy_value<F>( _function );
+}
+
+// -------------------------------------------------------------------------- //
+/**@cond GENERATE_INTERNAL_DOCUMENTATION
+ * @brief What a character becomes in a quoted value: 0 if it is kept, the
+ *        letter following the backslash otherwise, 'u' meaning \u00XX */
+inline
+const char * escape_table()
+{
+    static const char table[256] =
+    {
+        'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'b', 't', 'n', 'u', 'f', 'r', 'u', 'u',
+        'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+          0,   0, '"',   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+          0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+          0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+          0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0, '\\',  0,   0,   0
+    };
+    return table;
+}
+
+/**@brief Quotes and escapes what was written to a record since an offset, in place
+ * @param[in] _record The record
+ * @param[in] _start Where the value starts
+ * @param[in] _always Whether to quote a value that does not need it, as JSON does
+ * @throw nothing
+ *
+ * Nothing is copied when the value needs neither quotes nor escaping. */
+inline
+void quote_value( record_buffer & _record, size_t _start, bool _always )
+{
+    const char * const table = escape_table();
+    const size_t end = _record.size();
+    const char * const value = _record.data();
+    size_t extra = 0;
+    bool quote = _always || end == _start;
+    for( size_t i = _start; i < end; ++i )
+    {
+        const unsigned char c = static_cast<unsigned char>( value[i] );
+        if( table[c] )
+            extra += ( 'u' == table[c] ) ? 5 : 1;
+        else if( ' ' == c || '=' == c )
+            quote = true;
+    }
+
+    if( !quote && !extra )
+        return;
+
+    char * const room = _record.extend( extra + 2 );
+    if( !room )
+        return;
+
+    // moves the characters from the end, so that nothing is overwritten before being read
+    static const char digits[] = "0123456789abcdef";
+    char * const first = room - ( end - _start );
+    char * output = room + extra + 2;
+    *--output = '"';
+    for( char * input = room; input != first; )
+    {
+        const unsigned char c = static_cast<unsigned char>( *--input );
+        const char escape = table[c];
+        if( !escape )
+        {
+            *--output = static_cast<char>( c );
+            continue;
+        }
+
+        if( 'u' == escape )
+        {
+            *--output = digits[c & 0xF];
+            *--output = digits[c >> 4];
+            *--output = '0';
+            *--output = '0';
+        }
+        *--output = escape;
+        *--output = '\\';
+    }
+    *--output = '"';
+}
+
+/**@brief Writes the value of a pair, as the stream formats it, quoted as a string */
+template< typename T > inline
+void encode_value( record_stream & _stream, const T & _value )
+{
+    const size_t start = _stream.buffer().size();
+    _stream << _value;
+    quote_value( _stream.buffer(), start, structured::json == settings::structured_format );
+}
+
+/**@brief Writes the value of a pair computed by a function, see lazy() */
+template< typename F > inline
+void encode_value( record_stream & _stream, const lazy_value<F> & _value )
+{
+    encode_value( _stream, _value.function()() );
+}
+
+inline
+void encode_text( record_stream & _stream, const char * _text, size_t _size )
+{
+    const size_t start = _stream.buffer().size();
+    _stream.buffer().append( _text, _size );
+    quote_value( _stream.buffer(), start, structured::json == settings::structured_format );
+}
+
+inline void encode_value( record_stream & _stream, const char * _value ) { encode_text( _stream, _value, std::strlen( _value ) ); }
+inline void encode_value( record_stream & _stream, char * _value ) { encode_text( _stream, _value, std::strlen( _value ) ); }
+inline void encode_value( record_stream & _stream, const std::string & _value ) { encode_text( _stream, _value.data(), _value.size() ); }
+inline void encode_value( record_stream & _stream, char _value ) { encode_text( _stream, &_value, 1 ); }
+
+inline
+void encode_value( record_stream & _stream, bool _value )
+{
+    if( _value )
+        _stream.buffer().append( "true", 4 );
+    else
+        _stream.buffer().append( "false", 5 );
+}
+
+inline void encode_value( record_stream & _stream, short _value ) { encode_signed<unsigned long>( _stream.buffer(), _value ); }
+inline void encode_value( record_stream & _stream, unsigned short _value ) { encode_unsigned( _stream.buffer(), _value ); }
+inline void encode_value( record_stream & _stream, int _value ) { encode_signed<unsigned long>( _stream.buffer(), _value ); }
+inline void encode_value( record_stream & _stream, unsigned int _value ) { encode_unsigned( _stream.buffer(), _value ); }
+inline void encode_value( record_stream & _stream, long _value ) { encode_signed<unsigned long>( _stream.buffer(), _value ); }
+inline void encode_value( record_stream & _stream, unsigned long _value ) { encode_unsigned( _stream.buffer(), _value ); }
+#ifdef QLOG_HAS_LONG_LONG
+inline void encode_value( record_stream & _stream, long long _value ) { encode_signed<unsigned long long>( _stream.buffer(), _value ); }
+inline void encode_value( record_stream & _stream, unsigned long long _value ) { encode_unsigned( _stream.buffer(), _value ); }
+#endif
+
+/**@brief Writes a floating-point value, as null in JSON if it is not finite */
+template< typename T > inline
+void encode_number( record_stream & _stream, T _value )
+{
+    if( !( _value - _value == 0 ) && structured::json == settings::structured_format )
+        _stream.buffer().append( "null", 4 );
+    else
+        format_value( _stream, _value );
+}
+
+inline void encode_value( record_stream & _stream, float _value ) { encode_number( _stream, _value ); }
+inline void encode_value( record_stream & _stream, double _value ) { encode_number( _stream, _value ); }
+inline void encode_value( record_stream & _stream, long double _value ) { encode_number( _stream, _value ); }
+
+/**@brief Writes a key-value pair of a structured message
+ *
+ * In a binary record, the pair is written as text: the writer of the
+ * record, not its reader, knows how to encode the value. */
+template< typename T > inline
+void write_pair( record_state & _record, const char * _key, const T & _value )
+{
+    QLOG_ASSERT( 0 != _key );
+    record_buffer & buffer = _record.m_stream.buffer();
+    const size_t start = _record.m_binary ? begin_text( buffer ) : 0;
+    if( _record.m_binary && 0 == start )
+        return;
+
+    const bool json = ( structured::json == settings::structured_format );
+    if( _record.m_pairs || json )
+        buffer.append( _record.m_pairs ? ( json ? "," : " " ) : "{", 1 );
+
+    const size_t key = buffer.size();
+    buffer.append( _key, std::strlen( _key ) );
+    if( json )
+        quote_value( buffer, key, true );
+    buffer.append( json ? ":" : "=", 1 );
+
+    encode_value( _record.m_stream, _value );
+    ++_record.m_pairs;
+
+    if( _record.m_binary )
+        end_text( buffer, start );
+}
+
+/**@brief Closes the key-value pairs written since the last text, if any */
+inline
+void end_pairs( record_state & _record )
+{
+    if( structured::json == settings::structured_format )
+    {
+        if( _record.m_binary )
+            capture_text( _record.m_stream.buffer(), "}", 1 );
+        else
+            _record.m_stream.buffer().append( "}", 1 );
+    }
+    _record.m_pairs = 0;
+}
+/**@endcond */
+
+template< unsigned level > struct receiver;
+template< unsigned level, bool compiled_in = ( level >= QLOG_MIN_LEVEL ) > struct level_stream;
+
+// -------------------------------------------------------------------------- //
+/**@struct logger
+ * @brief An object that logs messages
+ * @tparam level The level of detail the object logs at */
+template< unsigned level >
+struct logger
+{
+    /**@brief Constructs a logger
+     * @warning This should almost never been used. 5 loggers are already created
+     *          by the library in each compile unit to be used by the user.
+     * @param[in] _disabled Whether this logger actually writes messages
+     *
+     * In C++11, the constructor is constexpr: the 5 loggers are initialized
+     * before any code runs, at no cost at startup. */
+#   ifdef QLOG_HAS_CONSTEXPR
+    explicit constexpr
+    logger( bool _disabled = false )
+        :m_disabled{ _disabled ? 1U : 0U }
+    {
+    }
+#   else
+    explicit
+    logger( bool _disabled = false )
+        :m_disabled()
+    {
+        m_disabled.store_relaxed( _disabled );
+    }
+#   endif
+
+    /**@brief Copies a logger
+     * @warning This should almost never been used. 5 loggers are already created
+     *          by the library in each compile unit to be used by the user.
+     * @param[in] _logger The logger to copy */
+    logger( const logger & _logger )
+        :m_disabled()
+    {
+        m_disabled.store_relaxed( _logger.m_disabled.load_relaxed() );
+    }
+
+    ~logger()
+    {
+        reset_decoration();
+    }
+
+    /**@brief Removes all prepending or appending text */
+    void reset_decoration()
+    {
+        reset_prepend();
+        reset_append();
+    }
+
+    /**@brief Removes all appending text */
+    void reset_append()
+    {
+        m_append.reset();
+    }
+
+    /**@brief Removes all prepending text */
+    void reset_prepend()
+    {
+        m_prepend.reset();
+    }
+
+
+    /**@brief Assigns a logger
+     * @param[in] _copy Another logger
+     * @warning Assigning a logger is not permitted
+     * @return *this */
+    logger & operator=( const logger & _copy );
+
+    /**@brief Checks if the logger is able to log
+     * @return True if the logger can log */
+    bool isDisabled() const { return 0 != m_disabled.load_relaxed(); }
+
+    /**@brief Checks whether a message sent now would be written
+     * @return false if the level is below QLOG_MIN_LEVEL or below the current
+     *         level of logging, if the logger is disabled or has no output
+     * @see QLOG_LOG */
+    bool enabled() const
+    {
+#       ifdef QLOG_STATS
+        if( level >= QLOG_MIN_LEVEL && level < get_loglevel() )
+        {
+            const unsigned stripe = stats_stripe();
+            stats_add( m_stats[stripe % QLOG_STATS_STRIPES].m_filtered, 1 );
+            return false;
+        }
+#       endif
+        return ( level >= QLOG_MIN_LEVEL ) && can_log();
+    }
+
+    /**@brief Checks whether a message filtered out by the level would be kept in the backtrace ring
+     * @param[in] _threshold The level in effect: the global one, or the one of a module
+     * @see set_backtrace() */
+    bool traced( unsigned _threshold ) const
+    {
+        return ( level >= QLOG_MIN_LEVEL ) && 0 != settings::backtrace_records
+            && level >= settings::backtrace_level && level < _threshold && !isDisabled();
+    }
+
+    bool traced() const { return traced( get_loglevel() ); }
+
+    /**@brief Checks whether a message sent now would be written, or kept in the backtrace ring
+     * @see QLOG_LOG, set_backtrace() */
+    bool recorded() const
+    {
+        return enabled() || traced();
+    }
+
+    /**@brief Checks whether a message logged through a module would be output
+     * @param[in] _module The module, whose threshold replaces the global level
+     * @see qlog::module */
+    bool enabled( const module_node & _module ) const
+    {
+#       ifdef QLOG_STATS
+        if( level >= QLOG_MIN_LEVEL && level < _module.m_threshold.load_relaxed() )
+        {
+            const unsigned stripe = stats_stripe();
+            stats_add( m_stats[stripe % QLOG_STATS_STRIPES].m_filtered, 1 );
+            return false;
+        }
+#       endif
+        return ( level >= QLOG_MIN_LEVEL ) && ( level >= _module.m_threshold.load_relaxed() )
+            && ( _module.m_route || !m_sinks.empty() ) && !isDisabled();
+    }
+
+    /**@brief Outputs a part of a message.
+     * @warning This is automatically be called by @c operator<<, once the
+     *          receiver has checked that the message can be output
+     * @param[in] _message The message to check and output
+     * @param[in] _first_part Set to true if a custom message should be appended
+     * @param[in] _record Where the calling thread assembles the message
+     *
+     * Checking whether the message can be output consists in:
+     * - seeing whether the detail level of the logger is sufficient to output
+     *   the message: an warning logger cannot output message when the logging
+     *   level is set to error.
+     * - checking whether an output stream has been set.
+     * - checking whether the logger has been disabled during construction
+     *
+     * @see logger::logger(bool _disabled)
+     */
+    template< typename T >
+    void treat( const T & _message, bool _first_part, record_state & _record ) const
+    {
+        QLOG_ASSERT( _record.m_traced || !m_sinks.empty() );
+        if( _first_part )
+            start_record( _record );
+        else if( _record.m_pairs )
+            end_pairs( _record );
+
+        write( _record, _message );
+    }
+
+    /**@brief Outputs the escape sequence of a color, unless no output of the message is a terminal
+     * @param[in] _text The escape sequence
+     * @param[in] _size The length of the escape sequence
+     * @param[in] _first_part Whether it starts the message
+     * @param[in] _record Where the calling thread assembles the message */
+    void escape( const char * _text, size_t _size, bool _first_part, record_state & _record ) const
+    {
+        if( _first_part )
+            start_record( _record );
+        else if( _record.m_pairs )
+            end_pairs( _record );
+
+        if( _record.m_colored )
+            write_text( _record, _text, _size );
+    }
+
+#   ifdef QLOG_HAS_VARIADIC_TEMPLATES
+    /**@brief Writes a whole message made of a format and its arguments
+     * @param[in] _format The text of the message, where each {} is replaced by the
+     *            next argument; {{ and }} write { and }, and a {} left without an
+     *            argument is written as it is
+     * @param[in] _args The arguments, written as operator<< would
+     *
+     * The message is assembled in one call, without the receivers of operator<<.
+     * QLOG_LOGF also checks at compile time that the arguments match the format.
+     *
+     * @code{.cpp}
+     * qlog::info.log( "x={} y={}\n", x, y );
+     * @endcode
+     */
+    template< typename... Args >
+    void log( const char * _format, const Args &... _args ) const
+    {
+        log( location( 0, 0 ), _format, _args... );
+    }
+
+    /**@brief Writes a whole message, knowing where it comes from, see log( const char *, ... ) */
+    template< typename... Args >
+    void log( const location & _location, const char * _format, const Args &... _args ) const
+    {
+        QLOG_ASSERT( 0 != _format );
+        const bool written = enabled();
+        const bool traced = !written && this->traced();
+        if( !written && !traced )
+            return;
+
+        record_state * const record = records::acquire();
+        if( !record )
+            return;
+
+        // held while the arguments are written, as they may log themselves
+        ++record->m_receivers;
+        record->m_traced = traced;
+        record->m_location = _location;
+        start_record( *record );
+        write_format( *record, _format, _args... );
+        --record->m_receivers;
+        signal_end( *record );
+    }
+#   endif
+
+    /**@brief Starts a structured message with a key-value pair
+     * @param[in] _key The name of the value, written as it is in logfmt
+     * @param[in] _value The value: numbers and booleans are written as such,
+     *            anything else as a string, quoted and escaped if needed
+     * @return What the next pairs, or the rest of the message, are given to
+     *
+     * The pairs are written as one JSON object or in logfmt, see
+     * set_structured_format(). Text sent with operator<< after some pairs,
+     * std::endl included, closes the object.
+     *
+     * @code{.cpp}
+     * qlog::info.kv( "user", id ).kv( "latency_us", latency ) << std::endl;
+     * // {"user":42,"latency_us":118}
+     * @endcode
+     */
+    template< typename T >
+    typename level_stream<level>::type kv( const char * _key, const T & _value ) const
+    {
+        return typename level_stream<level>::type( this ).kv( _key, _value, true );
+    }
+
+    /**@brief Writes a key-value pair of a message
+     * @cond GENERATE_INTERNAL_DOCUMENTATION
+     * @param[in] _key The name of the value
+     * @param[in] _value The value
+     * @param[in] _first_part Whether the pair starts the message
+     * @param[in] _record Where the calling thread assembles the message
+     * @private */
+    template< typename T >
+    void key_value( const char * _key, const T & _value, bool _first_part, record_state & _record ) const
+    {
+        QLOG_ASSERT( _record.m_traced || !m_sinks.empty() );
+        if( _first_part )
+            start_record( _record );
+
+        write_pair( _record, _key, _value );
+    }
+    /**@endcond */
+
+    /**@brief Sets the destination of the messages
+     * @param[in] _output A std::ostream object that will receive the next messages
+     *
+     * Use this function if you want a certain logger to write its message to
+     * a customized output stream. The most frequent use is to direct messages
+     * to a file.
+     *
+     * @code{.cpp}
+     * #include <fstream>
+     * #include <string>
+     * #include "qlog.hpp"
+     *
+     * using namespace qlog;
+     *
+     * int main()
+     * {
+     *     const std::string filename("output.log");
+     *     std::ofstream output_file( filename.c_str() );
+     *
+     *     qlog::error.set_output( output_file );
+     *
+     *     qlog::error << "This message will be written in output.log" << std::endl;
+     * }
+     * @endcode
+     *
+     * @param[in] _terminal Whether the stream writes to a terminal, which gets
+     *            the colors, as in set_output( std::cout, isatty( 1 ) ); see set_color_policy()
+     */
+    void set_output( std::ostream & _output, bool _terminal = false )
+    {
+        m_stream_sink.set_stream( _output, _terminal );
+        m_sinks.clear();
+        m_sinks.add( m_stream_sink );
+    }
+
+    /**@brief Sets the destination of the messages
+     * @param[in] _sink Where the next messages will be written, file_sink or fd_sink for instance
+     * @see sink */
+    void set_output( sink & _sink )
+    {
+        m_sinks.clear();
+        m_sinks.add( _sink );
+    }
+
+    /**@brief Writes the next messages to one more sink
+     * @param[in] _sink A sink to write to, in addition to the current ones
+     * @return false if the logger already writes to QLOG_MAX_SINKS sinks
+     *
+     * The message is only formatted once, whatever the number of sinks.
+     * Like set_output(), this must not be called while other threads log. */
+    bool add_output( sink & _sink )
+    {
+        return m_sinks.add( _sink );
+    }
+
+    /**@brief Stops writing to a sink */
+    void remove_output( sink & _sink )
+    {
+        m_sinks.remove( _sink );
+    }
+
+    /**@brief Flushes the sinks of the logger
+     * @see qlog::flush() */
+    void flush_outputs() const
+    {
+#       ifdef QLOG_MULTITHREAD
+        if( m_mutex )
+            lock();
+#       endif
+        m_sinks.flush();
+#       ifdef QLOG_MULTITHREAD
+        if( m_mutex )
+            unlock();
+#       endif
+    }
+
+#   ifdef QLOG_STATS
+    /**@brief Adds up the counters of the threads
+     * @see get_stats() */
+    level_stats get_stats() const
+    {
+        level_stats total = { 0, 0, 0, 0 };
+        for( size_t i = 0; i < QLOG_STATS_STRIPES; ++i )
+        {
+            total.m_emitted += m_stats[i].m_emitted.load_relaxed();
+            total.m_filtered += m_stats[i].m_filtered.load_relaxed();
+            total.m_bytes += m_stats[i].m_bytes.load_relaxed();
+            total.m_lock_wait_nanoseconds += m_stats[i].m_lock_wait.load_relaxed();
+        }
+        return total;
+    }
+
+    /**@brief Sets the counters of the logger back to 0
+     * @see destroy() */
+    void reset_stats()
+    {
+        for( size_t i = 0; i < QLOG_STATS_STRIPES; ++i )
+        {
+            m_stats[i].m_emitted.store_relaxed( 0 );
+            m_stats[i].m_filtered.store_relaxed( 0 );
+            m_stats[i].m_bytes.store_relaxed( 0 );
+            m_stats[i].m_lock_wait.store_relaxed( 0 );
+        }
+    }
+#   endif
+
+    /**@brief Flushes the sinks of the logger from a signal handler, without locking
+     * @see set_crash_handler() */
+    void flush_outputs_on_crash() const
+    {
+        m_sinks.flush_on_crash();
+    }
+
+    /**@brief Adds a custom text after all logged messages. */
+    decorater<level, true> & append()
+    {
+        return m_append;
+    }
+
+    /**@brief Adds a custom text before all logged messages. */
+    decorater<level, false> & prepend()
+    {
+        return m_prepend;
+    }
+
+    /**@brief Informs the logger that std::endl, or other io manipulators, have been passed
+     * @cond GENERATE_INTERNAL_DOCUMENTATION
+     * @param[in] _func The io function, such as std::endl
+     * @param[in] _first_message Whether it is the first element of the << series.
+     * @param[in] _record Where the calling thread assembles the message
+     * @private */
+    void signal( standard_endline _func, bool _first_message, record_state & _record ) const
+    {
+        if( _first_message )
+            start_record( _record );
+        else if( _record.m_pairs )
+            end_pairs( _record );
+
+        if( _record.m_binary )
+        {
+            capture( _record.m_stream, _func );
+            return;
+        }
+        _func( _record.m_stream );
+    }
+
+    /**@brief Informs the logger that the last message was treated and that custom text can be appended
+     * @param[in] _record The finished message
+     *
+     * This is the only moment the output is locked in multithread mode: the
+     * message has been entirely formatted by the calling thread already. */
+    void signal_end( record_state & _record ) const
+    {
+        // the messages logged while this one was assembled had record_state of their own
+        QLOG_ASSERT( 0 == _record.m_receivers );
+
+        if( _record.m_pairs )
+            end_pairs( _record );
+        decorate( m_append, _record );
+        commit( _record );
+        _record.m_location.m_file = 0;
+        _record.m_module = 0;
+        _record.m_traced = false;
+    }
+
+    /**@brief Starts a message whose location is known
+     * @param[in] _record Where the message is assembled, with its location set */
+    void signal_start( record_state & _record ) const
+    {
+        start_record( _record );
+    }
+
+#   ifdef QLOG_MULTITHREAD
+    void lock() const
+    {
+#       ifdef QLOG_STATS
+        // the clock is only read when the lock is taken already
+        if( m_mutex->try_lock() )
+            return;
+
+        const size_t start = monotonic_nanoseconds();
+        m_mutex->lock();
+        const unsigned stripe = stats_stripe();
+        stats_add( m_stats[stripe % QLOG_STATS_STRIPES].m_lock_wait, monotonic_nanoseconds() - start );
+#       else
+        m_mutex->lock();
+#       endif
+    }
+
+    void unlock() const
+    {
+        m_mutex->unlock();
+    }
+
+    bool init_mutex()
+    {
+        bool ret = false;
+        QLOG_ASSERT( 0 == m_mutex );
+        try
+        {
+            m_mutex = new mutex();
+            ret = true;
+        } catch (...)
+        {
+            m_mutex = 0;
+            ret = false;
+        }
+
+        return ret;
+    }
+
+    void destroy_mutex()
     {
         QLOG_ASSERT( 0 != m_mutex );
         delete m_mutex;
         m_mutex = 0;
     }
-#   endif
+#   endif
+
+    /**@endcond*/
+
+    /**@brief Conditional logging
+     * @param[in] _cond Pass true to enable logging
+     * @return A disabled logger if true has been passed, an enabled logger otherwise */
+    logger operator()( bool _cond )
+    {
+        logger ret( *this );
+        ret.m_disabled.store_relaxed( !_cond );
+        return ret;
+    }
+
+    /**@brief Disables logging (no further message will be output)
+     * @throw nothing */
+    void disable() { m_disabled.store( true ); }
+
+    /**@brief Resumes logging */
+    void enable() { m_disabled.store( false ); }
+
+private:
+    atomic_integer<unsigned> m_disabled; ///< Read without locking by every logging thread
+    static sink_list m_sinks;
+    static ostream_sink m_stream_sink; ///< What set_output( std::ostream & ) adds to m_sinks
+    static decorater<level, false> m_prepend;
+    static decorater<level, true> m_append;
+#   ifdef QLOG_MULTITHREAD
+    static mutex * m_mutex;
+#   endif
+#   ifdef QLOG_STATS
+    static stats_counters m_stats[QLOG_STATS_STRIPES];
+#   endif
+
+private:
+    /**@brief Helper function to check that the logger can output messages
+     * @cond GENERATE_INTERNAL_DOCUMENTATION
+     * @throw nothing
+     * @private */
+    bool can_log() const
+    {
+        return ( level >= get_loglevel() ) && !m_sinks.empty() && !isDisabled();
+    }
+
+    /**@brief Called before the first part of a message is written
+     * @private */
+    void start_record( record_state & _record ) const
+    {
+        const sink_list & sinks = sinks_of( _record );
+        _record.m_stream.buffer().clear();
+        _record.m_pairs = 0;
+        _record.m_binary = sinks.binary();
+        _record.m_colored = sinks.colored();
+#       ifdef QLOG_ASYNC
+        _record.m_binary = _record.m_binary || ( settings::backend && settings::deferred_formatting );
+#       endif
+        if( _record.m_traced )
+        {
+            // formatted if it is ever written
+            _record.m_binary = true;
+            _record.m_colored = false;
+        }
+        if( _record.m_binary )
+        {
+            record_header header;
+            header.m_size = 0;
+            header.m_level = level;
+            current_time( header.m_seconds, header.m_nanoseconds );
+            header.m_thread = cached_thread_id( _record.m_cache );
+            _record.m_stream.buffer().append( &header, sizeof( record_header ) );
+
+            if( !( format_state::of( _record.m_stream ) == format_state::initial() ) )
+                capture_format( _record.m_stream );
+        }
+        decorate( m_prepend, _record );
+    }
+
+    /**@brief Writes a part of a message
+     * @private */
+    template< typename T >
+    static void write( record_state & _record, const T & _message )
+    {
+        if( _record.m_binary )
+        {
+            capture( _record.m_stream, _message );
+            return;
+        }
+        format_value( _record.m_stream, _message );
+    }
+
+    /**@brief Writes what a function returns, the message being known to be written, see lazy()
+     * @private */
+    template< typename F >
+    static void write( record_state & _record, const lazy_value<F> & _value )
+    {
+        write( _record, _value.function()() );
+    }
+
+    /**@brief Writes text as it is, as a literal of the message
+     * @private */
+    static void write_text( record_state & _record, const char * _text, size_t _size )
+    {
+        if( 0 == _size )
+            return;
+
+        if( _record.m_binary )
+            capture_text( _record.m_stream.buffer(), _text, _size );
+        else
+            _record.m_stream.buffer().append( _text, _size );
+    }
+
+#   ifdef QLOG_HAS_VARIADIC_TEMPLATES
+    /**@brief Writes the text of a format up to its next {}
+     * @return What follows the {}, or 0 if there is none
+     * @private */
+    static const char * write_literal( record_state & _record, const char * _format )
+    {
+        const char * start = _format;
+        for( ; *_format; ++_format )
+        {
+            const bool escaped = ( '{' == _format[0] || '}' == _format[0] ) && _format[0] == _format[1];
+            const bool placeholder = ( '{' == _format[0] && '}' == _format[1] );
+            if( !escaped && !placeholder )
+                continue;
+
+            // the first brace of an escaped pair is kept, the second one skipped
+            write_text( _record, start, static_cast<size_t>( _format - start ) + ( escaped ? 1 : 0 ) );
+            start = _format + 2;
+            if( placeholder )
+                return start;
+            ++_format;
+        }
+
+        write_text( _record, start, static_cast<size_t>( _format - start ) );
+        return 0;
+    }
+
+    static void write_format( record_state & _record, const char * _format )
+    {
+        // the {} left without an argument are written as they are, with the text around them
+        while( _format && 0 != ( _format = write_literal( _record, _format ) ) )
+            write_text( _record, "{}", 2 );
+    }
+
+    template< typename T, typename... Args >
+    static void write_format( record_state & _record, const char * _format, const T & _first, const Args &... _rest )
+    {
+        // the arguments left without a {} are dropped
+        const char * const next = _format ? write_literal( _record, _format ) : 0;
+        if( next )
+            write( _record, _first );
+        write_format( _record, next, _rest... );
+    }
+#   endif
+
+    /**@brief Writes the decorations, as text even in a binary record
+     * @private */
+    template< bool append >
+    static void decorate( decorater<level, append> & _decorations, record_state & _record )
+    {
+        if( _record.m_binary )
+        {
+            if( _decorations.empty() )
+                return;
+
+            const size_t start = begin_text( _record.m_stream.buffer() );
+            _decorations.apply_all( _record );
+            end_text( _record.m_stream.buffer(), start );
+            return;
+        }
+        _decorations.apply_all( _record );
+    }
+
+    /**@brief Writes a finished message to the output, or hands it to the writer thread
+     * @private */
+    void commit( record_state & _state ) const
+    {
+        sink_list & sinks = sinks_of( _state );
+        record_buffer & _record = _state.m_stream.buffer();
+        if( _state.m_binary && _record.size() >= sizeof( record_header ) )
+        {
+            const unsigned size = static_cast<unsigned>( _record.size() );
+            _record.overwrite( 0, &size, sizeof( unsigned ) );
+        }
+
+        if( _state.m_traced )
+        {
+            _state.backtrace().push( _record.data(), _record.size(), settings::backtrace_generation, settings::backtrace_records );
+            _record.clear();
+            return;
+        }
+        const bool backtrace = ( level >= settings::backtrace_trigger ) && !_state.backtrace().empty( settings::backtrace_generation );
+
+#       ifdef QLOG_ASYNC
+        if( settings::backend )
+        {
+            if( backtrace )
+                write_backtrace( sinks, _state );
+            if( ( _record.size() || _record.flush_requested() )
+                && settings::backend->push( &sinks, _record.data(), _record.size(), level, _record.flush_requested(), _state.m_binary ) )
+                count_emitted( _record.size() );
+            _record.clear();
+            return;
+        }
+#       endif
+
+#       ifdef QLOG_MULTITHREAD
+        // the outputs of a module are shared by every level: they have a lock of their own
+        mutex * const module_mutex = ( &sinks != &m_sinks ) ? _state.m_module->m_mutex : 0;
+        if( module_mutex )
+            module_mutex->lock();
+        else
+            lock();
+#       endif
+        if( backtrace )
+            write_backtrace( sinks, _state );
+        sinks.write_messages( _record.data(), _record.size(), _record.flush_requested(), level, _state.m_binary );
+#       ifdef QLOG_MULTITHREAD
+        if( module_mutex )
+            module_mutex->unlock();
+        else
+            unlock();
+#       endif
+        count_emitted( _record.size() );
+        _record.clear();
+    }
+
+    /**@brief Writes the messages the thread kept in its backtrace ring, before the one they explain
+     * @private */
+    void write_backtrace( sink_list & _sinks, record_state & _state ) const
+    {
+        record_buffer context;
+        if( !_state.backtrace().take( context, settings::backtrace_generation ) )
+            return;
+
+#       ifdef QLOG_ASYNC
+        if( settings::backend )
+        {
+            // a record each, as a message too big for the ring would be cut
+            for( size_t position = 0; context.size() - position >= sizeof( record_header ); )
+            {
+                unsigned size = 0;
+                std::memcpy( &size, context.data() + position, sizeof( size ) );
+                settings::backend->push( &_sinks, context.data() + position, size, level, false, true );
+                position += size;
+            }
+            return;
+        }
+#       endif
+        _sinks.write_messages( context.data(), context.size(), false, level, true );
+    }
+
+    /**@brief Where a message goes: the outputs of its module, if it has some, or the logger's
+     * @private */
+    sink_list & sinks_of( const record_state & _record ) const
+    {
+        if( _record.m_module && _record.m_module->m_route )
+            return *_record.m_module->m_route;
+        return m_sinks;
+    }
+
+#   ifdef QLOG_STATS
+    static void count_emitted( size_t _size )
+    {
+        const unsigned stripe = stats_stripe();
+        stats_counters & mine = m_stats[stripe % QLOG_STATS_STRIPES];
+        stats_add( mine.m_emitted, 1 );
+        stats_add( mine.m_bytes, _size );
+    }
+#   else
+    static void count_emitted( size_t ) { }
+#   endif
+
+    /** @endcond */
+};
+// -------------------------------------------------------------------------- //
+
+#ifdef QLOG_MULTITHREAD
+template< unsigned level >
+mutex * logger<level>::m_mutex = 0;
+#endif
+
+template< unsigned level >
+sink_list logger<level>::m_sinks;
+
+#ifdef QLOG_STATS
+template< unsigned level >
+stats_counters logger<level>::m_stats[QLOG_STATS_STRIPES];
+#endif
+
+template< unsigned level >
+ostream_sink logger<level>::m_stream_sink;
+
+
+template< unsigned level >
+decorater<level, true> logger<level>::m_append;
+
+template< unsigned level >
+decorater<level, false> logger<level>::m_prepend;
+
+// -------------------------------------------------------------------------- //
+/**@struct receiver
+ * @cond GENERATE_INTERNAL_DOCUMENTATION
+ * @brief A light-weight structure that receives a stream.
+ *
+ * The purpose of receiver is to detect when a series of operator<< ends.
+ * Let’s consider this example:
+ * logger << "value = " << value;
+ *
+ * I want to append a custom text so that the written message
+ * looks something like "[..] value = 35\n", which means that I have to add
+ * "\n" at some point. receiver is a helper structure that will let us know
+ * about that.
+ *
+ * When logger << "value = " is first proceeded, it calls
+ * operator<<( const logger &, std::string & ), which returns a temporary receiver
+ * object.
+ *
+ * Then the second part of the message is treated: "<< value". This time, the
+ * function operator << (const receiver &, int) is called. It treats the value
+ * and returns the same receiver, by reference.
+ *
+ * The temporary receiver dies at the end of the statement. Its destructor
+ * informs the logger object that a custom text should be appended and the
+ * message written. Copying a receiver hands the message over to the copy, as
+ * std::auto_ptr does, so that only one receiver ends it: nothing is counted
+ * and nothing is copied for each argument.
+ */
+template< unsigned level >
+struct receiver
+{
+    /**@brief Starts a message
+     *
+     * Whether the message is output is decided here, once: a filtered message
+     * never touches the per-thread state nor any lock. */
+    explicit
+    receiver( const logger<level> * _logger, bool _muted = false )
+        :m_logger( _logger )
+        ,m_muted( _muted || !_logger->enabled() )
+        ,m_record( 0 )
+    {
+        QLOG_ASSERT( 0 != _logger );
+        const bool traced = m_muted && !_muted && _logger->traced();
+        start( traced );
+    }
+
+    /**@brief Starts a message logged through a module, whose threshold and outputs it uses */
+    receiver( const logger<level> * _logger, const module_node & _module )
+        :m_logger( _logger )
+        ,m_muted( !_logger->enabled( _module ) )
+        ,m_record( 0 )
+    {
+        QLOG_ASSERT( 0 != _logger );
+        const bool traced = m_muted && _logger->traced( _module.m_threshold.load_relaxed() );
+        if( start( traced ) )
+            m_record->m_module = &_module;
+    }
+
+    /**@brief Takes the message over: the copied receiver will not end it */
+    receiver( const receiver & _copy )
+        :m_logger( _copy.m_logger )
+        ,m_muted( _copy.m_muted )
+        ,m_record( _copy.m_record )
+    {
+        _copy.m_record = 0;
+    }
+
+    ~receiver()
+    {
+        QLOG_ASSERT( 0 != m_logger);
+        if( m_record )
+        {
+            QLOG_ASSERT( m_record->m_receivers );
+            --m_record->m_receivers;
+            if( !m_muted )
+                m_logger->signal_end( *m_record );
+        }
+    }
+
+    bool is_muted() const { return m_muted; }
+    void signal( standard_endline _func, bool _first_part = false ) const
+    {
+        if( !is_muted() )
+        {
+            m_logger->signal( _func, _first_part, *m_record );
+        }
+    }
+
+    template< typename T >
+    const receiver & treat( const T & _message, bool _first_part ) const
+    {
+        if( !m_muted )
+            m_logger->treat( _message, _first_part, *m_record );
+
+        return *this;
+    }
+
+    /**@brief Adds a key-value pair to the message, see logger::kv() */
+    template< typename T >
+    const receiver & kv( const char * _key, const T & _value, bool _first_part = false ) const
+    {
+        if( !m_muted )
+            m_logger->key_value( _key, _value, _first_part, *m_record );
+
+        return *this;
+    }
+
+    /**@brief Adds the escape sequence of a color to the message, see logger::escape() */
+    const receiver & escape( const char * _text, size_t _size, bool _first_part = false ) const
+    {
+        if( !m_muted )
+            m_logger->escape( _text, _size, _first_part, *m_record );
+
+        return *this;
+    }
+
+    /**@brief Starts the message, knowing where it comes from */
+    const receiver & locate( const location & _location ) const
+    {
+        if( !m_muted )
+        {
+            m_record->m_location = _location;
+            m_logger->signal_start( *m_record );
+        }
+
+        return *this;
+    }
+
+private:
+    receiver operator=( const receiver & );
+
+    /**@brief Takes the record_state of the thread, unless the message is filtered out
+     * @param[in] _traced Whether the message is filtered out but goes to the backtrace ring
+     * @return Whether the message is assembled */
+    bool start( bool _traced )
+    {
+        if( !m_muted || _traced )
+            m_record = records::acquire();
+
+        if( !m_record )
+        {
+            m_muted = true;
+            return false;
+        }
+
+        ++m_record->m_receivers;
+        m_record->m_traced = _traced;
+        m_muted = false;
+        return true;
+    }
+
+private:
+    const logger<level> * m_logger;
+    mutable bool m_muted;
+    mutable record_state * m_record; ///< Where the calling thread assembles the message, 0 once handed over
+};
+
+// -------------------------------------------------------------------------- //
+/**@struct null_receiver
+ * @brief What loggers below QLOG_MIN_LEVEL return: it swallows everything.
+ *
+ * All its functions are empty and inline, so that a message sent to a
+ * logger that was compiled out costs nothing but the evaluation of its
+ * arguments (and not even that when using the QLOG_DEBUG family of macros).
+ */
+struct null_receiver
+{
+    explicit
+    null_receiver( const void * )
+    {
+    }
+
+    null_receiver( const void *, const module_node & )
+    {
+    }
+
+    template< typename T >
+    const null_receiver & treat( const T &, bool ) const { return *this; }
+
+    void signal( standard_endline, bool = false ) const { }
+
+    const null_receiver & locate( const location & ) const { return *this; }
+
+    template< typename T >
+    const null_receiver & kv( const char *, const T &, bool = false ) const { return *this; }
+
+    const null_receiver & escape( const char *, size_t, bool = false ) const { return *this; }
+
+    template< typename T >
+    const null_receiver & operator<<( const T & ) const { return *this; }
+
+    const null_receiver & operator<<( standard_endline ) const { return *this; }
+};
+
+/**@struct level_stream
+ * @brief Selects what operator<< returns for a given level: receiver<level>,
+ *        or null_receiver when the level is below QLOG_MIN_LEVEL. */
+template< unsigned level, bool compiled_in >
+struct level_stream
+{
+    typedef receiver<level> type;
+    static const bool compiled = true;
+};
+
+template< unsigned level >
+struct level_stream<level, false>
+{
+    typedef null_receiver type;
+    static const bool compiled = false;
+};
+
+// -------------------------------------------------------------------------- //
+template< unsigned level,typename T > inline
+const receiver<level> & operator<<( const receiver<level> & _receiver,  const T & _message )
+{
+    return _receiver.treat( _message, false );
+}
+
+// -------------------------------------------------------------------------- //
+template< unsigned level > inline
+typename level_stream<level>::type operator<<( const logger<level> & _logger, const location & _location )
+{
+    return typename level_stream<level>::type( &_logger ).locate( _location );
+}
+
+// -------------------------------------------------------------------------- //
+template< unsigned level > inline
+const receiver<level> & operator<<( const receiver<level> & _recv, standard_endline _func )
+{
+    _recv.signal( _func );
+    return _recv;
+}
+
+// -------------------------------------------------------------------------- //
+template< unsigned level, typename T > inline
+typename level_stream<level>::type operator << ( const logger<level> & _logger, const T & _message )
+{
+    return typename level_stream<level>::type( &_logger ).treat( _message, true );
+}
+
+// -------------------------------------------------------------------------- //
+template< unsigned level > inline
+typename level_stream<level>::type operator<<( const logger<level> & _logger, standard_endline _func )
+{
+    const typename level_stream<level>::type recv( &_logger );
+    recv.signal( _func, true );
+    return recv;
+}
+/** @endcond */
+// -------------------------------------------------------------------------- //
+
+/**@struct module_site
+ * @cond GENERATE_INTERNAL_DOCUMENTATION
+ * @brief A module and where a message is logged from, see module::at() */
+struct module_site
+{
+    module_site( const module_node & _module, const location & _location )
+        :m_module( &_module )
+        ,m_location( _location )
+    {
+    }
 
-    /**@endcond*/
+    const module_node * m_module;
+    location m_location;
+};
+/** @endcond */
 
-    /**@brief Conditional logging
-     * @param[in] _cond Pass true to enable logging
-     * @return A disabled logger if true has been passed, an enabled logger otherwise */
-    logger operator()( bool _cond )
+// -------------------------------------------------------------------------- //
+/**@struct module
+ * @brief A named part of the program, with a level and outputs of its own
+ *
+ * Modules are named with dots, the parent first: "net.http" is a child of
+ * "net", which is registered along with it. A module without a level of its
+ * own follows the level of its nearest parent that has one, or else the
+ * global level. A module without outputs writes to the outputs of its
+ * nearest parent that has some, or else to the outputs of the logger.
+ *
+ * The name is only looked up when the handle is constructed, so keep the
+ * handle around. Checking a message is then a single comparison with the
+ * threshold of the module, computed again whenever a level changes.
+ *
+ * @code{.cpp}
+ * static qlog::module http( "net.http" );
+ * http.set_level( qlog::loglevel::debug );
+ *
+ * QLOG_MODULE( http, qlog::debug ) << "request " << id;
+ * qlog::warning << http << "without the location";
+ * @endcode
+ *
+ * The levels can be changed while other threads log, but not by two threads
+ * at once. Like set_output(), the outputs must not be changed while other
+ * threads log. The handles of the modules that cannot be registered, for
+ * lack of memory, follow the global level and the outputs of the loggers.
+ */
+struct module
+{
+    /**@brief Finds a module, registering it and its parents the first time
+     * @param[in] _name The name of the module, such as "net.http"
+     * @throw nothing */
+    explicit
+    module( const char * _name )
+        :m_node( modules::get( _name, std::strlen( _name ) ) )
     {
-        logger ret( *this );
-        ret.m_disabled = !_cond;
+        if( !m_node )
+            m_node = &modules::m_unregistered;
+    }
+
+    const char * name() const
+    {
+        return m_node->m_name;
+    }
+
+    /**@brief Sets the level of the module and of the children that have none
+     * @param[in] _level The lowest level output, loglevel::disabled to output nothing */
+    void set_level( unsigned _level )
+    {
+        if( &modules::m_unregistered == m_node )
+            return;
+
+        m_node->m_level.store_relaxed( _level );
+        modules::update();
+    }
+
+    /**@brief Makes the module follow the level of its parent again */
+    void reset_level()
+    {
+        set_level( 0 );
+    }
+
+    /**@brief The level in effect for the module, its own or an inherited one */
+    unsigned get_level() const
+    {
+        return m_node->m_threshold.load_relaxed();
+    }
+
+    /**@brief Checks whether a message of a logger would be output through the module
+     * @see QLOG_MODULE */
+    template< unsigned level >
+    bool enabled( const logger<level> & _logger ) const
+    {
+        return _logger.enabled( *m_node );
+    }
+
+    /**@brief Checks whether a message of a logger would be output through the module, or kept in
+     *        the backtrace ring, see set_backtrace()
+     * @see QLOG_MODULE */
+    template< unsigned level >
+    bool recorded( const logger<level> & _logger ) const
+    {
+        return _logger.enabled( *m_node ) || _logger.traced( m_node->m_threshold.load_relaxed() );
+    }
+
+    /**@brief Makes the messages of every level go to a sink, instead of the logger's
+     * @return false if memory cannot be obtained */
+    bool set_output( sink & _sink )
+    {
+        if( !make_sinks() )
+            return false;
+
+        m_node->m_sinks->clear();
+        return add_output( _sink );
+    }
+
+    /**@brief Writes the messages of the module to one more sink
+     * @return false if memory cannot be obtained, or if the module already writes to QLOG_MAX_SINKS sinks */
+    bool add_output( sink & _sink )
+    {
+        if( !make_sinks() )
+            return false;
+
+        const bool ret = m_node->m_sinks->add( _sink );
+        routes_changed();
         return ret;
     }
 
-    /**@brief Disables logging (no further message will be output)
-     * @throw nothing */
-    void disable() { m_disabled = true; }
+    /**@brief Stops writing to a sink: without outputs, the module writes to its parent's */
+    void remove_output( sink & _sink )
+    {
+        if( m_node->m_sinks )
+            m_node->m_sinks->remove( _sink );
+        routes_changed();
+    }
 
-    /**@brief Resumes logging */
-    void enable() { m_disabled = false; }
+    /**@brief Makes the module write to the outputs of its parent again */
+    void reset_outputs()
+    {
+        if( m_node->m_sinks )
+            m_node->m_sinks->clear();
+        routes_changed();
+    }
 
-private:
-    bool m_disabled;
-    mutable unsigned m_nbReceivers;
-    static std::ostream * m_output;
-    static decorater<level, false> m_prepend;
-    static decorater<level, true> m_append;
-#   ifdef QLOG_MULTITHREAD
-    static mutex * m_mutex;
-#   endif
+    /**@brief Tells a message its module and where it is logged from: @code qlog::info << http.at( QLOG_HERE ) << "text"; @endcode */
+    module_site at( const location & _location ) const
+    {
+        return module_site( *m_node, _location );
+    }
 
-private:
-    /**@brief Helper function to check that the logger can output messages
-     * @cond GENERATE_INTERNAL_DOCUMENTATION
-     * @throw nothing
-     * @private */
-    bool can_log() const
+    /**@private */
+    const module_node & node() const
     {
-        return ( level >= get_loglevel() ) && m_output && !isDisabled();
+        return *m_node;
     }
 
-    /**@brief Informs the logger that the last message was treated and that custom text can be appended
-     * @private */
-    void signal_end() const
+private:
+    bool make_sinks()
     {
-        QLOG_ASSERT( 0 == m_nbReceivers );
+        if( &modules::m_unregistered == m_node )
+            return false;
+        if( m_node->m_sinks )
+            return true;
+
+        try
+        {
+            m_node->m_sinks = new sink_list();
+#           ifdef QLOG_MULTITHREAD
+            m_node->m_mutex = new mutex();
+#           endif
+        }
+        catch( ... )
+        {
+            delete m_node->m_sinks;
+            m_node->m_sinks = 0;
+            return false;
+        }
+        return true;
+    }
 
-        if( can_log() )
-            m_append.apply_all( *m_output );
+    void routes_changed()
+    {
+        m_node->m_routed = m_node->m_sinks && !m_node->m_sinks->empty();
+        modules::update();
     }
-    /** @endcond */
+
+    module_node * m_node;
 };
+
+/**@cond GENERATE_INTERNAL_DOCUMENTATION */
+template< unsigned level > inline
+typename level_stream<level>::type operator<<( const logger<level> & _logger, const module & _module )
+{
+    return typename level_stream<level>::type( &_logger, _module.node() ).locate( location( 0, 0 ) );
+}
+
+template< unsigned level > inline
+typename level_stream<level>::type operator<<( const logger<level> & _logger, const module_site & _site )
+{
+    return typename level_stream<level>::type( &_logger, *_site.m_module ).locate( _site.m_location );
+}
+
+/**@brief Flushes the outputs of the modules, see qlog::flush() */
+inline
+void flush_modules()
+{
+    for( const module_node * node = modules::first(); node; node = node->m_next )
+    {
+        if( !node->m_routed )
+            continue;
+
+#       ifdef QLOG_MULTITHREAD
+        if( node->m_mutex )
+            node->m_mutex->lock();
+#       endif
+        node->m_sinks->flush();
+#       ifdef QLOG_MULTITHREAD
+        if( node->m_mutex )
+            node->m_mutex->unlock();
+#       endif
+    }
+}
+/** @endcond */
 // -------------------------------------------------------------------------- //
 
-#ifdef QLOG_MULTITHREAD
-template< unsigned level >
-mutex * logger<level>::m_mutex = 0;
+#ifndef QLOG_NAME_LOGGER_DEBUG
+#   define QLOG_NAME_LOGGER_DEBUG debug
+#endif
+#ifndef QLOG_NAME_LOGGER_TRACE
+#   define QLOG_NAME_LOGGER_TRACE trace
+#endif
+#ifndef QLOG_NAME_LOGGER_INFO
+#   define QLOG_NAME_LOGGER_INFO info
+#endif
+#ifndef QLOG_NAME_LOGGER_WARNING
+#   define QLOG_NAME_LOGGER_WARNING warning
+#endif
+#ifndef QLOG_NAME_LOGGER_ERROR
+#   define QLOG_NAME_LOGGER_ERROR error
 #endif
 
-template< unsigned level >
-std::ostream * logger<level>::m_output = 0;
+/**@def QLOG_EXTERN_LOGGERS
+ * @brief Makes the 5 loggers extern: a single compile unit defines them, by
+ *        defining QLOG_DEFINE_LOGGERS as well before including qlog.hpp
+ *
+ * By default, each compile unit has loggers of its own, sharing their
+ * outputs and decorations but each of them constructed, enabled and
+ * destroyed on its own. In C++17 the loggers are inline variables, of
+ * which there is a single instance already, unless QLOG_STATIC_LOGGERS is
+ * defined. Either way, the free functions such as set_output() and init()
+ * are then inline rather than static. */
+#if defined QLOG_EXTERN_LOGGERS && !defined QLOG_DEFINE_LOGGERS
+#   define QLOG_LOGGER extern
+#elif defined QLOG_EXTERN_LOGGERS
+#   define QLOG_LOGGER
+#elif defined QLOG_SINGLE_INSTANCE
+#   define QLOG_LOGGER inline
+#else
+#   define QLOG_LOGGER static
+#endif
 
-template< unsigned level >
-decorater<level, true> logger<level>::m_append;
+QLOG_LOGGER logger<loglevel::debug> QLOG_NAME_LOGGER_DEBUG ;
+QLOG_LOGGER logger<loglevel::trace> QLOG_NAME_LOGGER_TRACE ;
+QLOG_LOGGER logger<loglevel::info> QLOG_NAME_LOGGER_INFO ;
+QLOG_LOGGER logger<loglevel::warning> QLOG_NAME_LOGGER_WARNING ;
+QLOG_LOGGER logger<loglevel::error> QLOG_NAME_LOGGER_ERROR ;
 
-template< unsigned level >
-decorater<level, false> logger<level>::m_prepend;
+/**@brief Logs with _logger, not even evaluating the message if it would not be written
+ *
+ * @code{.cpp}
+ * QLOG_LOG( qlog::debug ) << "state: " << expensive_dump() << std::endl;
+ * QLOG_DEBUG << "same thing, for the default debug logger" << std::endl;
+ * @endcode
+ */
+#define QLOG_LOG( _logger ) if( !( _logger ).recorded() ) {} else ( _logger ) << QLOG_HERE
 
-// -------------------------------------------------------------------------- //
-/**@struct receiver
- * @cond GENERATE_INTERNAL_DOCUMENTATION
- * @brief A light-weight structure that receives a stream.
+/**@brief Logs with _logger if a condition holds, which is only evaluated if the message would be written
  *
- * The purpose of receiver is to detect when a series of operator<< ends.
- * Let’s consider this example:
- * logger << "value = " << value;
+ * Unlike qlog::debug( condition ), neither the condition nor the message is
+ * evaluated when the logger is filtered out.
  *
- * I want to append a custom text so that the written message
- * looks something like "[..] value = 35\n", which means that I have to add
- * "\n" at some point. receiver is a helper structure that will let us know
- * about that.
+ * @code{.cpp}
+ * QLOG_LOG_IF( qlog::debug, cache.size() > 1000 ) << "cache: " << cache.dump() << std::endl;
+ * @endcode
+ */
+#define QLOG_LOG_IF( _logger, _condition ) if( !( _logger ).recorded() || !( _condition ) ) {} else ( _logger ) << QLOG_HERE
+
+/**@brief Logs with _logger through a module, with the level and the outputs of the module
  *
- * When logger << "value = " is first proceeded, it calls
- * operator<<( const logger &, std::string & ), which returns a temporary receiver
- * object.
+ * @code{.cpp}
+ * static qlog::module http( "net.http" );
+ * QLOG_MODULE( http, qlog::debug ) << "headers: " << dump( headers );
+ * @endcode
+ * @see module */
+#define QLOG_MODULE( _module, _logger ) if( !( _module ).recorded( _logger ) ) {} else ( _logger ) << ( _module ).at( QLOG_HERE )
+
+#ifdef QLOG_HAS_VARIADIC_TEMPLATES
+/**@brief The number of {} of a format, {{ and }} excepted
+ * @cond GENERATE_INTERNAL_DOCUMENTATION */
+constexpr unsigned count_placeholders( const char * _format, unsigned _count = 0 )
+{
+    return !*_format ? _count
+        : ( '{' == _format[0] && '}' == _format[1] ) ? count_placeholders( _format + 2, _count + 1 )
+        : ( ( '{' == _format[0] || '}' == _format[0] ) && _format[0] == _format[1] ) ? count_placeholders( _format + 2, _count )
+        : count_placeholders( _format + 1, _count );
+}
+
+template< typename... Args >
+struct argument_list
+{
+    static const unsigned size = sizeof...( Args );
+};
+
+/**@brief Only used with decltype, to count the arguments of QLOG_LOGF */
+template< typename... Args >
+argument_list<Args...> list_arguments( const Args &... );
+/**@endcond */
+
+#   ifdef QLOG_NAMESPACE
+#       define QLOG_COUNT_ARGUMENTS( ... ) decltype( ::QLOG_NAMESPACE::list_arguments( __VA_ARGS__ ) )::size
+#       define QLOG_COUNT_PLACEHOLDERS ::QLOG_NAMESPACE::count_placeholders
+#   else
+#       define QLOG_COUNT_ARGUMENTS( ... ) decltype( ::qlog::list_arguments( __VA_ARGS__ ) )::size
+#       define QLOG_COUNT_PLACEHOLDERS ::qlog::count_placeholders
+#   endif
+
+/**@brief Calls logger::log(), once the format is known to match its arguments
  *
- * Then the second part of the message is treated: "<< value". This time, the
- * function operator << (const receiver &, int) is called. It treated the value
- * and returns a new temporary receiver.
+ * The format must be a string literal with at least one {}, and the
+ * arguments are not evaluated if the message would not be written.
  *
- * As there is no other message to treat, this last temporary receiver dies.
- * Its destructor inform the logger object that a custom text should be appended.
- * The logger object is not called from the destructor if any operator<< has been
- * called on the temporary receiver.
+ * @code{.cpp}
+ * QLOG_LOGF( qlog::info, "x={} y={}\n", x, y );
+ * @endcode
  */
-template< unsigned level >
-struct receiver
+#   define QLOG_LOGF( _logger, _format, ... ) \
+    do \
+    { \
+        static_assert( QLOG_COUNT_PLACEHOLDERS( _format ) == QLOG_COUNT_ARGUMENTS( __VA_ARGS__ ), \
+                       "the number of {} does not match the number of arguments" ); \
+        if( ( _logger ).enabled() ) \
+            ( _logger ).log( QLOG_HERE, _format, __VA_ARGS__ ); \
+    } while( 0 )
+#endif
+
+// -------------------------------------------------------------------------- //
+/**@struct call_site
+ * @brief The counters of a QLOG_EVERY_N, QLOG_SAMPLED or QLOG_RATE_LIMITED call site
+ *
+ * Each call site has its own static instance, which, being an aggregate of
+ * atomics, is initialized before any code runs. Deciding whether a message
+ * is written is one relaxed increment and a comparison; the rate limiter also
+ * reads the monotonic clock.
+ */
+struct call_site
 {
-    explicit
-    receiver( const logger<level> * _logger, bool _muted = false )
-        :m_logger( _logger )
-        ,m_muted( _muted )
+    /**@brief Whether this call is one of every _n calls, the first one included */
+    bool every( unsigned _n )
     {
-        QLOG_ASSERT( 0 != _logger );
-        _logger->signal_creation();
+        QLOG_ASSERT( _n > 0 );
+        return 0 == m_count.fetch_add_relaxed( 1 ) % _n;
     }
 
-    receiver( const receiver & _copy )
-        :m_logger( _copy.m_logger )
-        ,m_muted( _copy.m_muted )
+    /**@brief Whether this call is sampled, with a given probability between 0 and 1 */
+    bool sample( double _probability )
+    {
+        // the counter goes through a bijective mix, which spreads the chosen calls evenly
+        unsigned long x = m_count.fetch_add_relaxed( 1 ) * 0x9E3779B9UL & 0xFFFFFFFFUL;
+        x = ( ( x ^ ( x >> 16 ) ) * 0x85EBCA6BUL ) & 0xFFFFFFFFUL;
+        x = ( ( x ^ ( x >> 13 ) ) * 0xC2B2AE35UL ) & 0xFFFFFFFFUL;
+        x ^= x >> 16;
+        return static_cast<double>( x ) < _probability * 4294967296.0;
+    }
+
+    /**@brief Whether fewer than _per_second calls were allowed during the current second
+     *
+     * The calls that are refused are counted, see suppressed(). */
+    bool allow( unsigned _per_second )
+    {
+        // 0 is never a window, so that the first call opens one
+        const unsigned now = static_cast<unsigned>( monotonic_milliseconds() / 1000 ) | ( 1U << 31 );
+        unsigned window = m_window.load_relaxed();
+        if( window != now && m_window.compare_exchange( window, now ) )
+            m_count.store_relaxed( 0 );
+
+        if( m_count.fetch_add_relaxed( 1 ) < _per_second )
+            return true;
+
+        m_suppressed.fetch_add_relaxed( 1 );
+        return false;
+    }
+
+    /**@brief The number of calls refused by allow() since it was last asked, which is reset */
+    unsigned suppressed()
     {
-        m_logger->signal_creation();
+        unsigned count = m_suppressed.load_relaxed();
+        while( count && !m_suppressed.compare_exchange( count, 0 ) )
+        {
+        }
+        return count;
     }
 
-    ~receiver()
-    {
-        QLOG_ASSERT( 0 != m_logger);
-        m_logger->signal_destruction();
-    }
+    atomic_integer<unsigned> m_count;
+    atomic_integer<unsigned> m_window; ///< The second during which m_count was counted
+    atomic_integer<unsigned> m_suppressed;
+};
+
+/**@brief Logs how many messages a rate-limited call site dropped, if any
+ * @cond GENERATE_INTERNAL_DOCUMENTATION
+ * @return _logger, for the message that was allowed
+ * @see QLOG_RATE_LIMITED */
+template< unsigned level > inline
+const logger<level> & report_suppressed( const logger<level> & _logger, call_site & _site, const location & _location )
+{
+    const unsigned suppressed = _site.suppressed();
+    if( suppressed )
+        _logger << _location << "suppressed " << suppressed << " messages" << std::endl;
+    return _logger;
+}
+/**@endcond */
+
+#define QLOG_CONCATENATE_( _a, _b ) _a ## _b
+#define QLOG_CONCATENATE( _a, _b ) QLOG_CONCATENATE_( _a, _b )
+#define QLOG_SITE QLOG_CONCATENATE( qlog_call_site_, __LINE__ )
+
+#ifdef QLOG_NAMESPACE
+#   define QLOG_CALL_SITE static ::QLOG_NAMESPACE::call_site QLOG_SITE = { { 0 }, { 0 }, { 0 } }
+#   define QLOG_REPORT_SUPPRESSED ::QLOG_NAMESPACE::report_suppressed
+#else
+#   define QLOG_CALL_SITE static ::qlog::call_site QLOG_SITE = { { 0 }, { 0 }, { 0 } }
+#   define QLOG_REPORT_SUPPRESSED ::qlog::report_suppressed
+#endif
+
+/**@brief Like QLOG_LOG, but only writes one message out of _n from this line
+ *
+ * The messages that would be filtered out anyway are not counted. As it
+ * declares the counter of the call site, the macro must be a statement of
+ * its own: it cannot be the body of an @c if without braces, and two of them
+ * cannot share a line.
+ *
+ * @code{.cpp}
+ * QLOG_EVERY_N( qlog::warning, 1000 ) << "queue full" << std::endl;
+ * @endcode
+ */
+#define QLOG_EVERY_N( _logger, _n ) \
+    QLOG_CALL_SITE; \
+    if( !( _logger ).enabled() || !QLOG_SITE.every( _n ) ) {} else ( _logger ) << QLOG_HERE
+
+/**@brief Like QLOG_EVERY_N, but writes each message with a probability between 0 and 1 */
+#define QLOG_SAMPLED( _logger, _probability ) \
+    QLOG_CALL_SITE; \
+    if( !( _logger ).enabled() || !QLOG_SITE.sample( _probability ) ) {} else ( _logger ) << QLOG_HERE
+
+/**@brief Like QLOG_EVERY_N, but writes at most _per_second messages from this line each second
+ *
+ * The next message written once the limit is lifted is preceded by one
+ * saying how many were suppressed.
+ *
+ * @code{.cpp}
+ * QLOG_RATE_LIMITED( qlog::error, 10 ) << "cannot reach " << host << std::endl;
+ * @endcode
+ */
+#define QLOG_RATE_LIMITED( _logger, _per_second ) \
+    QLOG_CALL_SITE; \
+    if( !( _logger ).enabled() || !QLOG_SITE.allow( _per_second ) ) {} \
+    else QLOG_REPORT_SUPPRESSED( _logger, QLOG_SITE, QLOG_HERE ) << QLOG_HERE
+
+#ifdef QLOG_NAMESPACE
+#   define QLOG_DEBUG QLOG_LOG( ::QLOG_NAMESPACE::QLOG_NAME_LOGGER_DEBUG )
+#   define QLOG_TRACE QLOG_LOG( ::QLOG_NAMESPACE::QLOG_NAME_LOGGER_TRACE )
+#   define QLOG_INFO QLOG_LOG( ::QLOG_NAMESPACE::QLOG_NAME_LOGGER_INFO )
+#   define QLOG_WARNING QLOG_LOG( ::QLOG_NAMESPACE::QLOG_NAME_LOGGER_WARNING )
+#   define QLOG_ERROR QLOG_LOG( ::QLOG_NAMESPACE::QLOG_NAME_LOGGER_ERROR )
+#else
+#   define QLOG_DEBUG QLOG_LOG( ::qlog::QLOG_NAME_LOGGER_DEBUG )
+#   define QLOG_TRACE QLOG_LOG( ::qlog::QLOG_NAME_LOGGER_TRACE )
+#   define QLOG_INFO QLOG_LOG( ::qlog::QLOG_NAME_LOGGER_INFO )
+#   define QLOG_WARNING QLOG_LOG( ::qlog::QLOG_NAME_LOGGER_WARNING )
+#   define QLOG_ERROR QLOG_LOG( ::qlog::QLOG_NAME_LOGGER_ERROR )
+#endif
+
+/**@brief Makes every logger write to a stream
+ * @param[in] _terminal Whether the stream writes to a terminal, see logger::set_output() */
+QLOG_INLINE
+void set_output( std::ostream & _new_output, bool _terminal = false )
+{
+    QLOG_NAME_LOGGER_DEBUG . set_output( _new_output, _terminal );
+    QLOG_NAME_LOGGER_TRACE . set_output( _new_output, _terminal );
+    QLOG_NAME_LOGGER_INFO . set_output( _new_output, _terminal );
+    QLOG_NAME_LOGGER_WARNING . set_output( _new_output, _terminal );
+    QLOG_NAME_LOGGER_ERROR . set_output( _new_output, _terminal );
+}
+
+/**@brief Makes every logger write to a sink
+ * @see sink */
+QLOG_INLINE
+void set_output( sink & _new_output )
+{
+    QLOG_NAME_LOGGER_DEBUG . set_output( _new_output );
+    QLOG_NAME_LOGGER_TRACE . set_output( _new_output );
+    QLOG_NAME_LOGGER_INFO . set_output( _new_output );
+    QLOG_NAME_LOGGER_WARNING . set_output( _new_output );
+    QLOG_NAME_LOGGER_ERROR . set_output( _new_output );
+}
+
+/**@brief Adds a sink to the loggers of a sufficient level
+ * @param[in] _new_output The sink to write to, in addition to the current ones
+ * @param[in] _threshold The lowest level written to this sink
+ * @return false if one of the loggers already writes to QLOG_MAX_SINKS sinks
+ *
+ * @code{.cpp}
+ * qlog::fd_sink standard_error( 2 );
+ * qlog::set_output( logfile );                                 // everything goes to the file
+ * qlog::add_output( standard_error, qlog::loglevel::warning ); // warnings and errors to stderr too
+ * @endcode
+ */
+QLOG_INLINE
+bool add_output( sink & _new_output, unsigned _threshold = loglevel::debug )
+{
+    bool added = true;
+    if( loglevel::debug >= _threshold )
+        added = QLOG_NAME_LOGGER_DEBUG . add_output( _new_output ) && added;
+    if( loglevel::trace >= _threshold )
+        added = QLOG_NAME_LOGGER_TRACE . add_output( _new_output ) && added;
+    if( loglevel::info >= _threshold )
+        added = QLOG_NAME_LOGGER_INFO . add_output( _new_output ) && added;
+    if( loglevel::warning >= _threshold )
+        added = QLOG_NAME_LOGGER_WARNING . add_output( _new_output ) && added;
+    if( loglevel::error >= _threshold )
+        added = QLOG_NAME_LOGGER_ERROR . add_output( _new_output ) && added;
+    return added;
+}
+
+/**@brief Makes the loggers flush their sinks less often than std::endl does
+ * @param[in] _bytes Flush once that many bytes have been written since the last flush, or 0
+ * @param[in] _milliseconds Flush once the oldest message not flushed is that old, or 0
+ * @param[in] _level Flush after every message of this level or above
+ *
+ * Once this is called, std::endl only writes a new line, and the sinks are
+ * flushed when one of the conditions is met. In synchronous mode the
+ * conditions are checked when a message is written; in asynchronous mode the
+ * writer thread also checks the time while it waits for messages. flush()
+ * flushes everything anyway.
+ *
+ * @code{.cpp}
+ * qlog::set_flush_policy( 64 * 1024, 100 ); // errors are still flushed at once
+ * @endcode
+ */
+QLOG_INLINE
+void set_flush_policy( size_t _bytes, unsigned _milliseconds, unsigned _level = loglevel::error )
+{
+    settings::flush_batched = true;
+    settings::flush_bytes = _bytes;
+    settings::flush_milliseconds = _milliseconds;
+    settings::flush_level = _level;
+}
 
-    bool is_muted() const { return m_muted; }
-    void signal( standard_endline _func ) const
+/**@brief Flushes every sink
+ *
+ * In asynchronous mode, this waits until the writer thread has written and
+ * flushed every message logged so far. */
+QLOG_INLINE
+void flush()
+{
+#   ifdef QLOG_ASYNC
+    if( settings::backend )
     {
-        if( !is_muted() )
-        {
-            m_logger->signal( _func );
-        }
+        settings::backend->flush();
+        return;
     }
+#   endif
 
-    template< typename T >
-    receiver treat( const T & _message, bool _first_part ) const
-    {
-        if( !m_muted )
-            m_logger->treat( _message, _first_part );
+    QLOG_NAME_LOGGER_DEBUG . flush_outputs();
+    QLOG_NAME_LOGGER_TRACE . flush_outputs();
+    QLOG_NAME_LOGGER_INFO . flush_outputs();
+    QLOG_NAME_LOGGER_WARNING . flush_outputs();
+    QLOG_NAME_LOGGER_ERROR . flush_outputs();
+    flush_modules();
+}
 
-        return *this;
-    }
+/**@brief Chooses how logger::kv() writes its pairs
+ * @param[in] _format structured::json, the default, or structured::logfmt
+ * @warning Like set_output(), this must not be called while other threads log.
+ *
+ * In JSON, the keys and the strings are quoted and escaped, and the values
+ * that are not finite numbers are written as null. In logfmt, the values are
+ * only quoted when they hold spaces, '=', quotes or control characters. */
+QLOG_INLINE
+void set_structured_format( unsigned _format )
+{
+    QLOG_ASSERT( structured::json == _format || structured::logfmt == _format );
+    settings::structured_format = _format;
+}
 
-private:
-    receiver operator=( const receiver & );
+/**@brief Chooses which sinks are given the colors
+ * @param[in] _policy colors::automatic, the default, colors::always or colors::never
+ * @warning Like set_output(), this must not be called while other threads log.
+ *
+ * By default, the colors, underline() and blink() are only written to the
+ * sinks that are terminals, as sink::terminal() tells when the sink is added:
+ * a logger none of whose outputs is a terminal does not even write them, and
+ * the escape sequences are taken out of the text given to the other sinks of
+ * a logger that also writes to a terminal. */
+QLOG_INLINE
+void set_color_policy( unsigned _policy )
+{
+    QLOG_ASSERT( colors::automatic == _policy || colors::always == _policy || colors::never == _policy );
+    settings::color_policy = _policy;
+}
 
-private:
-    const logger<level> * m_logger;
-    mutable bool m_muted;
-};
+/**@brief Keeps the last messages filtered out by the level in memory, to write them before an error
+ * @param[in] _records How many messages each thread keeps, 0 to keep none
+ * @param[in] _lowest The lowest level of the messages kept
+ * @param[in] _trigger The level from which a message writes first what its thread kept
+ * @warning Like set_output(), this must not be called while other threads log. It is reset by destroy().
+ *
+ * The messages of a level from _lowest up but below the level of logging are
+ * captured in binary form, as for a binary_sink, in a ring of the thread
+ * that logs them, rather than thrown away. When the thread logs a message of
+ * level _trigger or above, the messages it kept are written first, to the
+ * outputs of that message, and forgotten. A thread keeps at most _records
+ * messages, in QLOG_BACKTRACE_RECORD_SIZE bytes per message, the oldest
+ * being forgotten first. A message longer than all of them is cut, and ends
+ * with " [...]".
+ *
+ * @code{.cpp}
+ * qlog::set_loglevel( qlog::loglevel::info );
+ * qlog::set_backtrace( 64 );
+ * qlog::debug << "connecting to " << host;  // kept, not written
+ * qlog::error << "connection lost";        // writes the debug message, then this one
+ * @endcode
+ *
+ * Messages sent to the QLOG_DEBUG family of macros are kept as well, but the
+ * ones below QLOG_MIN_LEVEL are not.
+ */
+QLOG_INLINE
+void set_backtrace( size_t _records = 32, unsigned _lowest = loglevel::debug, unsigned _trigger = loglevel::error )
+{
+    settings::backtrace_records = _records;
+    settings::backtrace_level = _lowest;
+    settings::backtrace_trigger = _trigger;
+    ++settings::backtrace_generation;
+}
 
-// -------------------------------------------------------------------------- //
-template< unsigned level,typename T > inline
-receiver<level> operator<<( const receiver<level> & _receiver,  const T & _message )
+/**@brief Makes std::endl flush the sinks again, which is the default */
+QLOG_INLINE
+void reset_flush_policy()
 {
-    return _receiver.treat( _message, false );
+    settings::flush_batched = false;
+    settings::flush_bytes = 0;
+    settings::flush_milliseconds = 0;
+    settings::flush_level = loglevel::disabled;
 }
 
-// -------------------------------------------------------------------------- //
-template< unsigned level > inline
-receiver<level> operator<<( const receiver<level> & _recv, standard_endline _func )
+/**@brief Makes every logger stop writing to a sink */
+QLOG_INLINE
+void remove_output( sink & _output )
 {
-    _recv.signal( _func );
-    return _recv;
+    QLOG_NAME_LOGGER_DEBUG . remove_output( _output );
+    QLOG_NAME_LOGGER_TRACE . remove_output( _output );
+    QLOG_NAME_LOGGER_INFO . remove_output( _output );
+    QLOG_NAME_LOGGER_WARNING . remove_output( _output );
+    QLOG_NAME_LOGGER_ERROR . remove_output( _output );
 }
 
-// -------------------------------------------------------------------------- //
-template< unsigned level, typename T > inline
-receiver<level> operator << ( const logger<level> & _logger, const T & _message )
+#ifdef QLOG_STATS
+/**@brief Takes a snapshot of the counters of the loggers and of the asynchronous ring
+ *
+ * The counters are only kept when QLOG_STATS is defined, and set back to 0
+ * by destroy(). Each logging thread updates a copy of its own, so the
+ * snapshot adds them up: it is cheap enough to be taken every second, but
+ * the counters of a level are not read at exactly the same time.
+ *
+ * @code{.cpp}
+ * const qlog::stats now = qlog::get_stats();
+ * metrics.gauge( "log.errors", now.m_levels[qlog::loglevel::error].m_emitted );
+ * metrics.gauge( "log.dropped", now.m_dropped );
+ * @endcode
+ */
+QLOG_INLINE
+stats get_stats()
 {
-#   ifdef QLOG_MULTITHREAD
-    _logger.lock();
+    stats snapshot;
+    std::memset( &snapshot, 0, sizeof( snapshot ) );
+    snapshot.m_levels[loglevel::debug] = QLOG_NAME_LOGGER_DEBUG . get_stats();
+    snapshot.m_levels[loglevel::trace] = QLOG_NAME_LOGGER_TRACE . get_stats();
+    snapshot.m_levels[loglevel::info] = QLOG_NAME_LOGGER_INFO . get_stats();
+    snapshot.m_levels[loglevel::warning] = QLOG_NAME_LOGGER_WARNING . get_stats();
+    snapshot.m_levels[loglevel::error] = QLOG_NAME_LOGGER_ERROR . get_stats();
+
+#   ifdef QLOG_ASYNC
+    if( settings::backend )
+    {
+        snapshot.m_queue_depth = settings::backend->depth();
+        snapshot.m_queue_high_water = settings::backend->high_water();
+        snapshot.m_dropped = settings::backend->dropped();
+    }
 #   endif
-    return receiver<level>( &_logger ).treat( _message, true );
+    return snapshot;
 }
+#endif
 
-// -------------------------------------------------------------------------- //
-template< unsigned level > inline
-receiver<level> operator<<( const logger<level> & _logger, standard_endline _func )
+#ifndef WIN32
+/**@brief Makes init() catch the fatal signals to write what the loggers still hold
+ * @param[in] _enabled Pass true to install the handler
+ * @warning This must be called before init(), and is reset by destroy().
+ *
+ * On SIGSEGV, SIGBUS, SIGFPE, SIGILL and SIGABRT, the handler writes the
+ * messages still waiting in the asynchronous ring, or in the batch of the
+ * writer thread, to the sinks that can be written to from a signal handler:
+ * fd_sink, rotating_file_sink and the binary_sink wrapping them. A
+ * rotating_file_sink is also truncated to what was written. The handlers in
+ * place before init() are then restored, and the signal raised again,
+ * so that the program still dies the way it would have.
+ *
+ * Only async-signal-safe functions are called. Streams, FILE * and binary
+ * records meant for text sinks are not written, as that would take locks or
+ * allocate memory. The handler runs on the alternate stack of the thread, if
+ * it has one (see sigaltstack(2)), which is needed to report a stack overflow.
+ *
+ * @code{.cpp}
+ * qlog::set_async();
+ * qlog::set_crash_handler();
+ * qlog::init();
+ * @endcode
+ */
+QLOG_INLINE
+void set_crash_handler( bool _enabled = true )
 {
-    _logger.signal( _func, true );
-    return receiver<level>( &_logger );
+    QLOG_ASSERT( !settings::initialized );
+    settings::crash_handler = _enabled;
 }
-/** @endcond */
-// -------------------------------------------------------------------------- //
 
-#ifndef QLOG_NAME_LOGGER_DEBUG
-#   define QLOG_NAME_LOGGER_DEBUG debug
-#endif
-#ifndef QLOG_NAME_LOGGER_TRACE
-#   define QLOG_NAME_LOGGER_TRACE trace
-#endif
-#ifndef QLOG_NAME_LOGGER_INFO
-#   define QLOG_NAME_LOGGER_INFO info
-#endif
-#ifndef QLOG_NAME_LOGGER_WARNING
-#   define QLOG_NAME_LOGGER_WARNING warning
-#endif
-#ifndef QLOG_NAME_LOGGER_ERROR
-#   define QLOG_NAME_LOGGER_ERROR error
-#endif
+/**@cond GENERATE_INTERNAL_DOCUMENTATION */
+/**@brief Puts back the handlers replaced by catch_fatal_signals() */
+QLOG_INLINE
+void restore_fatal_signals()
+{
+    if( !settings::crash_handler_installed )
+        return;
 
-static logger<loglevel::debug> QLOG_NAME_LOGGER_DEBUG ;
-static logger<loglevel::trace> QLOG_NAME_LOGGER_TRACE ;
-static logger<loglevel::info> QLOG_NAME_LOGGER_INFO ;
-static logger<loglevel::warning> QLOG_NAME_LOGGER_WARNING ;
-static logger<loglevel::error> QLOG_NAME_LOGGER_ERROR ;
+    for( size_t i = 0; i < sizeof( fatal_signals ) / sizeof( *fatal_signals ); ++i )
+        sigaction( fatal_signals[i], &settings::previous_actions[i], 0 );
+    settings::crash_handler_installed = false;
+}
 
-static inline
-void set_output( std::ostream & _new_output )
+/**@brief The handler of the fatal signals, see set_crash_handler() */
+QLOG_INLINE
+void on_fatal_signal( int _signal )
 {
-    QLOG_NAME_LOGGER_DEBUG . set_output( _new_output );
-    QLOG_NAME_LOGGER_TRACE . set_output( _new_output );
-    QLOG_NAME_LOGGER_INFO . set_output( _new_output );
-    QLOG_NAME_LOGGER_WARNING . set_output( _new_output );
-    QLOG_NAME_LOGGER_ERROR . set_output( _new_output );
+    const int saved_errno = errno;
+
+    // a second thread crashing meanwhile does not write the same messages again
+    if( 0 == settings::crashing.fetch_add( 1 ) )
+    {
+#       ifdef QLOG_ASYNC
+        if( settings::backend )
+            settings::backend->salvage();
+#       endif
+
+        QLOG_NAME_LOGGER_DEBUG . flush_outputs_on_crash();
+        QLOG_NAME_LOGGER_TRACE . flush_outputs_on_crash();
+        QLOG_NAME_LOGGER_INFO . flush_outputs_on_crash();
+        QLOG_NAME_LOGGER_WARNING . flush_outputs_on_crash();
+        QLOG_NAME_LOGGER_ERROR . flush_outputs_on_crash();
+        for( const module_node * node = modules::first(); node; node = node->m_next )
+        {
+            if( node->m_routed )
+                node->m_sinks->flush_on_crash();
+        }
+    }
+
+    // the signal is blocked until the handler returns, and then delivered to the previous handler
+    restore_fatal_signals();
+    errno = saved_errno;
+    raise( _signal );
 }
 
+/**@brief Installs on_fatal_signal()
+ * @return false if a handler could not be installed */
+QLOG_INLINE
+bool catch_fatal_signals()
+{
+    struct sigaction action;
+    std::memset( &action, 0, sizeof( action ) );
+    action.sa_handler = &on_fatal_signal;
+    action.sa_flags = SA_RESETHAND | SA_ONSTACK;
+    sigemptyset( &action.sa_mask );
+
+    settings::crashing.store( 0 );
+    settings::crash_handler_installed = true;
+    for( size_t i = 0; i < sizeof( fatal_signals ) / sizeof( *fatal_signals ); ++i )
+    {
+        if( 0 != sigaction( fatal_signals[i], &action, &settings::previous_actions[i] ) )
+        {
+            // only puts back the ones replaced so far
+            for( size_t j = 0; j < i; ++j )
+                sigaction( fatal_signals[j], &settings::previous_actions[j], 0 );
+            settings::crash_handler_installed = false;
+            return false;
+        }
+    }
+    return true;
+}
+/**@endcond */
+#endif
 
 // -------------------------------------------------------------------------- //
 /**@brief Terminates the library
  * @note This is only useful on Windows */
-static inline
+QLOG_INLINE
 void destroy()
 {
     QLOG_ASSERT( settings::initialized );
 
+#   ifndef WIN32
+    restore_fatal_signals();
+    settings::crash_handler = false;
+#   endif
+
+#   ifdef QLOG_ASYNC
+    if( settings::backend )
+    {
+        settings::backend->stop();
+        delete settings::backend;
+        settings::backend = 0;
+    }
+    settings::async_capacity = 0;
+    settings::deferred_formatting = false;
+    const writer_options defaults = { writer_wait::sleep, 0, 10, 0, { 0 }, false, false, 0 };
+    settings::writer = defaults;
+#   endif
+    reset_flush_policy();
+    settings::structured_format = structured::json;
+    settings::color_policy = colors::automatic;
+    set_backtrace( 0 );
+    for( module_node * node = modules::first(); node; node = node->m_next )
+    {
+        if( node->m_sinks )
+            node->m_sinks->clear();
+    }
+    modules::reset();
+
+#   ifdef QLOG_STATS
+    QLOG_NAME_LOGGER_DEBUG . reset_stats();
+    QLOG_NAME_LOGGER_TRACE . reset_stats();
+    QLOG_NAME_LOGGER_INFO . reset_stats();
+    QLOG_NAME_LOGGER_WARNING . reset_stats();
+    QLOG_NAME_LOGGER_ERROR . reset_stats();
+#   endif
+
 #	ifdef WIN32
     settings::console_handle = 0;
     settings::set_text_attribute = 0;
@@ -1089,6 +8243,7 @@ void destroy()
     QLOG_NAME_LOGGER_INFO . destroy_mutex();
     QLOG_NAME_LOGGER_WARNING . destroy_mutex();
     QLOG_NAME_LOGGER_ERROR . destroy_mutex();
+    sink_locks::destroy();
 #   endif
 
     settings::initialized = false;
@@ -1098,7 +8253,7 @@ void destroy()
  * @return true If the library in correctly initialized. If false is returned, then you should call
  *         destroy and not use the library.
  * @warning This should be called only once. */
-static inline
+QLOG_INLINE
 bool init()
 {
     QLOG_ASSERT( !settings::initialized );
@@ -1130,6 +8285,35 @@ bool init()
 
     if ( init )
         init = QLOG_NAME_LOGGER_ERROR . init_mutex();
+
+    if ( init )
+        init = sink_locks::create();
+#   endif
+
+#   ifdef QLOG_ASYNC
+    if ( init && settings::async_capacity )
+    {
+        try
+        {
+            settings::backend = new async_backend( settings::async_capacity, settings::async_overflow, settings::writer );
+        }
+        catch( const std::bad_alloc & )
+        {
+            settings::backend = 0;
+        }
+
+        init = settings::backend && settings::backend->start();
+        if ( !init )
+        {
+            delete settings::backend;
+            settings::backend = 0;
+        }
+    }
+#   endif
+
+#   ifndef WIN32
+    if ( init && settings::crash_handler )
+        init = catch_fatal_signals();
 #   endif
 
     settings::initialized = init;
@@ -1137,6 +8321,147 @@ bool init()
     return settings::initialized;
 }
 
+#ifdef QLOG_ASYNC
+// -------------------------------------------------------------------------- //
+/**@brief Makes the loggers hand their messages to a writer thread
+ * @param[in] _capacity The number of slots of the ring shared by the loggers and the writer
+ * @param[in] _policy What to do when the ring is full: overflow::drop, overflow::block,
+ *            or overflow::overwrite_oldest
+ * @warning This must be called before init(), and is reset by destroy().
+ *
+ * Once init() has started the writer, logging a message only consists in
+ * copying it to the ring: the streams set by set_output() are only ever
+ * written to by the writer thread. Call flush() before reading what has been
+ * logged, and keep the streams alive until destroy() returns.
+ *
+ * @code{.cpp}
+ * qlog::set_async( 4096, qlog::overflow::drop );
+ * qlog::init();
+ * qlog::info << "handled by the writer thread" << std::endl;
+ * qlog::flush();
+ * @endcode
+ */
+QLOG_INLINE
+void set_async( size_t _capacity = QLOG_ASYNC_CAPACITY, unsigned _policy = overflow::block )
+{
+    QLOG_ASSERT( !settings::initialized );
+    QLOG_ASSERT( _capacity > 0 );
+    settings::async_capacity = _capacity;
+    settings::async_overflow = _policy;
+}
+
+/**@brief Makes the writer thread format the messages as well
+ * @param[in] _deferred Pass true to capture the arguments of the messages and format them later
+ * @warning This must be called before init(), and is reset by destroy().
+ *
+ * The logging threads then copy the values of the arguments to the ring, and
+ * the writer thread is the one converting them to text. The built-in
+ * arithmetic types, pointers, strings and std::endl are captured that way;
+ * other types are still formatted by the logging thread. Manipulators such
+ * as std::hex or std::setw are recorded as well and have the same effect as
+ * in synchronous mode.
+ */
+QLOG_INLINE
+void set_deferred_formatting( bool _deferred = true )
+{
+    QLOG_ASSERT( !settings::initialized );
+    settings::deferred_formatting = _deferred;
+}
+
+/**@brief Keeps the writer thread on some processors
+ * @param[in] _cpus The processors, numbered from 0; only the first QLOG_WRITER_MAX_CPUS are kept
+ * @param[in] _count Their number, 0 to let the system choose
+ * @warning This must be called before init(), and is reset by destroy().
+ *
+ * On machines where some processors are kept for the threads that must not
+ * wait, the writer goes on one of the others. This is done on linux and
+ * windows (the first 64 processors), and ignored elsewhere; see
+ * writer_configured().
+ *
+ * @code{.cpp}
+ * const unsigned housekeeping[] = { 0, 1 };
+ * qlog::set_writer_affinity( housekeeping, 2 );
+ * @endcode
+ */
+QLOG_INLINE
+void set_writer_affinity( const unsigned * _cpus, size_t _count )
+{
+    QLOG_ASSERT( !settings::initialized );
+    settings::writer.m_cpu_count = _count < QLOG_WRITER_MAX_CPUS ? _count : QLOG_WRITER_MAX_CPUS;
+    for( size_t i = 0; i < settings::writer.m_cpu_count; ++i )
+        settings::writer.m_cpus[i] = _cpus[i];
+}
+
+/**@brief Keeps the writer thread on one processor, see set_writer_affinity( const unsigned *, size_t ) */
+QLOG_INLINE
+void set_writer_affinity( unsigned _cpu )
+{
+    set_writer_affinity( &_cpu, 1 );
+}
+
+/**@brief Changes the priority of the writer thread
+ * @param[in] _priority Without _realtime, the nice value of the writer thread
+ *            on linux (19 being the lowest priority), or one of the
+ *            THREAD_PRIORITY_* values on windows; with it, the SCHED_FIFO
+ *            priority (1 to 99 on linux)
+ * @param[in] _realtime Whether the writer runs with the SCHED_FIFO policy, or
+ *            THREAD_PRIORITY_TIME_CRITICAL on windows
+ * @warning This must be called before init(), and is reset by destroy().
+ *
+ * Without _realtime, this is ignored on the systems other than linux and
+ * windows. Raising a priority is usually reserved to privileged programs;
+ * see writer_configured().
+ */
+QLOG_INLINE
+void set_writer_priority( int _priority, bool _realtime = false )
+{
+    QLOG_ASSERT( !settings::initialized );
+    settings::writer.m_prioritized = true;
+    settings::writer.m_realtime = _realtime;
+    settings::writer.m_priority = _priority;
+}
+
+/**@brief Chooses how the writer thread waits for messages
+ * @param[in] _strategy writer_wait::sleep, writer_wait::spin_then_sleep or writer_wait::busy_poll
+ * @param[in] _spin_microseconds How long writer_wait::spin_then_sleep polls the ring before it sleeps
+ * @param[in] _sleep_milliseconds The longest the writer sleeps, as the flush policy is
+ *            checked when it wakes up
+ * @warning This must be called before init(), and is reset by destroy().
+ *
+ * Polling makes the messages reach their outputs sooner and spares the loggers
+ * the system call that wakes the writer up, at the cost of a processor.
+ *
+ * @code{.cpp}
+ * qlog::set_writer_affinity( 3 );  // an isolated processor
+ * qlog::set_writer_wait( qlog::writer_wait::busy_poll );
+ * @endcode
+ */
+QLOG_INLINE
+void set_writer_wait( unsigned _strategy, unsigned _spin_microseconds = 50, unsigned _sleep_milliseconds = 10 )
+{
+    QLOG_ASSERT( !settings::initialized );
+    QLOG_ASSERT( _sleep_milliseconds > 0 );
+    settings::writer.m_wait = _strategy;
+    settings::writer.m_spin_microseconds = _spin_microseconds;
+    settings::writer.m_sleep_milliseconds = _sleep_milliseconds;
+}
+
+/**@brief Whether the writer thread got the affinity and the priority asked for
+ * @return false before the writer has started, or if the system refused one of them */
+QLOG_INLINE
+bool writer_configured()
+{
+    return settings::backend && settings::backend->configured();
+}
+
+/**@brief The number of messages the overflow policy has discarded since init() */
+QLOG_INLINE
+size_t get_dropped_messages()
+{
+    return settings::backend ? settings::backend->dropped() : 0;
+}
+#endif
+
 static const unsigned black = 1;
 static const unsigned red = 2;
 static const unsigned green = 3;
@@ -1205,6 +8530,12 @@ struct blink
 
 
 #ifndef WIN32
+/**@struct color
+ * @brief A manipulator changing the colors of the text that follows
+ *
+ * The escape sequence is put together once, when the color is made, and
+ * written to the message in one piece. It is left out of the messages that
+ * no terminal is given, see set_color_policy(). */
 struct color
 {
     virtual ~color()
@@ -1219,14 +8550,18 @@ struct color
         :m_foreground( "\033[0m" )
         ,m_background( "" )
         ,m_bold( _bold ? "\033[1m" : "" )
+        ,m_size( 0 )
     {
+        compose();
     }
 
     color( const color & _copy )
         :m_foreground( _copy.m_foreground )
         ,m_background( _copy.m_background )
         ,m_bold( _copy.m_bold )
+        ,m_size( 0 )
     {
+        compose();
     }
 
     color & operator=( const color & _copy )
@@ -1234,6 +8569,7 @@ struct color
         m_foreground =_copy.m_foreground;
         m_background = _copy.m_background;
         m_bold = _copy.m_bold;
+        compose();
 
         return *this;
     }
@@ -1242,6 +8578,7 @@ struct color
         :m_foreground( "\033[0m" )
         ,m_background( "" )
         ,m_bold( _bold ? "\033[1m" : "" )
+        ,m_size( 0 )
     {
         switch( _foreground )
         {
@@ -1256,12 +8593,14 @@ struct color
 
         default: break;
         }
+        compose();
     }
 
     color( unsigned _foreground, unsigned _background, bool _bold = false )
         :m_foreground( "" )
         ,m_background( "" )
         ,m_bold( _bold ? "\033[1m" : "" )
+        ,m_size( 0 )
     {
         switch( _foreground )
         {
@@ -1294,54 +8633,81 @@ struct color
         QLOG_ASSERT(0 != m_foreground);
         QLOG_ASSERT(0 != m_background);
         QLOG_ASSERT(0 != m_bold);
+        compose();
     }
 
     const char * getBold() const { return m_bold; }
     const char * getBackground() const { return m_background; }
     const char * getForeground() const { return m_foreground; }
 
+    /**@brief The whole escape sequence: the foreground, the background and the boldness */
+    const char * getEscape() const { return m_escape; }
+    size_t getEscapeSize() const { return m_size; }
+
 private:
+    void compose()
+    {
+        m_size = 0;
+        const char * const parts[] = { m_foreground, m_background, m_bold };
+        for( size_t i = 0; i < sizeof( parts ) / sizeof( *parts ); ++i )
+        {
+            const size_t length = std::strlen( parts[i] );
+            QLOG_ASSERT( m_size + length < sizeof( m_escape ) );
+            std::memcpy( m_escape + m_size, parts[i], length );
+            m_size += length;
+        }
+        m_escape[m_size] = '\0';
+    }
+
     const char * m_foreground;
     const char * m_background;
     const char * m_bold;
+    char m_escape[16]; ///< "\033[37;47m\033[1m" at most
+    size_t m_size;
 };
 
 template<unsigned level> inline
-receiver<level> operator <<( const logger<level> & _logger, const color & _color )
+typename level_stream<level>::type operator <<( const logger<level> & _logger, const color & _color )
 {
-    return _logger << _color.getForeground() << _color.getBackground() << _color.getBold();
+    const typename level_stream<level>::type recv( &_logger );
+    recv.escape( _color.getEscape(), _color.getEscapeSize(), true );
+    return recv;
 }
 
 template<unsigned level> inline
-receiver<level> operator <<( const receiver<level> & _recv, const color & _color )
+const receiver<level> & operator <<( const receiver<level> & _recv, const color & _color )
 {
-    return _recv << _color.getForeground() << _color.getBackground() << _color.getBold();
+    return _recv.escape( _color.getEscape(), _color.getEscapeSize() );
 }
 
 // -------------------------------------------------------------------------- //
 template<unsigned level> inline
-receiver<level> operator <<( const logger<level> & _logger, const underline & )
+typename level_stream<level>::type operator <<( const logger<level> & _logger, const underline & )
 {
-    return _logger << "\033[4m";
+    const typename level_stream<level>::type recv( &_logger );
+    recv.escape( "\033[4m", 4, true );
+    return recv;
 }
 
 template<unsigned level> inline
-receiver<level> operator <<( const receiver<level> & _recv, const underline & )
+const receiver<level> & operator <<( const receiver<level> & _recv, const underline & )
 {
-    return _recv << "\033[4m";
+    return _recv.escape( "\033[4m", 4 );
 }
 
 // -------------------------------------------------------------------------- //
 template<unsigned level> inline
-receiver<level> operator <<( const logger<level> & _logger, const blink & )
+typename level_stream<level>::type operator <<( const logger<level> & _logger, const blink & )
 {
-    return _logger << "\033[5m";
+    const typename level_stream<level>::type recv( &_logger );
+    recv.escape( "\033[5m", 4, true );
+    return recv;
 }
 
 template<unsigned level> inline
-receiver<level> operator <<( const receiver<level> & _recv, const blink & )
+const receiver<level> & operator <<( const receiver<level> & _recv, const blink & )
 {
-    return _recv << "\033[5m";
+    return _recv.escape( "\033[5m", 4 );
 }
 
 #else // WIN32
@@ -1420,11 +8786,12 @@ private:
 };
 
 template<unsigned level> inline
-receiver<level> operator <<( const logger<level> & _logger, const color & _color )
+typename level_stream<level>::type operator <<( const logger<level> & _logger, const color & _color )
 {
     QLOG_ASSERT( settings::set_text_attribute && settings::console_handle );
-    settings::set_text_attribute( settings::console_handle, _color.getAttributes() );
-    return receiver<level>( &_logger ).treat( "", true );
+    if( level_stream<level>::compiled )
+        settings::set_text_attribute( settings::console_handle, _color.getAttributes() );
+    return typename level_stream<level>::type( &_logger ).treat( "", true );
 }
 
 template<unsigned level> inline
@@ -1437,9 +8804,9 @@ receiver<level> operator <<( const receiver<level> & _recv, const color & _color
 
 // -------------------------------------------------------------------------- //
 template<unsigned level> inline
-receiver<level> operator <<( const logger<level> & _logger, const underline & )
+typename level_stream<level>::type operator <<( const logger<level> & _logger, const underline & )
 {
-    return receiver<level>( &_logger ).treat( "", true );
+    return typename level_stream<level>::type( &_logger ).treat( "", true );
 }
 
 template<unsigned level> inline
@@ -1449,9 +8816,9 @@ receiver<level> operator <<( const receiver<level> & _recv, const underline & )
 }
 // -------------------------------------------------------------------------- //
 template<unsigned level> inline
-receiver<level> operator <<( const logger<level> & _logger, const blink & )
+typename level_stream<level>::type operator <<( const logger<level> & _logger, const blink & )
 {
-    return receiver<level>( &_logger ).treat( "", true );
+    return typename level_stream<level>::type( &_logger ).treat( "", true );
 }
 
 template<unsigned level> inline
@@ -1463,111 +8830,52 @@ receiver<level> operator <<( const receiver<level> & _recv, const blink & )
 #endif
 
 // -------------------------------------------------------------------------- //
-/**@struct color_decoration
- * @cond GENERATE_INTERNAL_DOCUMENTATION
- */
-struct color_decoration : public decoration
+/**@cond GENERATE_INTERNAL_DOCUMENTATION */
+#ifndef WIN32
+/**@brief Adds the escape sequence of a color to the decorations, left out when no terminal gets the message */
+template <unsigned level, bool append > inline
+void add_escape( decorater<level, append> & _dec, const char * _text, size_t _size )
 {
-    color_decoration( const color & _color )
-        :m_color( _color )
-    {
-    }
-
-    virtual void apply( std::ostream & _ostr )
-    {
-#       ifndef WIN32
-        _ostr << m_color.getForeground() << m_color.getBackground() << m_color.getBold();
-#       else
-        settings::set_text_attribute( settings::console_handle, m_color.getAttributes() );
-#       endif
-    }
-    virtual ~color_decoration() throw() { }
-
-private:
-    color m_color;
-};
+    char parameters[32];
+    QLOG_ASSERT( _size < sizeof( parameters ) );
+    parameters[0] = static_cast<char>( _size );
+    std::memcpy( parameters + 1, _text, _size );
+    _dec.add_field( field::escape, parameters, 1 + _size );
+}
+#endif
 
-// -------------------------------------------------------------------------- //
 template <unsigned level, bool append >
 decorater<level, append> & operator<< ( decorater<level, append> & _dec, const color & _color )
 {
-    try
-    {
-        decoration * const newdeco = new color_decoration( _color );
-        _dec.add_decoration( *newdeco );
-    }
-    catch( const std::bad_alloc & )
-    {
-        QLOG_ASSERT( 0 && "std::bad_alloc" );
-    }
-
+#   ifndef WIN32
+    add_escape( _dec, _color.getEscape(), _color.getEscapeSize() );
+#   else
+    const WORD attributes = _color.getAttributes();
+    _dec.add_field( field::attributes, &attributes, sizeof( WORD ) );
+#   endif
     return _dec;
 }
-/**@endcond */
-
-// -------------------------------------------------------------------------- //
-struct blink_decoration : public decoration
-{
-    virtual ~blink_decoration() throw() { }
-    virtual void apply( std::ostream & _ostr )
-    {
-
-#       ifndef WIN32
-        _ostr << "\033[5m";
-#       else
-        ( void )_ostr;
-#       endif
-    }
-};
 
 // -------------------------------------------------------------------------- //
 template<unsigned level, bool append > inline
 decorater<level, append> & operator << ( decorater<level, append> & _dec, const blink & )
 {
-    try
-    {
-        decoration * const newdeco = new blink_decoration();
-        _dec.add_decoration( *newdeco );
-    }
-    catch( const std::bad_alloc & )
-    {
-        QLOG_ASSERT( 0 && "std::bad_alloc" );
-    }
-
+#   ifndef WIN32
+    add_escape( _dec, "\033[5m", 4 );
+#   endif
     return _dec;
 }
 
-// -------------------------------------------------------------------------- //
-struct underline_decoration : public decoration
-{
-    virtual ~underline_decoration() throw()  { }
-    virtual void apply( std::ostream & _ostr )
-    {
-
-#       ifndef WIN32
-        _ostr << "\033[4m";;
-#       else
-        ( void )_ostr;
-#       endif
-    }
-};
-
 // -------------------------------------------------------------------------- //
 template< unsigned loglevel, bool append > inline
 decorater<loglevel, append> & operator << ( decorater<loglevel, append> & _dec, const underline & )
 {
-    try
-    {
-        decoration * const newdeco = new underline_decoration();
-        _dec.add_decoration( *newdeco );
-    }
-    catch( const std::bad_alloc & )
-    {
-        QLOG_ASSERT( 0 && "std::bad_alloc" );
-    }
-
+#   ifndef WIN32
+    add_escape( _dec, "\033[4m", 4 );
+#   endif
     return _dec;
 }
+/**@endcond */
 
 } // namespace
 #if __GNUC__ >= 4
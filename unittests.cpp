@@ -1,21 +1,33 @@
 #define QLOG_USE_ASSERTS
+#define QLOG_NETWORK
 #ifdef TEST_MULTITHREADING
 #   ifndef WIN32
 #       define QLOG_MULTITHREAD_CPP11
 #   else
 #		define QLOG_MULTITHREAD_WIN32
 #	endif
+#   define QLOG_ASYNC
+#   define QLOG_STATS
+#   define QLOG_EXTERN_LOGGERS
+#   define QLOG_DEFINE_LOGGERS
 #endif
 #include "qlog.hpp"
 #include <UnitTest++/UnitTest++.h>
 #include <iostream>
 #include <fstream>
+#include <iomanip>
+#include <cstdlib>
 #ifndef WIN32
 #   include <sys/resource.h>
+#   include <sys/wait.h>
+#   include <netinet/in.h>
+#   include <arpa/inet.h>
 #endif
 
 #ifdef TEST_MULTITHREADING
 #	include <thread>
+#	include <mutex>
+#	include <condition_variable>
 #endif
 
 using namespace qlog;
@@ -114,6 +126,67 @@ TEST_FIXTURE( qlog_resetter, Numbers )
     CHECK_EQUAL( "123", output.str() );
 }
 
+TEST_FIXTURE( qlog_resetter, NumberFormatting )
+{
+    std::cout << "NumberFormatting" << std::endl;
+    logger<loglevel::error> logger;
+    std::ostringstream output;
+    logger.set_output( output );
+
+    const std::ios_base::fmtflags formats[] =
+    {
+        std::ios_base::fmtflags(),
+        std::ios_base::fixed,
+        std::ios_base::scientific | std::ios_base::uppercase,
+        std::ios_base::showpos | std::ios_base::showpoint,
+        std::ios_base::hex | std::ios_base::showbase,
+    };
+    const int precisions[] = { 6, 0, 2, 17 };
+    const double reals[] = { 0.0, -0.0, 1.0, -42.0, 0.1, 1.0 / 3, 123456.0, 1234567.0, 4294967295.0, 4294967296.0, 1e300, -2.5e-300 };
+
+    for( size_t f = 0; f < sizeof( formats ) / sizeof( formats[0] ); ++f )
+    {
+        for( size_t p = 0; p < sizeof( precisions ) / sizeof( precisions[0] ); ++p )
+        {
+            std::ostringstream expected;
+            expected << std::setiosflags( formats[f] ) << std::setprecision( precisions[p] );
+            logger << std::setiosflags( formats[f] ) << std::setprecision( precisions[p] );
+            for( size_t i = 0; i < sizeof( reals ) / sizeof( reals[0] ); ++i )
+            {
+                expected << reals[i] << ' ' << static_cast<float>( reals[i] ) << ' ' << static_cast<long double>( reals[i] ) << ' ';
+                logger << reals[i] << ' ' << static_cast<float>( reals[i] ) << ' ' << static_cast<long double>( reals[i] ) << ' ';
+            }
+            expected << 0 << -7 << 65535U << -2147483647L - 1 << 18446744073709551615ULL << static_cast<short>( -32768 );
+            logger << 0 << -7 << 65535U << -2147483647L - 1 << 18446744073709551615ULL << static_cast<short>( -32768 );
+            expected << std::setw( 5 ) << 12 << std::setw( 8 ) << 1.5;
+            logger << std::setw( 5 ) << 12 << std::setw( 8 ) << 1.5;
+            logger << std::resetiosflags( formats[f] ) << std::setprecision( 6 );
+
+            CHECK_EQUAL( expected.str(), output.str() );
+            output.str( "" );
+        }
+    }
+}
+
+TEST_FIXTURE( qlog_resetter, ReceiverHandOver )
+{
+    std::cout << "ReceiverHandOver" << std::endl;
+    std::ostringstream output;
+    qlog::error.set_output( output );
+    qlog::error.append() << "!";
+
+    {
+        // the message is only ended by the receiver that holds it last
+        const receiver<loglevel::error> held = ( qlog::error << "a" << 1 );
+        held << "b";
+        CHECK_EQUAL( "", output.str() );
+    }
+    CHECK_EQUAL( "a1b!", output.str() );
+
+    qlog::error << "c" << std::endl << "d";
+    CHECK_EQUAL( "a1b!c\nd!", output.str() );
+}
+
 TEST_FIXTURE( qlog_resetter, Loglevel )
 {
     std::cout << "Loglevel" << std::endl;
@@ -610,107 +683,1645 @@ TEST_FIXTURE( qlog_resetter, LoggingDisabledWithPrefixAndSuffixes )
     CHECK_EQUAL( 0, ostr.str().size() );
 }
 
-TEST_FIXTURE( qlog_resetter, CustomFlavour )
+TEST_FIXTURE( qlog_resetter, ManyDecorations )
 {
-    std::cout << "CustomFlavour\n";
-    set_output( std::cout );
+    std::cout << "ManyDecorations" << std::endl;
+
+    set_loglevel( loglevel::warning );
+
+    std::ostringstream ostr ;
+    set_output( ostr );
+
+    std::string expected;
+    for( int i = 0; i < 100; ++i )
+    {
+        qlog::warning.prepend() << "0123456789";
+        expected += "0123456789";
+    }
+    qlog::warning.append() << "a" << "b" << "c" << "d" << "e" << "f" << "g" << "h" << "i" << "j" << "k" << "l";
+    qlog::warning << "|";
+
+    CHECK_EQUAL( expected + "|abcdefghijkl", ostr.str() );
+
+    qlog::warning.prepend().reset();
+    ostr.str( "" );
+    qlog::warning << "|";
+    CHECK_EQUAL( "|abcdefghijkl", ostr.str() );
+}
+
+struct string_sink : public sink
+{
+    string_sink()
+        :m_text()
+        ,m_flushes( 0 )
+    {
+    }
+
+    virtual void write( const char * _data, size_t _size ) { m_text.append( _data, _size ); }
+    virtual void flush() { ++m_flushes; }
+
+    std::string m_text;
+    int m_flushes;
+};
+
+TEST_FIXTURE( qlog_resetter, CustomSink )
+{
+    std::cout << "CustomSink" << std::endl;
+
+    set_loglevel( loglevel::warning );
+
+    string_sink output;
+    set_output( output );
+
+    qlog::warning.prepend() << "[";
+    qlog::warning.append() << "]";
+    qlog::warning << "a" << 1;
+    qlog::error << "b" << std::endl;
+
+    CHECK_EQUAL( "[a1]b\n", output.m_text );
+    CHECK_EQUAL( 1, output.m_flushes );
+}
+
+TEST_FIXTURE( qlog_resetter, FanOut )
+{
+    std::cout << "FanOut" << std::endl;
+
     set_loglevel( loglevel::info );
 
-    qlog::info.prepend() << "[" << color(gray) << ".." << color() << "] ";
-    qlog::warning.prepend() << "[" << color( green ) << "ww" << color() << "] ";
-    qlog::error.prepend() << "[" << color( red, true ) << blink() << "EE" << color() << "] " << color(true);
-    qlog::error.append() << color();
+    string_sink everything;
+    string_sink important;
+    set_output( everything );
+    CHECK( add_output( important, loglevel::warning ) );
+
+    qlog::info.prepend() << "i:";
+    qlog::error.prepend() << "e:";
+    qlog::info << "a" << std::endl;
+    qlog::error << "b" << std::endl;
+    qlog::debug << "c" << std::endl;
+
+    CHECK_EQUAL( "i:a\ne:b\n", everything.m_text );
+    CHECK_EQUAL( "e:b\n", important.m_text );
+    CHECK_EQUAL( 2, everything.m_flushes );
+    CHECK_EQUAL( 1, important.m_flushes );
+
+    remove_output( everything );
+    qlog::info << "d";
+    qlog::error << "f";
+    CHECK_EQUAL( "i:a\ne:b\n", everything.m_text );
+    CHECK_EQUAL( "e:b\ne:f", important.m_text );
+}
 
-    qlog::info      << "A custom flavor info line\n";
-    qlog::warning   << "A custom flavor warning line\n";
-    qlog::error     << "A custom flavor error line\n";
+TEST_FIXTURE( qlog_resetter, BatchedFlush )
+{
+    std::cout << "BatchedFlush" << std::endl;
+
+    set_loglevel( loglevel::info );
+
+    string_sink output;
+    set_output( output );
+    set_flush_policy( 10, 0, loglevel::error );
+
+    qlog::info << "abc" << std::endl;
+    CHECK_EQUAL( 0, output.m_flushes );
+    qlog::info << "defghij" << std::endl;
+    CHECK_EQUAL( 1, output.m_flushes );
+    qlog::info << "k" << std::endl;
+    CHECK_EQUAL( 1, output.m_flushes );
+    qlog::error << "l";
+    CHECK_EQUAL( 2, output.m_flushes );
+    CHECK_EQUAL( "abc\ndefghij\nk\nl", output.m_text );
+
+    reset_flush_policy();
+    qlog::info << "m" << std::endl;
+    CHECK_EQUAL( 3, output.m_flushes );
 }
 
-TEST_FIXTURE( qlog_resetter, ColorCopy )
+#ifdef QLOG_HAS_VARIADIC_TEMPLATES
+TEST_FIXTURE( qlog_resetter, FormatString )
 {
-    std::cout << "ColorCopy\n";
-    qlog::color vert(green);
-    qlog::color copy( vert );
+    std::cout << "FormatString" << std::endl;
 
-#ifndef WIN32
-    CHECK_EQUAL(vert.getBold(), copy.getBold());
-    CHECK_EQUAL(vert.getForeground(), copy.getForeground());
-    CHECK_EQUAL(vert.getBackground(), copy.getBackground());
+    set_loglevel( loglevel::info );
+
+    string_sink output;
+    set_output( output );
+    qlog::info.prepend() << "[" << source_location() << "] ";
+
+    qlog::info.log( "x={} y={} {{}}", 1, 2.5 );
+    qlog::info.log( "|{}|{}|", std::string( "a" ), 'b', "dropped" );
+    qlog::info.log( "{}{}", 3 );
+    qlog::debug.log( "filtered {}", 4 );
+    const int line = __LINE__ + 1;
+    QLOG_LOGF( qlog::info, "line {}\n", line );
+    CHECK_EQUAL( "[] x=1 y=2.5 {}[] |a|b|[] 3{}[unittests.cpp:" + std::to_string( line ) + "] line "
+                 + std::to_string( line ) + "\n", output.m_text );
+
+    // too few arguments: the rest of the format is written, its {} as they are
+    output.m_text.clear();
+    qlog::info.prepend().reset();
+    qlog::info.log( "a={} b={} c={{{}}}!\n", 1 );
+    qlog::info.log( "none {} {{}}" );
+    CHECK_EQUAL( "a=1 b={} c={{}}!\nnone {} {}", output.m_text );
+
+    static_assert( 2 == count_placeholders( "{}{{}}{} }" ), "" );
+}
+#endif
+
+TEST_FIXTURE( qlog_resetter, KeyValue )
+{
+    std::cout << "KeyValue" << std::endl;
+
+    set_loglevel( loglevel::info );
+
+    std::ostringstream ostr;
+    set_output( ostr );
+
+    qlog::info.kv( "user", 42 ).kv( "name", "bob \"b\"\n" ).kv( "ok", true ).kv( "t", -1.5 ) << std::endl;
+    qlog::info << "login ";
+    qlog::info.kv( "id", std::string( "a\\b" ) ).kv( "c", '\x01' ) << " done";
+    qlog::debug.kv( "filtered", 1 ) << std::endl;
+    CHECK_EQUAL( "{\"user\":42,\"name\":\"bob \\\"b\\\"\\n\",\"ok\":true,\"t\":-1.5}\n"
+                 "login {\"id\":\"a\\\\b\",\"c\":\"\\u0001\"} done", ostr.str() );
+
+    ostr.str( "" );
+    set_structured_format( structured::logfmt );
+    qlog::info.kv( "user", 42U ).kv( "name", "bob" ).kv( "msg", "a b=c" ).kv( "empty", "" ) << std::endl;
+    qlog::info.kv( "level", "info" );
+    CHECK_EQUAL( "user=42 name=bob msg=\"a b=c\" empty=\"\"\nlevel=info", ostr.str() );
+}
+
+/**@brief Counts how many times it is called, for LazyArguments */
+struct counted_dump
+{
+    explicit
+    counted_dump( int * _calls )
+        :m_calls( _calls )
+    {
+    }
+
+    std::string operator()() const
+    {
+        ++*m_calls;
+        return "dump";
+    }
+
+    int * m_calls;
+};
+
+TEST_FIXTURE( qlog_resetter, LazyArguments )
+{
+    std::cout << "LazyArguments" << std::endl;
+
+    set_loglevel( loglevel::info );
+
+    std::ostringstream ostr;
+    set_output( ostr );
+
+    // the messages that are not written never call the function
+    int calls = 0;
+    qlog::debug << "state: " << lazy( counted_dump( &calls ) );
+    qlog::info( false ) << lazy( counted_dump( &calls ) ) << std::endl;
+    qlog::info.disable();
+    qlog::info << lazy( counted_dump( &calls ) );
+    qlog::info.enable();
+    qlog::debug.kv( "state", lazy( counted_dump( &calls ) ) );
+    CHECK_EQUAL( 0, calls );
+
+    qlog::info << lazy( counted_dump( &calls ) ) << ' ';
+    qlog::info( true ) << "state: " << lazy( counted_dump( &calls ) ) << ' ';
+    qlog::info.kv( "state", lazy( counted_dump( &calls ) ) ) << ' ';
+#ifdef QLOG_HAS_VARIADIC_TEMPLATES
+    qlog::debug.log( "{}", lazy( [&calls]{ return ++calls; } ) );
+    qlog::info.log( "{}", lazy( [&calls]{ return ++calls; } ) );
+    CHECK_EQUAL( 4, calls );
+    CHECK_EQUAL( "dump state: dump {\"state\":\"dump\"} 4", ostr.str() );
 #else
-    CHECK_EQUAL(vert.getAttributes(), copy.getAttributes());
+    CHECK_EQUAL( 3, calls );
+    CHECK_EQUAL( "dump state: dump {\"state\":\"dump\"} ", ostr.str() );
 #endif
+
+    // the condition is not evaluated either when the level is filtered
+    ostr.str( "" );
+    int conditions = 0;
+    QLOG_LOG_IF( qlog::debug, ++conditions > 0 ) << "not written";
+    CHECK_EQUAL( 0, conditions );
+    QLOG_LOG_IF( qlog::info, ++conditions > 1 ) << "not written";
+    QLOG_LOG_IF( qlog::info, ++conditions > 1 ) << "written";
+    CHECK_EQUAL( 2, conditions );
+    CHECK_EQUAL( "written", ostr.str() );
 }
 
-#ifdef TEST_MULTITHREADING
-void multithreading_test_one(const char ch, const unsigned maxIter)
+/**@brief Logs a message while the caller assembles one, for NestedMessages */
+static int log_inner()
 {
-    unsigned i = 0;
-    while (i++ < maxIter)
-        qlog::info << ch << ch << ch << ch << ch << ch;
+    qlog::warning << "inner\n";
+    return 1;
 }
 
+static int log_nested()
+{
+    qlog::warning << "outer " << log_inner() << '\n';
+    return 2;
+}
 
-TEST_FIXTURE( qlog_resetter, MultithreadingTestOne )
+TEST_FIXTURE( qlog_resetter, NestedMessages )
 {
-    std::cout << "MultithreadingTestOne" << std::endl;
+    std::cout << "NestedMessages" << std::endl;
 
-    std::ostringstream ostr;
     set_loglevel( loglevel::info );
+
+    std::ostringstream ostr;
     set_output( ostr );
+    qlog::info.prepend() << "<";
+    qlog::info.append() << ">";
+
+    // the message being assembled is kept whole, the nested one is written first
+    qlog::info << "a" << log_inner() << "b";
+    CHECK_EQUAL( "inner\n<a1b>", ostr.str() );
+
+    ostr.str( "" );
+    qlog::info << "c" << log_nested() << "d";
+    qlog::info << "e";
+    CHECK_EQUAL( "inner\nouter 1\n<c2d><e>", ostr.str() );
+
+    // logging while an argument is written, the assertions being on
+    ostr.str( "" );
+    qlog::info << "f" << lazy( &log_nested ) << lazy( &log_inner );
+#ifdef QLOG_HAS_VARIADIC_TEMPLATES
+    qlog::info.log( "g{}{}", lazy( &log_inner ), 3 );
+    CHECK_EQUAL( "inner\nouter 1\ninner\n<f21>inner\n<g13>", ostr.str() );
+#else
+    CHECK_EQUAL( "inner\nouter 1\ninner\n<f21>", ostr.str() );
+#endif
 
-    std::thread t1( multithreading_test_one, 'a', 80000);
-    std::thread t2( multithreading_test_one, 'b', 80000);
+    qlog::info.prepend().reset();
+    qlog::info.append().reset();
+}
 
-    t1.join();
-    t2.join();
+TEST_FIXTURE( qlog_resetter, CallSiteSampling )
+{
+    std::cout << "CallSiteSampling" << std::endl;
 
-    const std::string & result = ostr.str();
+    set_loglevel( loglevel::info );
 
-    CHECK_EQUAL( 0, result.size() % 6 );
-    for ( std::string::const_iterator it = result.begin(); it != result.end(); )
+    string_sink output;
+    set_output( output );
+
+    for( int i = 0; i < 10; ++i )
     {
-        const char first_char = *it++;
-        CHECK_EQUAL( first_char, *it++ );
-        CHECK_EQUAL( first_char, *it++ );
-        CHECK_EQUAL( first_char, *it++ );
-        CHECK_EQUAL( first_char, *it++ );
-        CHECK_EQUAL( first_char, *it++ );
+        QLOG_EVERY_N( qlog::info, 4 ) << i << ' ';
+        QLOG_EVERY_N( qlog::debug, 1 ) << "filtered";
+    }
+    CHECK_EQUAL( "0 4 8 ", output.m_text );
+
+    output.m_text.clear();
+    for( int i = 0; i < 1000; ++i )
+    {
+        QLOG_SAMPLED( qlog::info, 0.0 ) << "never";
+        QLOG_SAMPLED( qlog::info, 1.0 ) << 'a';
+    }
+    CHECK_EQUAL( std::string( 1000, 'a' ), output.m_text );
+
+    size_t sampled = 0;
+    for( int i = 0; i < 10000; ++i )
+    {
+        output.m_text.clear();
+        QLOG_SAMPLED( qlog::info, 0.25 ) << 'b';
+        sampled += output.m_text.size();
     }
+    CHECK( sampled > 2000 && sampled < 3000 );
 }
 
-void createSomeThreads();
+TEST_FIXTURE( qlog_resetter, RateLimiting )
+{
+    std::cout << "RateLimiting" << std::endl;
 
-TEST_FIXTURE( qlog_resetter, MultithreadingTestTwo )
+    set_loglevel( loglevel::info );
+
+    string_sink output;
+    set_output( output );
+
+    call_site site = { { 0 }, { 0 }, { 0 } };
+    CHECK( site.allow( 2 ) );
+    CHECK( site.allow( 2 ) );
+    CHECK( !site.allow( 2 ) );
+    CHECK( !site.allow( 2 ) );
+
+    // as if the next second had started
+    site.m_window.store( 0 );
+    CHECK( site.allow( 2 ) );
+    report_suppressed( qlog::info, site, QLOG_HERE ) << "next" << std::endl;
+    CHECK_EQUAL( "suppressed 2 messages\nnext\n", output.m_text );
+    CHECK_EQUAL( 0U, site.suppressed() );
+
+    // the loop may run across two seconds
+    output.m_text.clear();
+    for( int i = 0; i < 100; ++i )
+    {
+        QLOG_RATE_LIMITED( qlog::info, 3 ) << "x";
+    }
+    CHECK( 0 == output.m_text.find( "xxx" ) );
+    CHECK( output.m_text.size() < 100 );
+}
+
+TEST_FIXTURE( qlog_resetter, BinarySink )
 {
-    std::cout << "MultithreadingTestTwo" << std::endl;
+    std::cout << "BinarySink" << std::endl;
+
+    set_loglevel( loglevel::warning );
+
+    string_sink file;
+    binary_sink records( file );
+    string_sink text;
+    set_output( records );
+    add_output( text );
+
+    qlog::warning.prepend() << "[" << level_tag() << "] ";
+    qlog::warning << "a" << 1 << ' ' << std::hex << 255 << std::dec << ' ' << 2.5 << std::endl;
+    qlog::error << std::setw( 4 ) << "b" << ',' << std::string( "c" ) << std::endl;
+
+    // the text sink still receives text, flushed by std::endl
+    CHECK_EQUAL( "[WARNING] a1 ff 2.5\n   b,c\n", text.m_text );
+    CHECK_EQUAL( 2, text.m_flushes );
+
+    const size_t magic = sizeof( binary_file_magic );
+    CHECK( file.m_text.size() > magic + sizeof( record_header ) );
+    CHECK( 0 == file.m_text.compare( 0, magic, binary_file_magic, magic ) );
+
+    record_header header;
+    std::memcpy( &header, file.m_text.data() + magic, sizeof( record_header ) );
+    CHECK_EQUAL( loglevel::warning, header.m_level );
+    CHECK( header.m_seconds > 0 );
+
+    std::ostringstream decoded;
+    size_t used = 0;
+    CHECK( decode_records( file.m_text.data() + magic, file.m_text.size() - magic, decoded, false, &used ) );
+    CHECK_EQUAL( file.m_text.size() - magic, used );
+    CHECK_EQUAL( text.m_text, decoded.str() );
+}
+
+TEST_FIXTURE( qlog_resetter, Lz4Sink )
+{
+    std::cout << "Lz4Sink" << std::endl;
 
-    std::ostringstream ostr;
     set_loglevel( loglevel::info );
-    set_output( ostr );
 
-    std::thread t1( multithreading_test_one, 'c', 80000);
-    std::thread t2( multithreading_test_one, 'd', 80000);
+    string_sink file;
+    std::string expected;
+    {
+        lz4_sink compressed( file );
+        set_output( compressed );
+
+        // more than a block, most of it repeated
+        for( int i = 0; i < 5000; ++i )
+        {
+            qlog::info << "request " << i << " served in " << i % 7 << " ms\n";
+            std::ostringstream line;
+            line << "request " << i << " served in " << i % 7 << " ms\n";
+            expected += line.str();
+        }
+        CHECK( 0 == file.m_text.compare( 0, sizeof( lz4_frame_magic ), lz4_frame_magic, sizeof( lz4_frame_magic ) ) );
+
+        // a flush ends the block being filled
+        qlog::info << "last" << std::endl;
+        expected += "last\n";
+        remove_output( compressed );
+    }
+    CHECK( file.m_text.size() < expected.size() / 3 );
+
+    std::string decompressed;
+    size_t used = 0;
+    CHECK( lz4_decompress( file.m_text.data(), file.m_text.size(), decompressed, &used ) );
+    CHECK_EQUAL( file.m_text.size(), used );
+    CHECK( expected == decompressed );
+
+    // a file cut in the middle of its last frame keeps the frames before
+    std::string truncated;
+    CHECK( lz4_decompress( file.m_text.data(), file.m_text.size() - 10, truncated, &used ) );
+    CHECK( used < file.m_text.size() - 10 );
+    CHECK( 0 == expected.compare( 0, truncated.size(), truncated ) );
+    CHECK( truncated.size() < expected.size() );
+
+    // a frame of the lz4 program, whose descriptor holds the size of the content
+    static const unsigned char sized[] = {
+        0x04, 0x22, 0x4d, 0x18, 0x6c, 0x40, 0x0c, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x3b, 0x0c,
+        0x00, 0x00, 0x80, 'h', 'e', 'l', 'l', 'o', ',', ' ', 'q', 'l', 'o', 'g', '\n', 0x00,
+        0x00, 0x00, 0x00, 0x19, 0xb6, 0x0e, 0xe6 };
+    std::string hello;
+    CHECK( lz4_decompress( reinterpret_cast<const char *>( sized ), sizeof( sized ), hello, &used ) );
+    CHECK_EQUAL( sizeof( sized ), used );
+    CHECK_EQUAL( "hello, qlog\n", hello );
+
+    // a corrupted frame
+    std::string corrupted = file.m_text;
+    corrupted[5] = '\x42';
+    std::string nothing;
+    CHECK( !lz4_decompress( corrupted.data(), corrupted.size(), nothing ) );
+
+    // what does not compress is stored as it is
+    string_sink random;
+    {
+        lz4_sink compressed( random );
+        unsigned state = 1;
+        std::string noise;
+        for( int i = 0; i < 1000; ++i )
+        {
+            state = state * 1103515245U + 12345U;
+            noise += static_cast<char>( state >> 24 );
+        }
+        compressed.write( noise.data(), noise.size() );
+        compressed.flush();
+        CHECK_EQUAL( 7 + 4 + noise.size() + 4, random.m_text.size() );
+        decompressed.clear();
+        CHECK( lz4_decompress( random.m_text.data(), random.m_text.size(), decompressed ) );
+        CHECK( noise == decompressed );
+    }
+}
 
-    createSomeThreads();
+static std::string read_file( FILE * _file )
+{
+    std::string text;
+    std::rewind( _file );
+    char buffer[256];
+    size_t size = 0;
+    while( ( size = std::fread( buffer, 1, sizeof( buffer ), _file ) ) > 0 )
+        text.append( buffer, size );
+    return text;
+}
 
-    t1.join();
-    t2.join();
+TEST_FIXTURE( qlog_resetter, FileSink )
+{
+    std::cout << "FileSink" << std::endl;
 
-    const std::string & result = ostr.str();
+    set_loglevel( loglevel::warning );
 
-    CHECK_EQUAL( 0, result.size() % 6 );
-    for ( std::string::const_iterator it = result.begin(); it != result.end(); )
+    FILE * const file = std::tmpfile();
+    CHECK( file );
+    file_sink output( file );
+    set_output( output );
+
+    qlog::warning << "abc " << 42 << std::endl;
+    qlog::debug << "filtered" << std::endl;
+
+    CHECK_EQUAL( "abc 42\n", read_file( file ) );
+    std::fclose( file );
+}
+
+#ifndef WIN32
+TEST_FIXTURE( qlog_resetter, FdSink )
+{
+    std::cout << "FdSink" << std::endl;
+
+    set_loglevel( loglevel::warning );
+
+    FILE * const file = std::tmpfile();
+    CHECK( file );
+    fd_sink output( fileno( file ) );
+    qlog::error.set_output( output );
+
+    qlog::error << "def " << 1.5 << '\n';
+    qlog::error << "ghi" << std::endl;
+
+    CHECK_EQUAL( "def 1.5\nghi\n", read_file( file ) );
+    std::fclose( file );
+}
+
+static std::string read_file( const std::string & _path )
+{
+    std::ifstream file( _path.c_str() );
+    std::ostringstream text;
+    text << file.rdbuf();
+    return text.str();
+}
+
+TEST_FIXTURE( qlog_resetter, RotatingFileSink )
+{
+    std::cout << "RotatingFileSink" << std::endl;
+
+    std::ostringstream name;
+    name << "/tmp/qlog_unittests_" << getpid() << ".log";
+    const std::string path = name.str();
+
+    set_loglevel( loglevel::warning );
     {
-        const char first_char = *it++;
-        CHECK_EQUAL( first_char, *it++ );
-        CHECK_EQUAL( first_char, *it++ );
-        CHECK_EQUAL( first_char, *it++ );
-        CHECK_EQUAL( first_char, *it++ );
-        CHECK_EQUAL( first_char, *it++ );
+        // one page per segment, so that long messages span several of them
+        rotating_file_sink output( path.c_str(), 6000, 2, 0, 1 );
+        CHECK( output.is_open() );
+        set_output( output );
+
+        for( char c = 'a'; c < 'e'; ++c )
+            qlog::warning << std::string( 2999, c ) << std::endl;
+        qlog::warning << "end";
+        CHECK_EQUAL( 3UL, output.size() );
+        remove_output( output );
+    }
+
+    // the first file was dropped, the others were renamed
+    CHECK_EQUAL( "end", read_file( path ) );
+    CHECK_EQUAL( std::string( 2999, 'c' ) + '\n' + std::string( 2999, 'd' ) + '\n', read_file( path + ".1" ) );
+    CHECK_EQUAL( std::string( 2999, 'a' ) + '\n' + std::string( 2999, 'b' ) + '\n', read_file( path + ".2" ) );
+
+    std::remove( path.c_str() );
+    std::remove( ( path + ".1" ).c_str() );
+    std::remove( ( path + ".2" ).c_str() );
+}
+
+TEST_FIXTURE( qlog_resetter, SharedMemoryRing )
+{
+    std::cout << "SharedMemoryRing" << std::endl;
+
+    std::ostringstream name;
+    name << "/qlog_unittests_" << getpid();
+
+    set_loglevel( loglevel::warning );
+    char text[64];
+    {
+        shm_ring_sink ring( name.str().c_str(), 16 );
+        CHECK( ring.is_open() );
+        set_output( ring );
+
+        shm_ring_reader reader( name.str().c_str() );
+        CHECK( reader.is_open() );
+        CHECK_EQUAL( 0UL, reader.read( text, sizeof( text ) ) );
+
+        qlog::warning << "0123456789";
+        qlog::warning << "abcdefghij"; // does not fit
+        CHECK_EQUAL( 1UL, ring.dropped() );
+        CHECK_EQUAL( 4UL, reader.read( text, 4 ) );
+        CHECK_EQUAL( "0123", std::string( text, 4 ) );
+
+        // wraps around the end of the ring
+        qlog::warning << "abcdefghij";
+        CHECK_EQUAL( 16UL, reader.read( text, sizeof( text ) ) );
+        CHECK_EQUAL( "456789abcdefghij", std::string( text, 16 ) );
+        CHECK( !reader.closed() );
+
+        qlog::warning << "end";
+        remove_output( ring );
+        qlog::warning << "not written";
+
+        // a second run of the program replaces the ring
+        shm_ring_sink next( name.str().c_str(), 16 );
+        CHECK( reader.replaced() );
+        CHECK_EQUAL( 3UL, reader.read( text, sizeof( text ) ) );
+        CHECK_EQUAL( "end", std::string( text, 3 ) );
+    }
+
+    shm_ring_reader gone( name.str().c_str() );
+    CHECK( !gone.is_open() );
+}
+#endif
+
+#ifndef WIN32
+/**@brief Waits for something to read on a socket of NetworkSink, a second at most */
+static std::string receive( int _fd, size_t _size )
+{
+    std::string received;
+    char data[512];
+    struct pollfd readable = { _fd, POLLIN, 0 };
+    while( received.size() < _size && poll( &readable, 1, 1000 ) > 0 )
+    {
+        const ssize_t length = recv( _fd, data, sizeof( data ), 0 );
+        if( length <= 0 )
+            break;
+        received.append( data, static_cast<size_t>( length ) );
+    }
+    return received;
+}
+
+/**@brief Makes a socket of NetworkSink listen on a port of 127.0.0.1 chosen by the system
+ * @return The port */
+static std::string listen_locally( int _fd )
+{
+    struct sockaddr_in address;
+    std::memset( &address, 0, sizeof( address ) );
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+    socklen_t length = sizeof( address );
+    bind( _fd, reinterpret_cast<struct sockaddr *>( &address ), sizeof( address ) );
+    getsockname( _fd, reinterpret_cast<struct sockaddr *>( &address ), &length );
+
+    std::ostringstream port;
+    port << ntohs( address.sin_port );
+    return port.str();
+}
+
+TEST_FIXTURE( qlog_resetter, NetworkSink )
+{
+    std::cout << "NetworkSink" << std::endl;
+
+    std::ostringstream tail;
+    tail << " unittests " << getpid() << " - - ";
+    set_loglevel( loglevel::info );
+
+    // a datagram per message, with the syslog header
+    const int datagrams = socket( AF_INET, SOCK_DGRAM, 0 );
+    const std::string datagram_port = listen_locally( datagrams );
+    {
+        network_sink collector( "127.0.0.1", datagram_port.c_str(), network::udp_syslog, "unittests", 16 );
+        CHECK( collector.is_resolved() );
+        CHECK( collector.connected() );
+        set_output( collector );
+
+        qlog::error << "disk " << 3 << " failed\n";
+        qlog::info << "started";
+        CHECK_EQUAL( 0UL, collector.pending() );
+        remove_output( collector );
+    }
+
+    const std::string first = receive( datagrams, 1 );
+    CHECK_EQUAL( "<131>1 ", first.substr( 0, 7 ) );
+    CHECK_EQUAL( 'Z', first[33] );
+    CHECK_EQUAL( tail.str() + "disk 3 failed", first.substr( first.size() - tail.str().size() - 13 ) );
+    const std::string second = receive( datagrams, 1 );
+    CHECK_EQUAL( "<134>1 ", second.substr( 0, 7 ) );
+    CHECK_EQUAL( tail.str() + "started", second.substr( second.size() - tail.str().size() - 7 ) );
+    close( datagrams );
+
+    // the length of each message before it
+    const int listener = socket( AF_INET, SOCK_STREAM, 0 );
+    const std::string stream_port = listen_locally( listener );
+    listen( listener, 2 );
+    {
+        network_sink collector( "127.0.0.1", stream_port.c_str(), network::tcp_length_prefixed );
+        set_output( collector );
+
+        qlog::info << "a";
+        qlog::info << "bc";
+        const int connection = accept( listener, 0, 0 );
+        for( int i = 0; i < 1000 && collector.pending(); ++i )
+        {
+            usleep( 1000 );
+            collector.flush();
+        }
+        CHECK( collector.connected() );
+        CHECK_EQUAL( std::string( "\0\0\0\1a\0\0\0\2bc", 11 ), receive( connection, 11 ) );
+        remove_output( collector );
+        close( connection );
     }
+    {
+        network_sink collector( "127.0.0.1", stream_port.c_str(), network::tcp_syslog, "unittests" );
+        set_output( collector );
+
+        qlog::warning << "framed";
+        const int connection = accept( listener, 0, 0 );
+        for( int i = 0; i < 1000 && collector.pending(); ++i )
+        {
+            usleep( 1000 );
+            collector.flush();
+        }
+        const std::string framed = receive( connection, 1 );
+        const size_t space = framed.find( ' ' );
+        CHECK_EQUAL( framed.size() - space - 1, static_cast<size_t>( std::atoi( framed.c_str() ) ) );
+        CHECK_EQUAL( "<12>1 ", framed.substr( space + 1, 6 ) );
+        CHECK_EQUAL( tail.str() + "framed", framed.substr( framed.size() - tail.str().size() - 6 ) );
+        remove_output( collector );
+        close( connection );
+    }
+    close( listener );
+
+    // nobody listens anymore: the messages wait, up to the size of the buffer
+    {
+        network_sink collector( "127.0.0.1", stream_port.c_str(), network::tcp_syslog, "unittests", 1, 256 );
+        set_output( collector );
+        for( int i = 0; i < 10; ++i )
+            qlog::info << "message " << i;
+        CHECK( !collector.connected() );
+        CHECK( collector.pending() <= 256 );
+        CHECK( collector.pending() > 0 );
+        CHECK( collector.dropped() > 0 );
+        remove_output( collector );
+    }
+
+    network_sink unknown( "unknown.invalid", "514" );
+    CHECK( !unknown.is_resolved() );
+    CHECK( !unknown.connected() );
 }
 #endif
 
+TEST_FIXTURE( qlog_resetter, PrefixFields )
+{
+    std::cout << "PrefixFields" << std::endl;
+
+    set_loglevel( loglevel::warning );
+
+    std::ostringstream ostr ;
+    set_output( ostr );
+
+    qlog::warning.prepend() << level_tag() << " " << source_location() << " [" << thread_id() << "] ";
+    QLOG_WARNING << "x"; const int line = __LINE__;
+    qlog::warning << "y";
+
+    std::ostringstream expected;
+    expected << "WARNING unittests.cpp:" << line << " [";
+    const std::string result = ostr.str();
+    CHECK_EQUAL( expected.str(), result.substr( 0, expected.str().size() ) );
+
+    const size_t close = result.find( "] x" );
+    CHECK( close != std::string::npos && close > expected.str().size() );
+    const std::string id = result.substr( expected.str().size(), close - expected.str().size() );
+    CHECK_EQUAL( std::string::npos, id.find_first_not_of( "0123456789" ) );
+    CHECK_EQUAL( "WARNING  [" + id + "] y", result.substr( close + 3 ) );
+}
+
+TEST_FIXTURE( qlog_resetter, TimestampField )
+{
+    std::cout << "TimestampField" << std::endl;
+
+    set_loglevel( loglevel::warning );
+
+    std::ostringstream ostr ;
+    set_output( ostr );
+
+    qlog::warning.prepend() << timestamp( 3, true ) << "|";
+    qlog::error.prepend() << timestamp( 0 ) << "|";
+    qlog::warning << "a";
+    qlog::error << "b";
+
+    // 2014-03-01 12:30:45.123|a2014-03-01 12:30:45|b
+    const std::string result = ostr.str();
+    CHECK_EQUAL( 25UL + 21UL, result.size() );
+    CHECK_EQUAL( "|a", result.substr( 23, 2 ) );
+    CHECK_EQUAL( "|b", result.substr( 44, 2 ) );
+    const std::string pattern = "dddd-dd-dd dd:dd:dd.ddd|adddd-dd-dd dd:dd:dd|b";
+    for( size_t i = 0; i < pattern.size() && i < result.size(); ++i )
+    {
+        if( 'd' == pattern[i] )
+            CHECK( result[i] >= '0' && result[i] <= '9' );
+        else
+            CHECK_EQUAL( pattern[i], result[i] );
+    }
+}
+
+TEST_FIXTURE( qlog_resetter, CustomFlavour )
+{
+    std::cout << "CustomFlavour\n";
+    set_output( std::cout );
+    set_loglevel( loglevel::info );
+
+    qlog::info.prepend() << "[" << color(gray) << ".." << color() << "] ";
+    qlog::warning.prepend() << "[" << color( green ) << "ww" << color() << "] ";
+    qlog::error.prepend() << "[" << color( red, true ) << blink() << "EE" << color() << "] " << color(true);
+    qlog::error.append() << color();
+
+    qlog::info      << "A custom flavor info line\n";
+    qlog::warning   << "A custom flavor warning line\n";
+    qlog::error     << "A custom flavor error line\n";
+}
+
+TEST_FIXTURE( qlog_resetter, ColorCopy )
+{
+    std::cout << "ColorCopy\n";
+    qlog::color vert(green);
+    qlog::color copy( vert );
+
+#ifndef WIN32
+    CHECK_EQUAL(vert.getBold(), copy.getBold());
+    CHECK_EQUAL(vert.getForeground(), copy.getForeground());
+    CHECK_EQUAL(vert.getBackground(), copy.getBackground());
+#else
+    CHECK_EQUAL(vert.getAttributes(), copy.getAttributes());
+#endif
+}
+
+#ifndef WIN32
+/**@brief A sink that says it is a terminal */
+struct terminal_sink : public sink
+{
+    terminal_sink() : m_text() { }
+    virtual void write( const char * _data, size_t _size ) { m_text.append( _data, _size ); }
+    virtual void flush() { }
+    virtual bool terminal() const { return true; }
+
+    std::string m_text;
+};
+
+TEST_FIXTURE( qlog_resetter, ColorPolicy )
+{
+    std::cout << "ColorPolicy" << std::endl;
+    set_loglevel( loglevel::info );
+    std::ostringstream file;
+    set_output( file );
+
+    // nothing is a terminal: the colors are not even written
+    qlog::info.prepend() << color( green ) << "[..] " << color();
+    qlog::info << color( red, true ) << "a" << underline() << "b" << color();
+    CHECK_EQUAL( "[..] ab", file.str() );
+
+    // the terminal gets the colors, the other sinks do not
+    terminal_sink terminal;
+    qlog::info.add_output( terminal );
+    qlog::info << "c" << color( red, blue ) << "d";
+    CHECK_EQUAL( "[..] ab[..] cd", file.str() );
+    CHECK_EQUAL( "\033[32m[..] \033[0mc\033[31;44md", terminal.m_text );
+
+    set_color_policy( colors::always );
+    qlog::info.remove_output( terminal );
+    qlog::info << color( red );
+    CHECK_EQUAL( "[..] ab[..] cd\033[32m[..] \033[0m\033[31m", file.str() );
+
+    set_color_policy( colors::never );
+    qlog::info.prepend().reset();
+    qlog::info.add_output( terminal );
+    terminal.m_text.clear();
+    qlog::info << "e" << blink() << "f";
+    CHECK_EQUAL( "ef", terminal.m_text );
+    qlog::info.remove_output( terminal );
+
+    // a stream is a terminal when set_output() is told so
+    set_color_policy( colors::automatic );
+    std::ostringstream console;
+    set_output( console, true );
+    qlog::info << color( red ) << "g";
+    CHECK_EQUAL( "\033[31mg", console.str() );
+}
+#endif
+
+static unsigned evaluations = 0;
+
+static unsigned evaluate()
+{
+    return ++evaluations;
+}
+
+TEST_FIXTURE( qlog_resetter, CompiledOutLevel )
+{
+    std::cout << "CompiledOutLevel" << std::endl;
+
+    // QLOG_MIN_LEVEL defaults to loglevel::debug: level 0 is compiled out
+    logger<0> below_floor;
+    std::ostringstream output;
+    below_floor.set_output( output );
+    set_loglevel( 0 );
+
+    below_floor << "a" << color( red ) << 1 << std::endl;
+    CHECK( !below_floor.enabled() );
+    CHECK_EQUAL( "", output.str() );
+
+    evaluations = 0;
+    QLOG_LOG( below_floor ) << evaluate();
+    CHECK_EQUAL( 0U, evaluations );
+}
+
+TEST_FIXTURE( qlog_resetter, MacroSkipsFilteredMessages )
+{
+    std::cout << "MacroSkipsFilteredMessages" << std::endl;
+    std::ostringstream output;
+    set_output( output );
+    set_loglevel( loglevel::info );
+
+    evaluations = 0;
+    QLOG_DEBUG << evaluate();
+    QLOG_TRACE << evaluate();
+    QLOG_INFO << evaluate();
+    QLOG_WARNING << evaluate() << std::endl;
+    QLOG_ERROR << evaluate();
+
+    CHECK_EQUAL( 3U, evaluations );
+    CHECK_EQUAL( "12\n3", output.str() );
+
+    if ( evaluations == 0 )
+        QLOG_ERROR << "dangling";
+    else
+        evaluations = 0;
+    CHECK_EQUAL( 0U, evaluations );
+}
+
+TEST_FIXTURE( qlog_resetter, Modules )
+{
+    std::cout << "Modules" << std::endl;
+    std::ostringstream output;
+    set_output( output );
+    set_loglevel( loglevel::warning );
+
+    qlog::module net( "net" );
+    qlog::module http( "net.http" );
+    qlog::module dns( "net.dns" );
+    CHECK_EQUAL( std::string( "net.http" ), http.name() );
+    CHECK_EQUAL( loglevel::warning, http.get_level() );
+
+    // the children follow the level of their parent, unless they have one
+    net.set_level( loglevel::debug );
+    dns.set_level( loglevel::error );
+    CHECK_EQUAL( loglevel::debug, qlog::module( "net.http" ).get_level() );
+    CHECK_EQUAL( loglevel::error, dns.get_level() );
+
+    evaluations = 0;
+    QLOG_MODULE( http, qlog::debug ) << evaluate();
+    QLOG_MODULE( dns, qlog::warning ) << evaluate();
+    qlog::info << "not output";
+    qlog::info << http << "2";
+    CHECK_EQUAL( 1U, evaluations );
+    CHECK_EQUAL( "12", output.str() );
+
+    net.reset_level();
+    set_loglevel( loglevel::error );
+    CHECK_EQUAL( loglevel::error, http.get_level() );
+    QLOG_MODULE( http, qlog::warning ) << evaluate();
+    CHECK_EQUAL( 1U, evaluations );
+
+    // the outputs of a module are shared by its children, and by every level
+    std::ostringstream net_output;
+    ostream_sink net_sink( &net_output );
+    CHECK( net.set_output( net_sink ) );
+    qlog::info.prepend() << module_name() << ": ";
+    http.set_level( loglevel::info );
+    QLOG_MODULE( http, qlog::info ) << "a";
+    qlog::error << dns << "b";
+    qlog::error << "c";
+    CHECK_EQUAL( "net.http: ab", net_output.str() );
+    CHECK_EQUAL( "12c", output.str() );
+
+    net.remove_output( net_sink );
+    qlog::error << http << "d";
+    CHECK_EQUAL( "12cd", output.str() );
+}
+
+TEST_FIXTURE( qlog_resetter, BacktraceRing )
+{
+    std::cout << "BacktraceRing" << std::endl;
+    std::ostringstream ostr;
+    set_output( ostr );
+    set_loglevel( loglevel::info );
+    set_backtrace( 3 );
+
+    // the filtered messages are kept, the last ones only
+    qlog::debug.prepend() << "[d] ";
+    for( int i = 0; i < 5; ++i )
+        qlog::debug << "step " << i << '\n';
+    QLOG_DEBUG << "step 5\n";
+    qlog::info << "ok\n";
+    CHECK_EQUAL( "ok\n", ostr.str() );
+
+    // and written before an error, once
+    qlog::error << "failed\n";
+    qlog::error << "failed again\n";
+    CHECK_EQUAL( "ok\n[d] step 3\n[d] step 4\n[d] step 5\nfailed\nfailed again\n", ostr.str() );
+
+    // a module keeps the messages below its own level
+    ostr.str( "" );
+    qlog::module net( "net" );
+    net.set_level( loglevel::warning );
+    QLOG_MODULE( net, qlog::info ) << "connecting\n";
+    qlog::info << net << "connected\n";
+    qlog::error << "lost\n";
+    CHECK_EQUAL( "connecting\nconnected\nlost\n", ostr.str() );
+
+    // set_backtrace() forgets what was kept
+    ostr.str( "" );
+    qlog::debug << "forgotten\n";
+    set_backtrace( 0 );
+    qlog::debug << "not kept\n";
+    set_backtrace( 3 );
+    qlog::error << "failed\n";
+    CHECK_EQUAL( "failed\n", ostr.str() );
+
+    // a message longer than the whole ring is cut, not forgotten
+    ostr.str( "" );
+    set_backtrace( 1 );
+    qlog::debug << "long " << std::string( 1000, 'x' ) << 42 << '\n';
+    qlog::error << "failed\n";
+    const std::string text = ostr.str();
+    const std::string end( "xxx [...]\nfailed\n" );
+    CHECK( text.size() < QLOG_BACKTRACE_RECORD_SIZE );
+    CHECK_EQUAL( 0U, text.find( "[d] long xxx" ) );
+    CHECK( text.size() > end.size() && 0 == text.compare( text.size() - end.size(), end.size(), end ) );
+    qlog::debug.prepend().reset();
+}
+
+#ifdef TEST_MULTITHREADING
+void multithreading_test_one(const char ch, const unsigned maxIter)
+{
+    unsigned i = 0;
+    while (i++ < maxIter)
+        qlog::info << ch << ch << ch << ch << ch << ch;
+}
+
+
+TEST_FIXTURE( qlog_resetter, MultithreadingTestOne )
+{
+    std::cout << "MultithreadingTestOne" << std::endl;
+
+    std::ostringstream ostr;
+    set_loglevel( loglevel::info );
+    set_output( ostr );
+
+    std::thread t1( multithreading_test_one, 'a', 80000);
+    std::thread t2( multithreading_test_one, 'b', 80000);
+
+    t1.join();
+    t2.join();
+
+    const std::string & result = ostr.str();
+
+    CHECK_EQUAL( 0, result.size() % 6 );
+    for ( std::string::const_iterator it = result.begin(); it != result.end(); )
+    {
+        const char first_char = *it++;
+        CHECK_EQUAL( first_char, *it++ );
+        CHECK_EQUAL( first_char, *it++ );
+        CHECK_EQUAL( first_char, *it++ );
+        CHECK_EQUAL( first_char, *it++ );
+        CHECK_EQUAL( first_char, *it++ );
+    }
+}
+
+void multithreading_test_levels(const char ch, const unsigned maxIter)
+{
+    unsigned i = 0;
+    while (i++ < maxIter)
+    {
+        qlog::info << ch << ch << ch;
+        qlog::warning << ch << ch << ch;
+        qlog::error << ch << ch << ch;
+    }
+}
+
+TEST_FIXTURE( qlog_resetter, MultithreadingLevelsShareOutput )
+{
+    std::cout << "MultithreadingLevelsShareOutput" << std::endl;
+
+    std::ostringstream ostr;
+    set_loglevel( loglevel::info );
+    set_output( ostr );
+
+    std::thread t1( multithreading_test_levels, 'e', 30000);
+    std::thread t2( multithreading_test_levels, 'f', 30000);
+
+    t1.join();
+    t2.join();
+
+    const std::string & result = ostr.str();
+
+    CHECK_EQUAL( 2U * 30000 * 9, result.size() );
+    for ( std::string::const_iterator it = result.begin(); it != result.end(); )
+    {
+        const char first_char = *it++;
+        CHECK_EQUAL( first_char, *it++ );
+        CHECK_EQUAL( first_char, *it++ );
+    }
+}
+
+void createSomeThreads();
+bool other_unit_error_enabled();
+const void * other_unit_error_logger();
+
+TEST_FIXTURE( qlog_resetter, MultithreadingStats )
+{
+    std::cout << "MultithreadingStats" << std::endl;
+
+    std::ostringstream ostr;
+    set_loglevel( loglevel::warning );
+    set_output( ostr );
+
+    std::thread t1( multithreading_test_levels, 'g', 10000);
+    std::thread t2( multithreading_test_levels, 'h', 10000);
+
+    t1.join();
+    t2.join();
+
+    stats now = get_stats();
+    CHECK_EQUAL( 0U, now.m_levels[loglevel::info].m_emitted );
+    CHECK_EQUAL( 20000U, now.m_levels[loglevel::info].m_filtered );
+    CHECK_EQUAL( 20000U, now.m_levels[loglevel::warning].m_emitted );
+    CHECK_EQUAL( 0U, now.m_levels[loglevel::warning].m_filtered );
+    CHECK_EQUAL( 60000U, now.m_levels[loglevel::warning].m_bytes );
+    CHECK_EQUAL( 20000U, now.m_levels[loglevel::error].m_emitted );
+    CHECK_EQUAL( 0U, now.m_queue_high_water );
+
+    // destroy() starts the counters again
+    qlog::destroy();
+    set_async( 16 );
+    CHECK( qlog::init() );
+    set_loglevel( loglevel::info );
+    set_output( ostr );
+
+    for( int i = 0; i < 100; ++i )
+        qlog::info << "message";
+    qlog::flush();
+
+    now = get_stats();
+    CHECK_EQUAL( 100U, now.m_levels[loglevel::info].m_emitted );
+    CHECK_EQUAL( 0U, now.m_levels[loglevel::warning].m_emitted );
+    CHECK_EQUAL( 0U, now.m_queue_depth );
+    CHECK( now.m_queue_high_water >= 1 && now.m_queue_high_water <= 16 );
+    CHECK_EQUAL( 0U, now.m_dropped );
+
+    // more threads than stripes: the ones that share a stripe lose no update
+    std::thread threads[2 * QLOG_STATS_STRIPES];
+    for( size_t i = 0; i < 2 * QLOG_STATS_STRIPES; ++i )
+        threads[i] = std::thread( []{ for( int j = 0; j < 20000; ++j ) qlog::debug << "filtered"; } );
+    for( size_t i = 0; i < 2 * QLOG_STATS_STRIPES; ++i )
+        threads[i].join();
+    now = get_stats();
+    CHECK_EQUAL( 2U * QLOG_STATS_STRIPES * 20000U, now.m_levels[loglevel::debug].m_filtered );
+}
+
+TEST_FIXTURE( qlog_resetter, MultithreadingTestTwo )
+{
+    std::cout << "MultithreadingTestTwo" << std::endl;
+
+    std::ostringstream ostr;
+    set_loglevel( loglevel::info );
+    set_output( ostr );
+
+    std::thread t1( multithreading_test_one, 'c', 80000);
+    std::thread t2( multithreading_test_one, 'd', 80000);
+
+    createSomeThreads();
+
+    t1.join();
+    t2.join();
+
+    const std::string & result = ostr.str();
+
+    CHECK_EQUAL( 0, result.size() % 6 );
+    for ( std::string::const_iterator it = result.begin(); it != result.end(); )
+    {
+        const char first_char = *it++;
+        CHECK_EQUAL( first_char, *it++ );
+        CHECK_EQUAL( first_char, *it++ );
+        CHECK_EQUAL( first_char, *it++ );
+        CHECK_EQUAL( first_char, *it++ );
+        CHECK_EQUAL( first_char, *it++ );
+    }
+}
+
+TEST_FIXTURE( qlog_resetter, MultithreadingExternLoggers )
+{
+    std::cout << "MultithreadingExternLoggers" << std::endl;
+    std::ostringstream ostr;
+    set_output( ostr );
+
+    // unittests2.cpp sees the very same loggers
+    CHECK_EQUAL( static_cast<const void *>( &qlog::error ), other_unit_error_logger() );
+    CHECK( other_unit_error_enabled() );
+    qlog::error.disable();
+    CHECK( !other_unit_error_enabled() );
+    qlog::error.enable();
+}
+
+void multithreading_test_decorations(const char ch, const unsigned maxIter)
+{
+    unsigned i = 0;
+    while (i++ < maxIter)
+        qlog::info << ch << ch << std::endl;
+}
+
+TEST_FIXTURE( qlog_resetter, MultithreadingDecorations )
+{
+    std::cout << "MultithreadingDecorations" << std::endl;
+
+    std::ostringstream ostr;
+    set_loglevel( loglevel::info );
+    set_output( ostr );
+    qlog::info.prepend() << "<";
+    qlog::info.append() << ">";
+
+    std::thread t1( multithreading_test_decorations, 'a', 40000);
+    std::thread t2( multithreading_test_decorations, 'b', 40000);
+
+    t1.join();
+    t2.join();
+
+    const std::string & result = ostr.str();
+
+    CHECK_EQUAL( 5UL * 80000, result.size() );
+    for ( std::string::const_iterator it = result.begin(); it + 5 <= result.end(); it += 5 )
+        CHECK_EQUAL( std::string( "<" ) + it[1] + it[1] + "\n>", std::string( it, it + 5 ) );
+}
+
+void flip_loglevel(const unsigned maxIter)
+{
+    unsigned i = 0;
+    while (i++ < maxIter)
+    {
+        set_loglevel( i % 2 ? loglevel::error : loglevel::info );
+        if ( i % 3 )
+            qlog::info.disable();
+        else
+            qlog::info.enable();
+    }
+    set_loglevel( loglevel::info );
+    qlog::info.enable();
+}
+
+TEST_FIXTURE( qlog_resetter, LoglevelChangedWhileLogging )
+{
+    std::cout << "LoglevelChangedWhileLogging" << std::endl;
+
+    std::ostringstream ostr;
+    set_loglevel( loglevel::info );
+    set_output( ostr );
+
+    std::thread t1( multithreading_test_one, 'a', 80000);
+    std::thread t2( flip_loglevel, 80000 );
+
+    t1.join();
+    t2.join();
+
+    const std::string & result = ostr.str();
+
+    CHECK_EQUAL( 0UL, result.size() % 6 );
+    CHECK( result.size() <= 6UL * 80000 );
+    CHECK_EQUAL( std::string( result.size(), 'a' ), result );
+}
+
+TEST_FIXTURE( qlog_resetter, AsyncWrite )
+{
+    std::cout << "AsyncWrite" << std::endl;
+
+    qlog::destroy();
+    set_async( 16 );
+    CHECK( qlog::init() );
+
+    std::ostringstream ostr;
+    set_loglevel( loglevel::info );
+    set_output( ostr );
+    qlog::info.prepend() << "[";
+    qlog::info.append() << "]";
+
+    qlog::info << "a" << 1 << std::endl;
+    qlog::warning << "b";
+    qlog::debug << "c";
+    qlog::error << std::string( 1000, 'd' );
+    qlog::flush();
+
+    CHECK_EQUAL( "[a1\n]b" + std::string( 1000, 'd' ), ostr.str() );
+}
+
+#ifdef __linux__
+/**@brief Remembers the processor and the nice value of the thread writing to it */
+struct placement_sink : public sink
+{
+    placement_sink()
+        :m_cpu( -1 )
+        ,m_nice( 0 )
+        ,m_text()
+    {
+    }
+
+    virtual void write( const char * _data, size_t _size )
+    {
+        m_cpu = sched_getcpu();
+        m_nice = getpriority( PRIO_PROCESS, static_cast<id_t>( syscall( SYS_gettid ) ) );
+        m_text.append( _data, _size );
+    }
+
+    virtual void flush() { }
+
+    int m_cpu;
+    int m_nice;
+    std::string m_text;
+};
+
+TEST_FIXTURE( qlog_resetter, AsyncWriterPlacement )
+{
+    std::cout << "AsyncWriterPlacement" << std::endl;
+
+    // the last processor this process may run on
+    cpu_set_t allowed;
+    CHECK_EQUAL( 0, sched_getaffinity( 0, sizeof( allowed ), &allowed ) );
+    int cpu = CPU_SETSIZE - 1;
+    while( cpu > 0 && !CPU_ISSET( cpu, &allowed ) )
+        --cpu;
+
+    const unsigned strategies[] = { writer_wait::sleep, writer_wait::spin_then_sleep, writer_wait::busy_poll };
+    for( size_t i = 0; i < sizeof( strategies ) / sizeof( *strategies ); ++i )
+    {
+        qlog::destroy();
+        set_async( 16 );
+        set_writer_affinity( static_cast<unsigned>( cpu ) );
+        set_writer_priority( 19 );
+        set_writer_wait( strategies[i], 200, 5 );
+        CHECK( qlog::init() );
+
+        placement_sink placed;
+        set_loglevel( loglevel::info );
+        set_output( placed );
+        for( int j = 0; j < 100; ++j )
+            qlog::info << "message " << j << '\n';
+        qlog::flush();
+
+        CHECK( writer_configured() );
+        CHECK_EQUAL( cpu, placed.m_cpu );
+        CHECK_EQUAL( 19, placed.m_nice );
+        CHECK_EQUAL( 100 * 10 + 90, static_cast<int>( placed.m_text.size() ) );
+
+        // the main thread is left as it was
+        CHECK( 19 != getpriority( PRIO_PROCESS, static_cast<id_t>( syscall( SYS_gettid ) ) ) );
+        qlog::destroy();
+        CHECK( qlog::init() );
+    }
+}
+#endif
+
+TEST_FIXTURE( qlog_resetter, AsyncMultithreading )
+{
+    std::cout << "AsyncMultithreading" << std::endl;
+
+    qlog::destroy();
+    set_async( 64, overflow::block );
+    CHECK( qlog::init() );
+
+    std::ostringstream ostr;
+    set_loglevel( loglevel::info );
+    set_output( ostr );
+
+    std::thread t1( multithreading_test_one, 'a', 20000);
+    std::thread t2( multithreading_test_one, 'b', 20000);
+
+    t1.join();
+    t2.join();
+    qlog::flush();
+
+    const std::string & result = ostr.str();
+
+    CHECK_EQUAL( 6UL * 40000, result.size() );
+    CHECK_EQUAL( 0UL, get_dropped_messages() );
+    for ( std::string::const_iterator it = result.begin(); it + 6 <= result.end(); it += 6 )
+        CHECK_EQUAL( std::string( 6, *it ), std::string( it, it + 6 ) );
+}
+
+static void async_overflow_test( unsigned _policy )
+{
+    qlog::destroy();
+    set_async( 4, _policy );
+    CHECK( qlog::init() );
+
+    std::ostringstream ostr;
+    set_loglevel( loglevel::info );
+    set_output( ostr );
+
+    std::thread t1( multithreading_test_one, 'a', 20000);
+    std::thread t2( multithreading_test_one, 'b', 20000);
+
+    t1.join();
+    t2.join();
+    qlog::flush();
+
+    const std::string & result = ostr.str();
+
+    CHECK_EQUAL( 0UL, result.size() % 6 );
+    CHECK_EQUAL( 40000UL, result.size() / 6 + get_dropped_messages() );
+    for ( std::string::const_iterator it = result.begin(); it + 6 <= result.end(); it += 6 )
+        CHECK_EQUAL( std::string( 6, *it ), std::string( it, it + 6 ) );
+}
+
+TEST_FIXTURE( qlog_resetter, AsyncDrop )
+{
+    std::cout << "AsyncDrop" << std::endl;
+    async_overflow_test( overflow::drop );
+}
+
+TEST_FIXTURE( qlog_resetter, AsyncOverwriteOldest )
+{
+    std::cout << "AsyncOverwriteOldest" << std::endl;
+    async_overflow_test( overflow::overwrite_oldest );
+}
+
+/**@brief Logs lines of 100, 300 and 700 bytes, most of them longer than a slot of the ring */
+static void log_long_lines( char _c, int _lines )
+{
+    static const size_t lengths[] = { 100, 300, 700 };
+    for( int i = 0; i < _lines; ++i )
+        qlog::info << std::string( lengths[i % 3] - 1, _c ) << '\n';
+}
+
+TEST_FIXTURE( qlog_resetter, AsyncOverwriteOldestLongMessages )
+{
+    std::cout << "AsyncOverwriteOldestLongMessages" << std::endl;
+    qlog::destroy();
+    set_async( 16, overflow::overwrite_oldest );
+    CHECK( qlog::init() );
+
+    std::ostringstream ostr;
+    set_loglevel( loglevel::info );
+    set_output( ostr );
+
+    std::thread threads[6];
+    for( int i = 0; i < 6; ++i )
+        threads[i] = std::thread( log_long_lines, static_cast<char>( 'a' + i ), 30000 );
+    for( int i = 0; i < 6; ++i )
+        threads[i].join();
+    qlog::flush();
+
+    // the messages that were not overwritten are whole
+    const std::string result = ostr.str();
+    size_t lines = 0;
+    for( size_t start = 0; start < result.size(); ++lines )
+    {
+        const size_t end = result.find( '\n', start );
+        CHECK( std::string::npos != end );
+        if( std::string::npos == end )
+            break;
+
+        const size_t length = end - start + 1;
+        CHECK( 100 == length || 300 == length || 700 == length );
+        CHECK( std::string::npos == result.find_first_not_of( result[start], start ) || result.find_first_not_of( result[start], start ) == end );
+        start = end + 1;
+    }
+    CHECK_EQUAL( 180000UL, lines + get_dropped_messages() );
+}
+
+/**@brief A string_sink that the writer thread fills while the test thread waits for its flushes */
+struct waited_sink : public sink
+{
+    waited_sink()
+        :m_mutex()
+        ,m_flushed()
+        ,m_text()
+        ,m_flushes( 0 )
+    {
+    }
+
+    virtual void write( const char * _data, size_t _size )
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        m_text.append( _data, _size );
+    }
+
+    virtual void flush()
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        ++m_flushes;
+        m_flushed.notify_all();
+    }
+
+    /**@brief Waits until the sink was flushed that many times, 5 seconds at most
+     * @param[out] _text What was written when it was */
+    bool wait_flushes( int _flushes, std::string & _text )
+    {
+        std::unique_lock<std::mutex> lock( m_mutex );
+        const bool flushed = m_flushed.wait_for( lock, std::chrono::seconds( 5 ), [&]{ return m_flushes >= _flushes; } );
+        _text = m_text;
+        return flushed && m_flushes == _flushes;
+    }
+
+private:
+    std::mutex m_mutex;
+    std::condition_variable m_flushed;
+    std::string m_text;
+    int m_flushes;
+};
+
+TEST_FIXTURE( qlog_resetter, AsyncBatchedFlush )
+{
+    std::cout << "AsyncBatchedFlush" << std::endl;
+
+    // the policy is set before the writer thread, which reads it, starts
+    qlog::destroy();
+    set_async();
+    set_flush_policy( 4, 0, loglevel::error );
+    CHECK( qlog::init() );
+
+    set_loglevel( loglevel::info );
+    waited_sink output;
+    set_output( output );
+
+    // the writer thread flushed once enough bytes were written, not at each std::endl
+    std::string text;
+    qlog::info << "a" << std::endl;
+    qlog::info << "b" << std::endl;
+    CHECK( output.wait_flushes( 1, text ) );
+    CHECK_EQUAL( "a\nb\n", text );
+
+    // and once what it wrote is old enough
+    qlog::destroy();
+    set_async();
+    set_flush_policy( 0, 20, loglevel::error );
+    CHECK( qlog::init() );
+    set_loglevel( loglevel::info );
+    set_output( output );
+
+    qlog::info << "c" << std::endl;
+    CHECK( output.wait_flushes( 2, text ) );
+    CHECK_EQUAL( "a\nb\nc\n", text );
+    qlog::destroy();
+    CHECK( qlog::init() );
+}
+
+struct point
+{
+    int x;
+    int y;
+};
+
+static std::ostream & operator<<( std::ostream & _ostr, const point & _point )
+{
+    return _ostr << '(' << _point.x << ',' << _point.y << ')';
+}
+
+TEST_FIXTURE( qlog_resetter, AsyncDeferredFormatting )
+{
+    std::cout << "AsyncDeferredFormatting" << std::endl;
+    qlog::destroy();
+    set_async();
+    set_deferred_formatting();
+    CHECK( qlog::init() );
+
+    std::ostringstream ostr;
+    set_loglevel( loglevel::info );
+    set_output( ostr );
+    qlog::info.prepend() << "<";
+    qlog::info.append() << ">";
+
+    const point p = { 1, 2 };
+    const std::string str( "str" );
+    qlog::info << 42 << ' ' << -7L << ' ' << 2.5 << ' ' << true << ' ' << str << ' ' << "lit" << ' '
+               << std::setw( 4 ) << "pad" << ' ' << std::hex << 255 << ' ' << std::setw( 4 ) << std::setfill( '0' ) << 7 << ' ' << p << std::endl;
+    qlog::info << std::dec << 10;
+    qlog::flush();
+
+    CHECK_EQUAL( "<42 -7 2.5 1 str lit  pad ff 0007 (1,2)\n><10>", ostr.str() );
+    qlog::info.prepend().reset();
+    qlog::info.append().reset();
+}
+
+TEST_FIXTURE( qlog_resetter, AsyncBacktraceRing )
+{
+    std::cout << "AsyncBacktraceRing" << std::endl;
+    qlog::destroy();
+    set_async();
+    CHECK( qlog::init() );
+
+    std::ostringstream ostr;
+    set_loglevel( loglevel::warning );
+    set_output( ostr );
+    set_backtrace( 2, loglevel::info );
+
+    // each thread writes what it kept itself
+    std::thread other( []{ qlog::info << "other\n"; } );
+    other.join();
+    qlog::debug << "not kept\n";
+    qlog::info << "first " << 1 << '\n';
+    qlog::info << "second " << 2.5 << '\n';
+    qlog::error << "failed\n";
+    qlog::flush();
+    CHECK_EQUAL( "first 1\nsecond 2.5\nfailed\n", ostr.str() );
+}
+
+#ifndef WIN32
+TEST_FIXTURE( qlog_resetter, AsyncCrashHandler )
+{
+    std::cout << "AsyncCrashHandler" << std::endl;
+
+    std::ostringstream name;
+    name << "/tmp/qlog_unittests_" << getpid() << ".crash";
+    const std::string rotated = name.str() + ".rotated";
+
+    const pid_t child = fork();
+    if( 0 == child )
+    {
+        struct rlimit no_core = { 0, 0 };
+        setrlimit( RLIMIT_CORE, &no_core );
+
+        qlog::destroy();
+        set_async( 4096 );
+        set_crash_handler();
+        if( !qlog::init() )
+            _exit( 1 );
+
+        const int fd = open( name.str().c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+        fd_sink file( fd );
+        rotating_file_sink mapped( rotated.c_str() );
+        set_loglevel( loglevel::info );
+        set_output( file );
+        add_output( mapped );
+
+        // most of them are still in the ring when the program aborts
+        for( int i = 0; i < 1000; ++i )
+            qlog::info << "message " << i << '\n';
+        std::abort();
+    }
+
+    int status = 0;
+    CHECK_EQUAL( child, waitpid( child, &status, 0 ) );
+    CHECK( WIFSIGNALED( status ) );
+    CHECK_EQUAL( SIGABRT, WTERMSIG( status ) );
+
+    std::string expected;
+    for( int i = 0; i < 1000; ++i )
+    {
+        std::ostringstream line;
+        line << "message " << i << '\n';
+        expected += line.str();
+    }
+
+    std::ifstream file( name.str().c_str() );
+    const std::string written( ( std::istreambuf_iterator<char>( file ) ), std::istreambuf_iterator<char>() );
+    CHECK_EQUAL( expected, written );
+
+    std::ifstream mapped( rotated.c_str() );
+    const std::string copied( ( std::istreambuf_iterator<char>( mapped ) ), std::istreambuf_iterator<char>() );
+    CHECK_EQUAL( expected, copied );
+
+    std::remove( name.str().c_str() );
+    std::remove( rotated.c_str() );
+}
+#endif
+#endif
+
 #ifndef WIN32
 TEST_FIXTURE( qlog_resetter, ExceptionSafety )
 {
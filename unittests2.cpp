@@ -1,4 +1,14 @@
 #define QLOG_USE_ASSERTS
+#ifdef TEST_MULTITHREADING
+#   ifndef WIN32
+#       define QLOG_MULTITHREAD_CPP11
+#   else
+#		define QLOG_MULTITHREAD_WIN32
+#	endif
+#   define QLOG_ASYNC
+#   define QLOG_STATS
+#   define QLOG_EXTERN_LOGGERS
+#endif
 #include "qlog.hpp"
 
 #include <UnitTest++/UnitTest++.h>
@@ -19,4 +29,14 @@ void createSomeThreads()
     t1.join();
     t2.join();
 }
+
+bool other_unit_error_enabled()
+{
+    return qlog::error.enabled();
+}
+
+const void * other_unit_error_logger()
+{
+    return &qlog::error;
+}
 #endif